@@ -2,15 +2,41 @@
 
 #if CONFIG_USE_CANOPENNODE
 
+#include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "CANopen.h"
 #include "OD.h"
+#include "CANopenNode_ESP32.h"
+#include "CO_trace.h"
+#if CONFIG_CO_STORAGE_ENABLE
+#include "CO_storageNVS.h"
+#endif
+#if CONFIG_CO_PERIODIC_TASK_STATS
+#include <math.h>
+#endif
 
 #if (CONFIG_FREERTOS_HZ != 1000)
 #error "FreeRTOS tick interrupt frequency must be 1000Hz"
 #endif
+#if CONFIG_CO_PERIODIC_TASK_TIMER
+#define CO_PERIODIC_TASK_INTERVAL_US CONFIG_CO_PERIODIC_TASK_INTERVAL_US
+#else
 #define CO_PERIODIC_TASK_INTERVAL_US (CONFIG_CO_PERIODIC_TASK_INTERVAL_MS * 1000)
+#endif
 #define CO_MAIN_TASK_INTERVAL_US (CONFIG_CO_MAIN_TASK_INTERVAL_MS * 1000)
+/* FreeRTOS tick in microseconds */
+#define CO_TICK_US (1000000U / CONFIG_FREERTOS_HZ)
+#ifdef CONFIG_CO_MAIN_TASK_CORE
+#define CO_MAIN_TASK_CORE CONFIG_CO_MAIN_TASK_CORE
+#else
+#define CO_MAIN_TASK_CORE CONFIG_CO_TASK_CORE
+#endif
+#ifdef CONFIG_CO_PERIODIC_TASK_CORE
+#define CO_PERIODIC_TASK_CORE CONFIG_CO_PERIODIC_TASK_CORE
+#else
+#define CO_PERIODIC_TASK_CORE CONFIG_CO_TASK_CORE
+#endif
 
 static const char *TAG = "CO_ESP32";
 
@@ -18,7 +44,15 @@ static const char *TAG = "CO_ESP32";
 #define NMT_CONTROL (CO_NMT_control_t)(CO_NMT_STARTUP_TO_OPERATIONAL | CO_NMT_ERR_ON_ERR_REG | CO_ERR_REG_GENERIC_ERR | CO_ERR_REG_COMMUNICATION)
 
 static CO_t *CO = NULL;
-static void *CANptr = NULL;
+static void *CANptr = NULL; /* NULL: TWAI controller and GPIOs from Kconfig */
+#if CONFIG_CO_NODE_ID_UNCONFIGURED
+#define CO_DEFAULT_NODE_ID CO_LSS_NODE_ID_ASSIGNMENT
+#else
+#define CO_DEFAULT_NODE_ID CONFIG_CO_DEFAULT_NODE_ID
+#endif
+/* Configured by LSS master, active after communication reset or LSS activate */
+static uint8_t pendingNodeId = CO_DEFAULT_NODE_ID;
+static uint16_t pendingBitRate = CONFIG_CO_DEFAULT_BPS;
 
 static StaticTask_t xCoMainTaskBuffer;
 static StackType_t xCoMainStack[CONFIG_CO_MAIN_TASK_STACK_SIZE];
@@ -30,6 +64,138 @@ static StackType_t xCoPeriodicStack[CONFIG_CO_PERIODIC_TASK_STACK_SIZE];
 static TaskHandle_t xCoPeriodicTaskHandle = NULL;
 static void CO_periodicTask(void *pxParam);
 
+#if CONFIG_CO_PERIODIC_TASK_TIMER
+static esp_timer_handle_t xCoPeriodicTimer = NULL;
+#endif
+
+#if CONFIG_CO_STORAGE_ENABLE
+#if !defined(OD_ENTRY_H1010) || !defined(OD_ENTRY_H1011)
+#error "CO_STORAGE_ENABLE requires OD entries 0x1010 and 0x1011"
+#endif
+static CO_storage_t storage;
+static CO_storage_entry_t storageEntriesDefault[] = {
+    {
+        .addr = &OD_PERSIST_COMM,
+        .len = sizeof(OD_PERSIST_COMM),
+        .subIndexOD = 2,
+        .attr = CO_storage_cmd | CO_storage_restore,
+        .addrNV = NULL,
+    },
+};
+static CO_storage_entry_t *storageEntries = storageEntriesDefault;
+static uint8_t storageEntriesCount = sizeof(storageEntriesDefault) / sizeof(storageEntriesDefault[0]);
+#if (CONFIG_CO_STORAGE_AUTO_INTERVAL_MS > 0)
+#if (CONFIG_CO_STORAGE_TASK_PRIORITY >= CONFIG_CO_MAIN_TASK_PRIORITY)
+#error "Storage Task priority must be lower than Main Task priority"
+#endif
+static StaticTask_t xCoStorageTaskBuffer;
+static StackType_t xCoStorageStack[CONFIG_CO_STORAGE_TASK_STACK_SIZE];
+static TaskHandle_t xCoStorageTaskHandle = NULL;
+static void CO_storageTask(void *pxParam);
+#endif
+#endif
+
+#if CONFIG_CO_BOOT_TIME_LOG
+/* Initialization steps, recorded once, on the first communication reset */
+typedef enum
+{
+    CO_BOOT_MAIN_TASK,
+    CO_BOOT_CO_NEW,
+    CO_BOOT_STORAGE,
+    CO_BOOT_CAN_INIT,
+    CO_BOOT_CANOPEN_INIT,
+    CO_BOOT_PDO_INIT,
+    CO_BOOT_CAN_NORMAL,
+    CO_BOOT_FIRST_PROCESS,
+    CO_BOOT_FIRST_TPDO,
+    CO_BOOT_STEPS
+} CO_bootStep_t;
+
+#if (CO_CONFIG_PDO) & CO_CONFIG_TPDO_ENABLE
+#define CO_BOOT_LAST CO_BOOT_FIRST_TPDO
+#else
+#define CO_BOOT_LAST CO_BOOT_FIRST_PROCESS
+#endif
+
+static const char *const bootStepName[CO_BOOT_STEPS] = {
+    "main task",
+    "CO_new",
+    "storage",
+    "CAN init",
+    "CANopen init",
+    "PDO init",
+    "CAN normal mode",
+    "first process, bootup",
+    "first TPDO process",
+};
+static uint32_t bootTime_us[CO_BOOT_STEPS]; /* 0: not recorded */
+
+static void CO_bootTime(CO_bootStep_t step)
+{
+    uint32_t notRecorded = 0;
+    uint32_t time_us = (uint32_t)esp_timer_get_time() | 1;
+
+    __atomic_compare_exchange_n(&bootTime_us[step], &notRecorded, time_us, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/* Called from main task, logs once, after the last step is recorded */
+static void CO_bootTimeLog(void)
+{
+    static bool logged = false;
+    uint32_t previous_us = 0;
+    int i;
+
+    if (logged || (__atomic_load_n(&bootTime_us[CO_BOOT_LAST], __ATOMIC_ACQUIRE) == 0))
+    {
+        return;
+    }
+    logged = true;
+    for (i = 0; i <= CO_BOOT_LAST; i++)
+    {
+        if (bootTime_us[i] != 0)
+        {
+            ESP_LOGI(TAG, "boot %-22s %8lu us (+%lu us)", bootStepName[i], (unsigned long)bootTime_us[i], (unsigned long)(bootTime_us[i] - previous_us));
+            previous_us = bootTime_us[i];
+        }
+    }
+}
+/* Once a step is recorded, calls in loops cost only a load */
+#define CO_BOOT_TIME(step)                                                  \
+    do                                                                      \
+    {                                                                       \
+        if (__atomic_load_n(&bootTime_us[step], __ATOMIC_RELAXED) == 0U)    \
+        {                                                                   \
+            CO_bootTime(step);                                              \
+        }                                                                   \
+    } while (0)
+#else
+#define CO_BOOT_TIME(step)
+#endif /* CONFIG_CO_BOOT_TIME_LOG */
+
+#if CONFIG_CO_PERIODIC_TASK_STATS
+typedef struct
+{
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum;
+    uint64_t sumSq;
+} CO_timeAccumulator_t;
+
+static portMUX_TYPE xStatsSpinlock = portMUX_INITIALIZER_UNLOCKED;
+static CO_timeAccumulator_t periodAcc;
+static CO_timeAccumulator_t syncToTPDOAcc;
+static volatile uint32_t syncReceived_us = 0;
+#endif
+
+#if CONFIG_CO_STORAGE_ENABLE
+void CO_ESP32_setStorageEntries(CO_storage_entry_t *entries, uint8_t entriesCount)
+{
+    storageEntries = entries;
+    storageEntriesCount = entriesCount;
+}
+#endif
+
 bool CO_ESP32_init()
 {
     ESP_LOGI(TAG, "Initializing");
@@ -41,19 +207,403 @@ bool CO_ESP32_init()
         CONFIG_CO_MAIN_TASK_PRIORITY,
         &xCoMainStack[0],
         &xCoMainTaskBuffer,
-        CONFIG_CO_TASK_CORE);
+        CO_MAIN_TASK_CORE);
+    return true;
+}
+
+#if CONFIG_CO_PERIODIC_TASK_STATS
+static void CO_timeAccumulate(CO_timeAccumulator_t *acc, uint32_t time_us)
+{
+    taskENTER_CRITICAL(&xStatsSpinlock);
+    if ((acc->count == 0) || (time_us < acc->min_us))
+    {
+        acc->min_us = time_us;
+    }
+    if (time_us > acc->max_us)
+    {
+        acc->max_us = time_us;
+    }
+    acc->count++;
+    acc->sum += time_us;
+    acc->sumSq += (uint64_t)time_us * time_us;
+    taskEXIT_CRITICAL(&xStatsSpinlock);
+}
+
+static void CO_timeStatsGet(CO_timeAccumulator_t *acc, CO_ESP32_timeStats_t *stats)
+{
+    double mean = 0.0, variance = 0.0;
+
+    if (acc->count > 0)
+    {
+        mean = (double)acc->sum / acc->count;
+        variance = ((double)acc->sumSq / acc->count) - (mean * mean);
+    }
+    stats->count = acc->count;
+    stats->min_us = acc->min_us;
+    stats->max_us = acc->max_us;
+    stats->mean_us = (uint32_t)(mean + 0.5);
+    stats->stddev_us = (variance > 0.0) ? (uint32_t)(sqrt(variance) + 0.5) : 0;
+}
+
+void CO_ESP32_getPeriodicStats(CO_ESP32_periodicStats_t *stats, bool reset)
+{
+    CO_timeAccumulator_t period, syncToTPDO;
+
+    taskENTER_CRITICAL(&xStatsSpinlock);
+    period = periodAcc;
+    syncToTPDO = syncToTPDOAcc;
+    if (reset)
+    {
+        memset(&periodAcc, 0, sizeof(periodAcc));
+        memset(&syncToTPDOAcc, 0, sizeof(syncToTPDOAcc));
+    }
+    taskEXIT_CRITICAL(&xStatsSpinlock);
+
+    CO_timeStatsGet(&period, &stats->period);
+    CO_timeStatsGet(&syncToTPDO, &stats->syncToTPDO);
+}
+
+#if ((CO_CONFIG_SYNC) & CO_CONFIG_SYNC_ENABLE) && ((CO_CONFIG_SYNC) & CO_CONFIG_FLAG_CALLBACK_PRE)
+/* Called from CO_rxTask, when SYNC message is received */
+static void CO_syncReceivedCallback(void *object)
+{
+    syncReceived_us = (uint32_t)esp_timer_get_time();
+}
+#endif
+#endif /* CONFIG_CO_PERIODIC_TASK_STATS */
+
+#if CONFIG_CO_DRIVER_STATS && CONFIG_CO_DRIVER_STATS_OD_INDEX
+_Static_assert(sizeof(CO_CANstats_t) == (CO_CAN_STATS_VALUES * sizeof(uint32_t)), "CO_CANstats_t must contain only uint32_t");
+
+static OD_extension_t driverStatsExtension;
+
+/* Read driver statistics, subindex n is the n-th value of CO_CANstats_t */
+static ODR_t CO_driverStatsRead(OD_stream_t *stream, void *buf, OD_size_t count, OD_size_t *countRead)
+{
+    CO_CANstats_t stats;
+    const uint32_t *values = (const uint32_t *)&stats;
+
+    if ((stream == NULL) || (buf == NULL) || (countRead == NULL))
+    {
+        return ODR_DEV_INCOMPAT;
+    }
+    if (stream->subIndex == 0U)
+    {
+        return OD_readOriginal(stream, buf, count, countRead);
+    }
+    if (stream->subIndex > CO_CAN_STATS_VALUES)
+    {
+        return ODR_SUB_NOT_EXIST;
+    }
+    if (count < sizeof(uint32_t))
+    {
+        return ODR_DEV_INCOMPAT;
+    }
+
+    CO_CANmodule_getStats(CO->CANmodule, &stats, false);
+    CO_setUint32(buf, values[stream->subIndex - 1U]);
+    *countRead = sizeof(uint32_t);
+    return ODR_OK;
+}
+
+static void CO_driverStatsInitOD(void)
+{
+    OD_entry_t *entry = OD_find(OD, CONFIG_CO_DRIVER_STATS_OD_INDEX);
+
+    if (entry == NULL)
+    {
+        ESP_LOGW(TAG, "Driver statistics entry 0x%X not in Object Dictionary", CONFIG_CO_DRIVER_STATS_OD_INDEX);
+        return;
+    }
+    driverStatsExtension.object = NULL;
+    driverStatsExtension.read = CO_driverStatsRead;
+    driverStatsExtension.write = NULL;
+    OD_extension_init(entry, &driverStatsExtension);
+}
+#endif /* CONFIG_CO_DRIVER_STATS && CONFIG_CO_DRIVER_STATS_OD_INDEX */
+
+#if (CO_CONFIG_LSS) & CO_CONFIG_LSS_SLAVE
+/* LSS configure bit timing, accept only bit rates with TWAI timing */
+static bool_t CO_LSScheckBitRate(void *object, uint16_t bitRate)
+{
+    return CO_CANcheckBitRate(bitRate);
+}
+
+/* Node ID 1 to 127 or unconfigured, bit rate with TWAI timing */
+static bool_t CO_LSSconfigValid(uint8_t nodeId, uint16_t bitRate)
+{
+    return (((nodeId >= 1U) && (nodeId <= 127U)) || (nodeId == CO_LSS_NODE_ID_ASSIGNMENT)) &&
+           CO_CANcheckBitRate(bitRate);
+}
+
+/* LSS activate bit timing, called from CO_process() in main task. Starts the
+ * switch to pendingBitRate without communication reset, see CO_CANsetBitRate(). */
+static void CO_LSSactivateBitRate(void *object, uint16_t delay)
+{
+    if (!CO_CANsetBitRate((CO_CANmodule_t *)object, pendingBitRate, delay))
+    {
+        ESP_LOGE(TAG, "Bit rate %d kbit/s not activated", pendingBitRate);
+    }
+}
+
+#if CONFIG_CO_STORAGE_ENABLE
+/* LSS store configuration, called from CO_process() in main task */
+static bool_t CO_LSSstoreConfig(void *object, uint8_t id, uint16_t bitRate)
+{
+    return CO_storageNVS_writeLSS(id, bitRate);
+}
+
+/* Use node ID and bit rate stored by LSS instead of Kconfig defaults */
+static void CO_LSSrestoreConfig(void)
+{
+    uint8_t nodeId;
+    uint16_t bitRate;
+
+    if (!CO_storageNVS_readLSS(&nodeId, &bitRate))
+    {
+        return;
+    }
+    if (CO_LSSconfigValid(nodeId, bitRate))
+    {
+        pendingNodeId = nodeId;
+        pendingBitRate = bitRate;
+        ESP_LOGI(TAG, "LSS configuration restored: node ID %d, %d kbit/s", nodeId, bitRate);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Stored LSS configuration not valid, using defaults");
+    }
+}
+#endif /* CONFIG_CO_STORAGE_ENABLE */
+#endif /* (CO_CONFIG_LSS) & CO_CONFIG_LSS_SLAVE */
+
+#if CONFIG_CO_LSS_MASTER
+/* States of LSS fastscan commissioning, processed in main task */
+typedef enum
+{
+    CO_FASTSCAN_IDLE,
+    CO_FASTSCAN_START,   /* requested by CO_ESP32_LSSfastscanStart() */
+    CO_FASTSCAN_SCAN,    /* identify next slave without node ID */
+    CO_FASTSCAN_NODE_ID, /* configure node ID of the found slave */
+    CO_FASTSCAN_STORE,   /* store configuration of the found slave */
+} CO_fastscanState_t;
+
+static CO_fastscanState_t fastscanState = CO_FASTSCAN_IDLE;
+static CO_LSSmaster_fastscan_t fastscan;
+static CO_ESP32_LSSfastscanStatus_t fastscanStatus;
+static bool fastscanStore;
+static int64_t fastscanStart_us;
+
+/******************************************************************************/
+bool CO_ESP32_LSSfastscanStart(uint8_t firstNodeId, bool store)
+{
+    if ((firstNodeId < 1U) || (firstNodeId > 127U) ||
+        (__atomic_load_n(&fastscanState, __ATOMIC_ACQUIRE) != CO_FASTSCAN_IDLE))
+    {
+        return false;
+    }
+    fastscanStatus.nextNodeId = firstNodeId;
+    fastscanStore = store;
+    __atomic_store_n(&fastscanState, CO_FASTSCAN_START, __ATOMIC_RELEASE);
+
     return true;
 }
 
+/******************************************************************************/
+void CO_ESP32_LSSfastscanGetStatus(CO_ESP32_LSSfastscanStatus_t *status)
+{
+    *status = fastscanStatus;
+    status->busy = __atomic_load_n(&fastscanState, __ATOMIC_ACQUIRE) != CO_FASTSCAN_IDLE;
+}
+
+static void CO_LSSfastscanFinish(const char *reason)
+{
+    fastscanStatus.duration_ms = (uint32_t)((esp_timer_get_time() - fastscanStart_us) / 1000);
+    ESP_LOGI(TAG, "LSS fastscan %s: %d node IDs assigned in %lu ms", reason,
+             fastscanStatus.nodesAssigned, fastscanStatus.duration_ms);
+    __atomic_store_n(&fastscanState, CO_FASTSCAN_IDLE, __ATOMIC_RELEASE);
+}
+
+/* Fastscan ended in main task. Node IDs configured by LSS become active,
+ * when slaves reset communication. Returns false. */
+static bool CO_LSSfastscanDone(const char *reason)
+{
+    CO_LSSfastscanFinish(reason);
+#if CONFIG_CO_LSS_MASTER_RESET_COMM
+    if (fastscanStatus.nodesAssigned > 0U)
+    {
+        /* to all nodes, this node resets communication too */
+        CO_NMT_sendCommand(CO->NMT, CO_NMT_RESET_COMMUNICATION, 0);
+    }
+#endif
+    return false;
+}
+
+/* Called after CO_process(). Each slave found by fastscan is in LSS
+ * configuration state, gets the next node ID and is deselected. It then does
+ * not answer fastscan any more. Returns true, while fastscan is running. */
+static bool CO_LSSfastscanProcess(uint32_t timeDifference_us)
+{
+    CO_LSSmaster_return_t ret;
+    uint8_t i;
+
+    switch (__atomic_load_n(&fastscanState, __ATOMIC_ACQUIRE))
+    {
+    case CO_FASTSCAN_IDLE:
+        return false;
+
+    case CO_FASTSCAN_START:
+        fastscanStart_us = esp_timer_get_time();
+        fastscanStatus.nodesAssigned = 0;
+        if (CO->nodeIdUnconfigured)
+        {
+            CO_LSSfastscanFinish("not possible without own node ID");
+            return false;
+        }
+        /* all four parts of LSS address are unknown */
+        memset(&fastscan, 0, sizeof(fastscan));
+        for (i = 0; i < 4; i++)
+        {
+            fastscan.scan[i] = CO_LSSmaster_FS_SCAN;
+        }
+        fastscanState = CO_FASTSCAN_SCAN;
+        timeDifference_us = 0;
+        /* fall through */
+    case CO_FASTSCAN_SCAN:
+        ret = CO_LSSmaster_IdentifyFastscan(CO->LSSmaster, timeDifference_us, &fastscan);
+        if (ret == CO_LSSmaster_WAIT_SLAVE)
+        {
+            break;
+        }
+        if (ret != CO_LSSmaster_SCAN_FINISHED)
+        {
+            /* CO_LSSmaster_SCAN_NOACK: no slave without node ID is left */
+            return CO_LSSfastscanDone((ret == CO_LSSmaster_SCAN_NOACK) ? "finished" : "failed");
+        }
+        ESP_LOGI(TAG, "LSS slave %08lx:%08lx:%08lx:%08lx gets node ID %d",
+                 fastscan.found.identity.vendorID, fastscan.found.identity.productCode,
+                 fastscan.found.identity.revisionNumber, fastscan.found.identity.serialNumber,
+                 fastscanStatus.nextNodeId);
+        fastscanState = CO_FASTSCAN_NODE_ID;
+        timeDifference_us = 0;
+        /* fall through */
+    case CO_FASTSCAN_NODE_ID:
+        ret = CO_LSSmaster_configureNodeId(CO->LSSmaster, timeDifference_us, fastscanStatus.nextNodeId);
+        if (ret == CO_LSSmaster_WAIT_SLAVE)
+        {
+            break;
+        }
+        if (ret != CO_LSSmaster_OK)
+        {
+            CO_LSSmaster_switchStateDeselect(CO->LSSmaster);
+            return CO_LSSfastscanDone("failed to configure node ID");
+        }
+        if (!fastscanStore)
+        {
+            CO_LSSmaster_switchStateDeselect(CO->LSSmaster);
+            fastscanStatus.nodesAssigned++;
+            fastscanStatus.nextNodeId++;
+            fastscanState = CO_FASTSCAN_SCAN;
+            break;
+        }
+        fastscanState = CO_FASTSCAN_STORE;
+        timeDifference_us = 0;
+        /* fall through */
+    case CO_FASTSCAN_STORE:
+        ret = CO_LSSmaster_configureStore(CO->LSSmaster, timeDifference_us);
+        if (ret == CO_LSSmaster_WAIT_SLAVE)
+        {
+            break;
+        }
+        CO_LSSmaster_switchStateDeselect(CO->LSSmaster);
+        if (ret != CO_LSSmaster_OK)
+        {
+            /* node ID is configured, but lost at power-on */
+            ESP_LOGW(TAG, "LSS slave with node ID %d did not store configuration: %d",
+                     fastscanStatus.nextNodeId, ret);
+        }
+        fastscanStatus.nodesAssigned++;
+        fastscanStatus.nextNodeId++;
+        fastscanState = CO_FASTSCAN_SCAN;
+        break;
+    }
+
+    if ((fastscanState == CO_FASTSCAN_SCAN) && (fastscanStatus.nextNodeId > 127U))
+    {
+        return CO_LSSfastscanDone("finished, no node ID left");
+    }
+
+    return true;
+}
+#endif /* CONFIG_CO_LSS_MASTER */
+
+#if CONFIG_CO_MAIN_TASK_EVENT_DRIVEN
+/* Called from CO_rxTask, when message for main task processing is received */
+static void CO_mainTaskSignal(void *object)
+{
+    xTaskNotifyGive(xCoMainTaskHandle);
+}
+
+static void CO_mainTaskSignalInit(void)
+{
+    uint16_t i;
+
+#if (CO_CONFIG_NMT) & CO_CONFIG_FLAG_CALLBACK_PRE
+    CO_NMT_initCallbackPre(CO->NMT, NULL, CO_mainTaskSignal);
+#endif
+#if (CO_CONFIG_EM) & CO_CONFIG_FLAG_CALLBACK_PRE
+    CO_EM_initCallbackPre(CO->em, NULL, CO_mainTaskSignal);
+#endif
+#if ((CO_CONFIG_SDO_SRV) & CO_CONFIG_FLAG_CALLBACK_PRE) && defined(OD_CNT_SDO_SRV)
+    for (i = 0; i < OD_CNT_SDO_SRV; i++)
+    {
+        CO_SDOserver_initCallbackPre(&CO->SDOserver[i], NULL, CO_mainTaskSignal);
+    }
+#endif
+#if ((CO_CONFIG_SDO_CLI) & CO_CONFIG_SDO_CLI_ENABLE) && ((CO_CONFIG_SDO_CLI) & CO_CONFIG_FLAG_CALLBACK_PRE) && defined(OD_CNT_SDO_CLI)
+    for (i = 0; i < OD_CNT_SDO_CLI; i++)
+    {
+        CO_SDOclient_initCallbackPre(&CO->SDOclient[i], NULL, CO_mainTaskSignal);
+    }
+#endif
+#if ((CO_CONFIG_HB_CONS) & CO_CONFIG_HB_CONS_ENABLE) && ((CO_CONFIG_HB_CONS) & CO_CONFIG_FLAG_CALLBACK_PRE)
+    CO_HBconsumer_initCallbackPre(CO->HBcons, NULL, CO_mainTaskSignal);
+#endif
+#if ((CO_CONFIG_TIME) & CO_CONFIG_TIME_ENABLE) && ((CO_CONFIG_TIME) & CO_CONFIG_FLAG_CALLBACK_PRE)
+    CO_TIME_initCallbackPre(CO->TIME, NULL, CO_mainTaskSignal);
+#endif
+#if ((CO_CONFIG_LSS) & CO_CONFIG_LSS_SLAVE) && ((CO_CONFIG_LSS) & CO_CONFIG_FLAG_CALLBACK_PRE)
+    CO_LSSslave_initCallbackPre(CO->LSSslave, NULL, CO_mainTaskSignal);
+#endif
+#if ((CO_CONFIG_LSS) & CO_CONFIG_LSS_MASTER) && ((CO_CONFIG_LSS) & CO_CONFIG_FLAG_CALLBACK_PRE)
+    CO_LSSmaster_initCallbackPre(CO->LSSmaster, NULL, CO_mainTaskSignal);
+#endif
+    (void)i;
+}
+#endif /* CONFIG_CO_MAIN_TASK_EVENT_DRIVEN */
+
 static void CO_mainTask(void *pxParam)
 {
     CO_ReturnError_t err;
     uint32_t errInfo = 0;
     CO_NMT_reset_cmd_t reset = CO_RESET_NOT;
     uint32_t heapMemoryUsed;
-    uint8_t activeNodeId = CONFIG_CO_DEFAULT_NODE_ID;
+    uint8_t activeNodeId = CO_DEFAULT_NODE_ID;
+#if CONFIG_CO_STORAGE_ENABLE
+    uint32_t storageInitError = 0;
+#if (CONFIG_CO_STORAGE_AUTO_INTERVAL_MS > 0)
+    bool storageAutoStart = false;
+#endif
+#endif
+#if CONFIG_CO_MAIN_TASK_EVENT_DRIVEN
+    uint32_t timerNext_us;
+    uint32_t timeDifference_us;
+    int64_t timeNow_us, timePrevious_us;
+#else
     TickType_t xLastWakeTime;
+#endif
 
+    CO_BOOT_TIME(CO_BOOT_MAIN_TASK);
     ESP_LOGI(TAG, "main task running.");
 
     /* Allocate CANopen object */
@@ -64,25 +614,108 @@ static void CO_mainTask(void *pxParam)
     }
     else
     {
+#if CONFIG_CO_STATIC_ALLOCATION
+        ESP_LOGI(TAG, "CANopen objects statically allocated");
+#else
         ESP_LOGI(TAG, "Allocated %d bytes for CANopen objects", (int)heapMemoryUsed);
+#endif
     }
+    CO_BOOT_TIME(CO_BOOT_CO_NEW);
+
+#if CONFIG_CO_STORAGE_ENABLE
+    /* Load stored parameters, before they are used by CO_CANopenInit() */
+    err = CO_storageNVS_init(&storage,
+                             CO->CANmodule,
+                             OD_ENTRY_H1010,
+                             OD_ENTRY_H1011,
+                             storageEntries,
+                             storageEntriesCount,
+                             &storageInitError);
+    CO_BOOT_TIME(CO_BOOT_STORAGE);
+    if ((err != CO_ERROR_NO) && (err != CO_ERROR_DATA_CORRUPT))
+    {
+        ESP_LOGE(TAG, "Storage initialization failed: %d", err);
+    }
+#if (CONFIG_CO_STORAGE_AUTO_INTERVAL_MS > 0)
+    else
+    {
+        storageAutoStart = true;
+    }
+#endif
+#if (CO_CONFIG_LSS) & CO_CONFIG_LSS_SLAVE
+    CO_LSSrestoreConfig();
+#endif
+#endif /* CONFIG_CO_STORAGE_ENABLE */
 
     while (reset != CO_RESET_APP)
     {
         /* CANopen communication reset - initialize CANopen objects *******************/
         ESP_LOGI(TAG, "CANopenNode - Reset communication");
+#if CONFIG_CO_LSS_MASTER
+        /* LSS master is initialized again, requested fastscan is kept */
+        if (fastscanState > CO_FASTSCAN_START)
+        {
+            CO_LSSfastscanFinish("aborted by communication reset");
+        }
+#endif
+
+#if (CO_CONFIG_LSS) & CO_CONFIG_LSS_SLAVE
+        /* Used by CO_CANinit() and CO_LSSinit() */
+        if (!CO_LSSconfigValid(pendingNodeId, pendingBitRate))
+        {
+            ESP_LOGW(TAG, "LSS configuration not valid: node ID %d, %d kbit/s, using defaults",
+                     pendingNodeId, pendingBitRate);
+            pendingNodeId = CO_DEFAULT_NODE_ID;
+            pendingBitRate = CONFIG_CO_DEFAULT_BPS;
+        }
+#endif
 
         CO->CANmodule->CANnormal = false;
 
         /* Enter CAN configuration. */
         CO_CANsetConfigurationMode(CANptr);
 
-        /* Initialize CAN */
-        err = CO_CANinit(CO, CANptr, CONFIG_CO_DEFAULT_BPS);
+        /* Initialize CAN, bit rate may be changed by LSS */
+        err = CO_CANinit(CO, CANptr, pendingBitRate);
+        CO_BOOT_TIME(CO_BOOT_CAN_INIT);
         if (err != CO_ERROR_NO)
         {
             ESP_LOGE(TAG, "CAN initialization failed: %d", err);
         }
+#if CONFIG_CO_STORAGE_ENABLE && (CONFIG_CO_STORAGE_AUTO_INTERVAL_MS > 0)
+        /* Storage task locks the OD, CO_CANinit() created the OD mutex */
+        else if (storageAutoStart && (xCoStorageTaskHandle == NULL))
+        {
+            xCoStorageTaskHandle = xTaskCreateStaticPinnedToCore(
+                CO_storageTask,
+                "CO_storage",
+                CONFIG_CO_STORAGE_TASK_STACK_SIZE,
+                (void *)0,
+                CONFIG_CO_STORAGE_TASK_PRIORITY,
+                &xCoStorageStack[0],
+                &xCoStorageTaskBuffer,
+                CO_MAIN_TASK_CORE);
+        }
+#endif
+
+#if (CO_CONFIG_LSS) & CO_CONFIG_LSS_SLAVE
+        /* LSS address is the identity object */
+        CO_LSS_address_t lssAddress = {.identity = {.vendorID = OD_PERSIST_COMM.x1018_identity.vendor_ID,
+                                                    .productCode = OD_PERSIST_COMM.x1018_identity.productCode,
+                                                    .revisionNumber = OD_PERSIST_COMM.x1018_identity.revisionNumber,
+                                                    .serialNumber = OD_PERSIST_COMM.x1018_identity.serialNumber}};
+        err = CO_LSSinit(CO, &lssAddress, &pendingNodeId, &pendingBitRate);
+        if (err != CO_ERROR_NO)
+        {
+            ESP_LOGE(TAG, "LSS slave initialization failed: %d", err);
+        }
+        CO_LSSslave_initCheckBitRateCallback(CO->LSSslave, NULL, CO_LSScheckBitRate);
+        CO_LSSslave_initActivateBitRateCallback(CO->LSSslave, CO->CANmodule, CO_LSSactivateBitRate);
+#if CONFIG_CO_STORAGE_ENABLE
+        CO_LSSslave_initCfgStoreCallback(CO->LSSslave, NULL, CO_LSSstoreConfig);
+#endif
+#endif
+        activeNodeId = pendingNodeId;
 
         /* Initialize CANopen */
         err = CO_CANopenInit(CO,                           /* CANopen object */
@@ -101,6 +734,7 @@ static void CO_mainTask(void *pxParam)
 #endif
                              activeNodeId,
                              &errInfo);
+        CO_BOOT_TIME(CO_BOOT_CANOPEN_INIT);
         if ((err != CO_ERROR_NO) && (err != CO_ERROR_NODE_ID_UNCONFIGURED_LSS))
         {
             if (err == CO_ERROR_OD_PARAMETERS)
@@ -113,21 +747,51 @@ static void CO_mainTask(void *pxParam)
             }
         }
 
-        err = CO_CANopenInitPDO(CO, CO->em, OD, activeNodeId, &errInfo);
-        if (err != CO_ERROR_NO)
+        if (CO->nodeIdUnconfigured)
         {
-            if (err == CO_ERROR_OD_PARAMETERS)
+            /* Only LSS slave runs, objects using node ID are not initialized */
+            ESP_LOGI(TAG, "Node ID not configured, waiting for LSS master");
+        }
+        else
+        {
+#if CONFIG_CO_STORAGE_ENABLE
+            if (storageInitError != 0)
             {
-                ESP_LOGE(TAG, "Object Dictionary entry 0x%lx", errInfo);
+                CO_errorReport(CO->em, CO_EM_NON_VOLATILE_MEMORY, CO_EMC_HARDWARE, storageInitError);
             }
-            else
+#endif
+
+            err = CO_CANopenInitPDO(CO, CO->em, OD, activeNodeId, &errInfo);
+            CO_BOOT_TIME(CO_BOOT_PDO_INIT);
+            if (err != CO_ERROR_NO)
             {
-                ESP_LOGE(TAG, "PDO initialization failed: %d", err);
+                if (err == CO_ERROR_OD_PARAMETERS)
+                {
+                    ESP_LOGE(TAG, "Object Dictionary entry 0x%lx", errInfo);
+                }
+                else
+                {
+                    ESP_LOGE(TAG, "PDO initialization failed: %d", err);
+                }
             }
+#if CONFIG_CO_LSS_MASTER
+            CO_LSSmaster_changeTimeout(CO->LSSmaster, CONFIG_CO_LSS_MASTER_TIMEOUT_MS);
+#endif
+#if CONFIG_CO_PERIODIC_TASK_STATS && ((CO_CONFIG_SYNC) & CO_CONFIG_SYNC_ENABLE) && ((CO_CONFIG_SYNC) & CO_CONFIG_FLAG_CALLBACK_PRE)
+            /* SYNC is initialized only with configured node ID */
+            CO_SYNC_initCallbackPre(CO->SYNC, NULL, CO_syncReceivedCallback);
+#endif
         }
 
+#if CONFIG_CO_MAIN_TASK_EVENT_DRIVEN
+        CO_mainTaskSignalInit();
+#endif
+#if CONFIG_CO_DRIVER_STATS && CONFIG_CO_DRIVER_STATS_OD_INDEX
+        CO_driverStatsInitOD();
+#endif
+
         /*
-         * Create Timer Task with execution every 1 millisecond
+         * Create Timer Task with execution every CO_PERIODIC_TASK_INTERVAL_US
          */
 #if (CONFIG_CO_PERIODIC_TASK_PRIORITY <= CONFIG_CO_MAIN_TASK_PRIORITY)
 /*
@@ -146,7 +810,7 @@ static void CO_mainTask(void *pxParam)
                 CONFIG_CO_PERIODIC_TASK_PRIORITY,
                 &xCoPeriodicStack[0],
                 &xCoPeriodicTaskBuffer,
-                CONFIG_CO_TASK_CORE);
+                CO_PERIODIC_TASK_CORE);
             if (xCoPeriodicTaskHandle == NULL)
             {
                 ESP_LOGE(TAG, "Failed to create periodic task");
@@ -160,14 +824,58 @@ static void CO_mainTask(void *pxParam)
 
         /* Start CAN */
         CO_CANsetNormalMode(CO->CANmodule);
+        CO_BOOT_TIME(CO_BOOT_CAN_NORMAL);
         reset = CO_RESET_NOT;
         ESP_LOGI(TAG, "CANopenNode is running");
-        xLastWakeTime = xTaskGetTickCount();
+#if CONFIG_CO_MAIN_TASK_EVENT_DRIVEN
+        timerNext_us = 0;
+        timePrevious_us = esp_timer_get_time();
+#else
+        /* first CO_process() without delay, it sends the bootup message */
+        xLastWakeTime = xTaskGetTickCount() - pdMS_TO_TICKS(CONFIG_CO_MAIN_TASK_INTERVAL_MS);
+#endif
         while (reset == CO_RESET_NOT)
         {
+#if CONFIG_CO_MAIN_TASK_EVENT_DRIVEN
+            /* Sleep until CANopen objects need processing or message is received.
+             * Round up to whole ticks and add one, as the current tick is partly
+             * elapsed, so task does not wake before timerNext_us expires. */
+            ulTaskNotifyTake(pdTRUE, (timerNext_us > 0U) ? ((timerNext_us + CO_TICK_US - 1U) / CO_TICK_US + 1U) : 0U);
+            timeNow_us = esp_timer_get_time();
+            timeDifference_us = (uint32_t)(timeNow_us - timePrevious_us);
+            timePrevious_us = timeNow_us;
+
+            /* CANopen process, reduces timerNext_us if required earlier */
+            timerNext_us = CO_MAIN_TASK_INTERVAL_US;
+            CO_TRACE(CO_TRACE_PROCESS_BEGIN, 0);
+            reset = CO_process(CO, false, timeDifference_us, &timerNext_us);
+            CO_TRACE(CO_TRACE_PROCESS_END, reset);
+            if (CO->CANmodule->driverPause && (timerNext_us > 1000))
+            {
+                /* Bit rate switch delays are checked every millisecond */
+                timerNext_us = 1000;
+            }
+#if CONFIG_CO_LSS_MASTER
+            if (CO_LSSfastscanProcess(timeDifference_us) && (timerNext_us > 1000))
+            {
+                /* LSS master timeout is checked every millisecond */
+                timerNext_us = 1000;
+            }
+#endif
+#else
             vTaskDelayUntil(&xLastWakeTime, CONFIG_CO_MAIN_TASK_INTERVAL_MS);
             /* CANopen process */
+            CO_TRACE(CO_TRACE_PROCESS_BEGIN, 0);
             reset = CO_process(CO, false, CO_MAIN_TASK_INTERVAL_US, NULL);
+            CO_TRACE(CO_TRACE_PROCESS_END, reset);
+#if CONFIG_CO_LSS_MASTER
+            CO_LSSfastscanProcess(CO_MAIN_TASK_INTERVAL_US);
+#endif
+#endif
+#if CONFIG_CO_BOOT_TIME_LOG
+            CO_BOOT_TIME(CO_BOOT_FIRST_PROCESS);
+            CO_bootTimeLog();
+#endif
 #if CO_CONFIG_LEDS
             uint32_t ledState;
 #if (CONFIG_CO_LED_RED_GPIO >= 0)
@@ -190,6 +898,18 @@ static void CO_mainTask(void *pxParam)
         }
     }
 
+#if CONFIG_CO_STORAGE_ENABLE && (CONFIG_CO_STORAGE_AUTO_INTERVAL_MS > 0)
+    /* Write pending changes, before CANopen objects are deleted */
+    if (xCoStorageTaskHandle != NULL)
+    {
+        xTaskNotifyGive(xCoStorageTaskHandle);
+        while (eTaskGetState(xCoStorageTaskHandle) != eDeleted)
+        {
+            vTaskDelay(1);
+        }
+    }
+#endif
+
     CO_delete(CO);
 
     /* Reset */
@@ -201,24 +921,94 @@ static void CO_mainTask(void *pxParam)
     vTaskDelete(NULL);
 }
 
+#if CONFIG_CO_STORAGE_ENABLE && (CONFIG_CO_STORAGE_AUTO_INTERVAL_MS > 0)
+/* Writes changed CO_storage_auto entries. Changes within one interval are
+ * written once. Notification requests the last write and deletes the task. */
+static void CO_storageTask(void *pxParam)
+{
+    bool_t quit = false;
+    uint32_t errorMask;
+
+    while (!quit)
+    {
+        quit = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_CO_STORAGE_AUTO_INTERVAL_MS)) != 0;
+        errorMask = CO_storageNVS_autoProcess(&storage);
+        if ((errorMask != 0) && !quit)
+        {
+            CO_errorReport(CO->em, CO_EM_NON_VOLATILE_MEMORY, CO_EMC_HARDWARE, errorMask);
+        }
+    }
+    vTaskDelete(NULL);
+}
+#endif
+
+#if CONFIG_CO_PERIODIC_TASK_TIMER
+static void CO_periodicTimerCallback(void *arg)
+{
+    xTaskNotifyGive(xCoPeriodicTaskHandle);
+}
+#endif
+
 static void CO_periodicTask(void *pxParam)
 {
+    int64_t timeNow_us, timePrevious_us;
+    uint32_t timeDifference_us;
+
     ESP_LOGI(TAG, "Periodic task running");
 
+#if CONFIG_CO_PERIODIC_TASK_TIMER
+    const esp_timer_create_args_t timerArgs = {
+        .callback = CO_periodicTimerCallback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "CO_periodic",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timerArgs, &xCoPeriodicTimer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(xCoPeriodicTimer, CO_PERIODIC_TASK_INTERVAL_US));
+#endif
+
+    timePrevious_us = esp_timer_get_time();
     while (1)
     {
-        vTaskDelay(1);
+#if CONFIG_CO_PERIODIC_TASK_TIMER
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#else
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_CO_PERIODIC_TASK_INTERVAL_MS));
+#endif
+        /* pass time which really elapsed, not the nominal interval */
+        timeNow_us = esp_timer_get_time();
+        timeDifference_us = (uint32_t)(timeNow_us - timePrevious_us);
+        timePrevious_us = timeNow_us;
+#if CONFIG_CO_PERIODIC_TASK_STATS
+        CO_timeAccumulate(&periodAcc, timeDifference_us);
+#endif
+
         if ((!CO->nodeIdUnconfigured) && (CO->CANmodule->CANnormal))
         {
             bool syncWas = false;
 #if (CO_CONFIG_SYNC) & CO_CONFIG_SYNC_ENABLE
-            syncWas = CO_process_SYNC(CO, CO_PERIODIC_TASK_INTERVAL_US, NULL);
+            CO_TRACE(CO_TRACE_SYNC_BEGIN, 0);
+            syncWas = CO_process_SYNC(CO, timeDifference_us, NULL);
+            CO_TRACE(CO_TRACE_SYNC_END, syncWas);
 #endif
 #if (CO_CONFIG_PDO) & CO_CONFIG_RPDO_ENABLE
-            CO_process_RPDO(CO, syncWas, CO_PERIODIC_TASK_INTERVAL_US, NULL);
+            CO_TRACE(CO_TRACE_RPDO_BEGIN, 0);
+            CO_process_RPDO(CO, syncWas, timeDifference_us, NULL);
+            CO_TRACE(CO_TRACE_RPDO_END, 0);
 #endif
 #if (CO_CONFIG_PDO) & CO_CONFIG_TPDO_ENABLE
-            CO_process_TPDO(CO, syncWas, CO_PERIODIC_TASK_INTERVAL_US, NULL);
+            CO_TRACE(CO_TRACE_TPDO_BEGIN, 0);
+            CO_process_TPDO(CO, syncWas, timeDifference_us, NULL);
+            CO_TRACE(CO_TRACE_TPDO_END, 0);
+            CO_BOOT_TIME(CO_BOOT_FIRST_TPDO);
+#endif
+#if CONFIG_CO_PERIODIC_TASK_STATS
+            if (syncWas && (syncReceived_us != 0))
+            {
+                CO_timeAccumulate(&syncToTPDOAcc, (uint32_t)esp_timer_get_time() - syncReceived_us);
+                syncReceived_us = 0;
+            }
 #endif
         }
     }
@@ -5,7 +5,58 @@
 
 #include "CANopen.h"
 
+/* Start one CANopen node on the CAN module configured in Kconfig. The driver
+ * supports CO_CAN_MODULE_INSTANCES modules, but this layer and the OD are
+ * single instance. */
 bool CO_ESP32_init();
 
+#if CONFIG_CO_STORAGE_ENABLE
+/* Use entries instead of the default, which stores OD_PERSIST_COMM on
+ * 0x1010 subindex 2. Call before CO_ESP32_init(). Array must stay valid. */
+void CO_ESP32_setStorageEntries(CO_storage_entry_t *entries, uint8_t entriesCount);
+#endif /* CONFIG_CO_STORAGE_ENABLE */
+
+#if CONFIG_CO_LSS_MASTER
+typedef struct
+{
+    bool busy;             /* fastscan is running */
+    uint8_t nodesAssigned; /* node IDs assigned by the last fastscan */
+    uint8_t nextNodeId;    /* node ID for the next slave found */
+    uint32_t duration_ms;  /* duration of the last finished fastscan */
+} CO_ESP32_LSSfastscanStatus_t;
+
+/* Assign node IDs from firstNodeId upwards to all LSS slaves without node ID,
+ * found with LSS fastscan. If store is true, each slave stores its node ID.
+ * Slaves use the new node ID after NMT reset communication, which is sent to
+ * all nodes at the end with CONFIG_CO_LSS_MASTER_RESET_COMM, else by the
+ * application. Runs in main task, node itself must have a node ID. Return
+ * false, if fastscan is running or firstNodeId is not valid. */
+bool CO_ESP32_LSSfastscanStart(uint8_t firstNodeId, bool store);
+
+/* Get progress or result of fastscan */
+void CO_ESP32_LSSfastscanGetStatus(CO_ESP32_LSSfastscanStatus_t *status);
+#endif /* CONFIG_CO_LSS_MASTER */
+
+#if CONFIG_CO_PERIODIC_TASK_STATS
+/* Statistics of measured time, in microseconds */
+typedef struct
+{
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t mean_us;
+    uint32_t stddev_us;
+} CO_ESP32_timeStats_t;
+
+typedef struct
+{
+    CO_ESP32_timeStats_t period;     /* time between periodic task runs */
+    CO_ESP32_timeStats_t syncToTPDO; /* SYNC reception to end of TPDO processing */
+} CO_ESP32_periodicStats_t;
+
+/* Get periodic task statistics. If reset is true, start new measurement. */
+void CO_ESP32_getPeriodicStats(CO_ESP32_periodicStats_t *stats, bool reset);
+#endif /* CONFIG_CO_PERIODIC_TASK_STATS */
+
 #endif /* CONFIG_USE_CANOPENNODE */
 #endif /* CANOPENNODE_ESP32_H */
\ No newline at end of file
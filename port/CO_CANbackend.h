@@ -0,0 +1,66 @@
+/*
+ * CAN controller backend of CANopenNode driver.
+ *
+ * @file        CO_CANbackend.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_CAN_BACKEND_H
+#define CO_CAN_BACKEND_H
+
+#include "freertos/FreeRTOS.h"
+#include "driver/twai.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Interface between CO_driver.c and a CAN controller.
+ *
+ * Frames, configuration, status and alerts use the types of the TWAI driver,
+ * a backend for another controller translates them. install() returns the
+ * handle, which is passed to all other functions. Functions return ESP_OK,
+ * ESP_ERR_TIMEOUT if nothing happened within ticksToWait, or other error of
+ * the controller. transmit() and receive() are called from CO_txTask and
+ * CO_rxTask, readAlerts() from CO_alertTask or CO_CANmodule_process().
+ */
+typedef struct
+{
+    const char *name;
+    esp_err_t (*install)(const twai_general_config_t *generalConfig,
+                         const twai_timing_config_t *timingConfig,
+                         const twai_filter_config_t *filterConfig,
+                         void **handle);
+    esp_err_t (*uninstall)(void *handle);
+    esp_err_t (*start)(void *handle);
+    esp_err_t (*stop)(void *handle);
+    esp_err_t (*transmit)(void *handle, const twai_message_t *message, TickType_t ticksToWait);
+    esp_err_t (*receive)(void *handle, twai_message_t *message, TickType_t ticksToWait);
+    esp_err_t (*getStatusInfo)(void *handle, twai_status_info_t *statusInfo);
+    esp_err_t (*readAlerts)(void *handle, uint32_t *alerts, TickType_t ticksToWait);
+    esp_err_t (*initiateRecovery)(void *handle);
+} CO_CANbackend_t;
+
+/* On-chip TWAI controller, used if CO_CANptrTWAI_t.backend is NULL */
+extern const CO_CANbackend_t CO_CANbackendTWAI;
+
+#ifdef __cplusplus
+}
+#endif /*__cplusplus*/
+
+#endif /* CO_CAN_BACKEND_H */
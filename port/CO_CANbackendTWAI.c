@@ -0,0 +1,88 @@
+/*
+ * CAN controller backend for on-chip TWAI controller.
+ *
+ * @file        CO_CANbackendTWAI.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_CANbackend.h"
+
+/* Handle of the interface is twai_handle_t of the TWAI driver */
+static esp_err_t CO_TWAIinstall(const twai_general_config_t *generalConfig,
+                                const twai_timing_config_t *timingConfig,
+                                const twai_filter_config_t *filterConfig,
+                                void **handle)
+{
+    twai_handle_t twaiHandle = NULL;
+    esp_err_t ret;
+
+    ret = twai_driver_install_v2(generalConfig, timingConfig, filterConfig, &twaiHandle);
+    *handle = twaiHandle;
+    return ret;
+}
+
+static esp_err_t CO_TWAIuninstall(void *handle)
+{
+    return twai_driver_uninstall_v2((twai_handle_t)handle);
+}
+
+static esp_err_t CO_TWAIstart(void *handle)
+{
+    return twai_start_v2((twai_handle_t)handle);
+}
+
+static esp_err_t CO_TWAIstop(void *handle)
+{
+    return twai_stop_v2((twai_handle_t)handle);
+}
+
+static esp_err_t CO_TWAItransmit(void *handle, const twai_message_t *message, TickType_t ticksToWait)
+{
+    return twai_transmit_v2((twai_handle_t)handle, message, ticksToWait);
+}
+
+static esp_err_t CO_TWAIreceive(void *handle, twai_message_t *message, TickType_t ticksToWait)
+{
+    return twai_receive_v2((twai_handle_t)handle, message, ticksToWait);
+}
+
+static esp_err_t CO_TWAIgetStatusInfo(void *handle, twai_status_info_t *statusInfo)
+{
+    return twai_get_status_info_v2((twai_handle_t)handle, statusInfo);
+}
+
+static esp_err_t CO_TWAIreadAlerts(void *handle, uint32_t *alerts, TickType_t ticksToWait)
+{
+    return twai_read_alerts_v2((twai_handle_t)handle, alerts, ticksToWait);
+}
+
+static esp_err_t CO_TWAIinitiateRecovery(void *handle)
+{
+    return twai_initiate_recovery_v2((twai_handle_t)handle);
+}
+
+const CO_CANbackend_t CO_CANbackendTWAI = {
+    .name = "TWAI",
+    .install = CO_TWAIinstall,
+    .uninstall = CO_TWAIuninstall,
+    .start = CO_TWAIstart,
+    .stop = CO_TWAIstop,
+    .transmit = CO_TWAItransmit,
+    .receive = CO_TWAIreceive,
+    .getStatusInfo = CO_TWAIgetStatusInfo,
+    .readAlerts = CO_TWAIreadAlerts,
+    .initiateRecovery = CO_TWAIinitiateRecovery,
+};
@@ -28,9 +28,20 @@
 #include "301/CO_driver.h"
 #include "esp_log.h"
 #include "driver/twai.h"
+#include "CO_trace.h"
+#include "esp_timer.h"
 
 static const char *TAG = "CO_driver";
 
+_Static_assert(offsetof(CO_CANtx_t, ident) == offsetof(twai_message_t, identifier), "CO_CANtx_t must overlay twai_message_t");
+_Static_assert(offsetof(CO_CANtx_t, DLC) == offsetof(twai_message_t, data_length_code), "CO_CANtx_t must overlay twai_message_t");
+_Static_assert(offsetof(CO_CANtx_t, data) == offsetof(twai_message_t, data), "CO_CANtx_t must overlay twai_message_t");
+
+/* Arbitration priority of transmit buffer, lower value wins. RTR bit is above
+ * 11-bit identifier, so data frame wins over remote frame as on the bus. */
+#define CO_CAN_TX_PRIORITY(buffer) \
+    ((buffer)->ident | ((((buffer)->flags & TWAI_MSG_FLAG_RTR) != 0U) ? 0x0800U : 0U))
+
 typedef struct
 {
     uint16_t kbps;
@@ -56,25 +67,456 @@ static baudrate_config_t const baudrate_config[] = {
 #if CONFIG_CO_BPS_500K
     {500, TWAI_TIMING_CONFIG_500KBITS()},
 #endif
+#if CONFIG_CO_BPS_800K
+    {800, TWAI_TIMING_CONFIG_800KBITS()},
+#endif
 #if CONFIG_CO_BPS_1M
     {1000, TWAI_TIMING_CONFIG_1MBITS()},
 #endif
-#if CONFIG_CO_BPS_25K
-    {25, TWAI_TIMING_CONFIG_25KBITS()},
+};
+
+/* Find timing configuration of bit rate in kbit/s, NULL if not supported */
+static const twai_timing_config_t *CO_CANtimingFind(uint16_t bitRate)
+{
+    uint16_t i;
+
+    for (i = 0; i < (sizeof(baudrate_config) / sizeof(baudrate_config[0])); i++)
+    {
+        if (bitRate == baudrate_config[i].kbps)
+        {
+            return &baudrate_config[i].timing_config;
+        }
+    }
+    return NULL;
+}
+
+#if CONFIG_CO_CAN_MODULE_INSTANCES
+#define CO_CAN_MODULE_INSTANCES CONFIG_CO_CAN_MODULE_INSTANCES
+#else
+#define CO_CAN_MODULE_INSTANCES 1
+#endif
+#if CONFIG_CO_TWAI_CONTROLLER_ID
+#define CO_TWAI_CONTROLLER_ID CONFIG_CO_TWAI_CONTROLLER_ID
+#else
+#define CO_TWAI_CONTROLLER_ID 0
+#endif
+#ifdef CONFIG_CO_RX_TASK_CORE
+#define CO_RX_TASK_CORE CONFIG_CO_RX_TASK_CORE
+#else
+#define CO_RX_TASK_CORE CONFIG_CO_TASK_CORE
+#endif
+#ifdef CONFIG_CO_TX_TASK_CORE
+#define CO_TX_TASK_CORE CONFIG_CO_TX_TASK_CORE
+#else
+#define CO_TX_TASK_CORE CONFIG_CO_TASK_CORE
 #endif
+
+/* Number of tasks, which must park before the driver is reinstalled, and
+ * their index in resumeHdl of CO_TWAIinstance_t */
+#if CONFIG_CO_TWAI_ALERT_TASK
+#define CO_PARKED_TASKS 3
+#else
+#define CO_PARKED_TASKS 2
+#endif
+#define CO_PARK_TX 0U
+#define CO_PARK_RX 1U
+#define CO_PARK_ALERT 2U
+
+/* TWAI driver configuration and task memory of one CAN module */
+typedef struct
+{
+    CO_CANmodule_t *CANmodule; /* NULL, if instance is free */
+    twai_general_config_t generalConfig;
+    twai_timing_config_t timingConfig;
+    twai_filter_config_t filterConfig;
+    uint16_t bitRate; /* kbit/s of timingConfig */
+    bool_t driverInstalled;
+    bool_t tasksParked; /* CO_CANtasksStop() returned, tasks wait for resume */
+    StaticSemaphore_t resumeBuf[CO_PARKED_TASKS];
+    SemaphoreHandle_t resumeHdl[CO_PARKED_TASKS]; /* given by CO_CANtasksResume() */
+    uint8_t switchState;      /* CO_CAN_SWITCH_xxx, see CO_CANbitRateSwitchProcess() */
+    uint16_t switchBitRate;   /* kbit/s requested by CO_CANsetBitRate() */
+    uint16_t switchDelay_ms;  /* bus silence before and after the switch */
+    int64_t switchStart_us;   /* time of CO_CANsetBitRate() */
+    int64_t switchStep_us;    /* time of last switchState change */
+    StaticTask_t txTaskBuffer;
+    StackType_t txStack[CONFIG_CO_TX_TASK_STACK_SIZE];
+    StaticTask_t rxTaskBuffer;
+    StackType_t rxStack[CONFIG_CO_RX_TASK_STACK_SIZE];
+#if CONFIG_CO_TWAI_ALERT_TASK
+    StaticTask_t alertTaskBuffer;
+    StackType_t alertStack[CONFIG_CO_ALERT_TASK_STACK_SIZE];
+#endif
+} CO_TWAIinstance_t;
+
+static CO_TWAIinstance_t twaiInstance[CO_CAN_MODULE_INSTANCES];
+
+/* Used, if CANptr passed to CO_CANmodule_init() is NULL */
+static const CO_CANptrTWAI_t CANptrDefault = {
+    .controllerId = CO_TWAI_CONTROLLER_ID,
+    .txGpio = CONFIG_CO_TWAI_TX_GPIO,
+    .rxGpio = CONFIG_CO_TWAI_RX_GPIO,
+    .rxTaskCore = CO_RX_TASK_CORE,
+    .txTaskCore = CO_TX_TASK_CORE,
 };
 
-static StaticTask_t xCoTxTaskBuffer;
-static StackType_t xCoTxStack[CONFIG_CO_TX_TASK_STACK_SIZE];
-static TaskHandle_t xCoTxTaskHandle = NULL;
 static void CO_txTask(void *pxParam);
-
-static StaticTask_t xCoRxTaskBuffer;
-static StackType_t xCoRxStack[CONFIG_CO_RX_TASK_STACK_SIZE];
-static TaskHandle_t xCoRxTaskHandle = NULL;
 static void CO_rxTask(void *pxParam);
+#if CONFIG_CO_TWAI_ALERT_TASK
+static void CO_alertTask(void *pxParam);
+static void CO_CANerrorUpdate(CO_CANmodule_t *CANmodule);
+#endif
+
+/* Maximum time CO_rxTask waits for a frame, CO_CANtasksStop() ends it early */
+#define CO_RX_TASK_WAIT_MS 100
+/* Maximum time CO_txTask waits for space in TWAI transmit queue */
+#define CO_TX_TASK_WAIT_MS 1000
+/* States of bit rate switch, switchState of CO_TWAIinstance_t */
+#define CO_CAN_SWITCH_NONE 0U   /* no switch requested */
+#define CO_CAN_SWITCH_STOP 1U   /* transmission stopped, waiting for delay */
+#define CO_CAN_SWITCH_RESUME 2U /* new bit rate installed, waiting for delay */
+
+#if CONFIG_CO_BUS_OFF_RECOVERY
+/* States of bus-off recovery, CANmodule->busOffState */
+#define CO_CAN_BUS_OFF_NONE 0U       /* controller is not bus-off */
+#define CO_CAN_BUS_OFF_BACKOFF 1U    /* bus-off, waiting for back-off time */
+#define CO_CAN_BUS_OFF_RECOVERING 2U /* recovery initiated, waiting for alert */
+/* TWAI alerts used by bus-off recovery */
+#define CO_CAN_BUS_OFF_ALERTS (TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED)
+#endif
+
+#if CONFIG_CO_TWAI_ALERT_TASK
+#ifdef TWAI_ALERT_RX_FIFO_OVERRUN
+#define CO_CAN_ALERT_RX_FIFO_OVERRUN TWAI_ALERT_RX_FIFO_OVERRUN
+#else
+#define CO_CAN_ALERT_RX_FIFO_OVERRUN 0U
+#endif
+/* TWAI alerts, after which CANerrorStatus is recalculated */
+#define CO_CAN_ERROR_ALERTS (TWAI_ALERT_ERR_ACTIVE | TWAI_ALERT_ABOVE_ERR_WARN |    \
+                             TWAI_ALERT_BELOW_ERR_WARN | TWAI_ALERT_ERR_PASS |      \
+                             TWAI_ALERT_BUS_OFF | TWAI_ALERT_RECOVERY_IN_PROGRESS | \
+                             TWAI_ALERT_BUS_RECOVERED | TWAI_ALERT_RX_QUEUE_FULL |  \
+                             CO_CAN_ALERT_RX_FIFO_OVERRUN)
+/* Alerts counted only in driver statistics */
+#define CO_CAN_STATS_ALERTS (TWAI_ALERT_ARB_LOST | TWAI_ALERT_BUS_ERROR)
+#endif
+
+/******************************************************************************/
+/* Called from CO_txTask, CO_rxTask and CO_alertTask, when driverPause is set.
+ * Task signals it does not use the TWAI driver any more and waits until
+ * CO_CANtasksResume() gives its own semaphore, so a stop following the resume
+ * immediately can't miss the task. */
+static void CO_CANtaskPark(CO_CANmodule_t *CANmodule, uint8_t task)
+{
+    xSemaphoreGive(CANmodule->xSemParkHdl);
+    /* wait is ended early by xTaskAbortDelay() of CO_CANtasksStop() */
+    while (xSemaphoreTake(twaiInstance[CANmodule->instance].resumeHdl[task], portMAX_DELAY) != pdTRUE)
+    {
+    }
+}
+
+/* Wait until CO_txTask, CO_rxTask (and CO_alertTask) are parked, so the
+ * driver and the CAN module buffers may be changed. Tasks stay parked until
+ * CO_CANtasksResume(). Stopping parked tasks again has no effect. */
+static void CO_CANtasksStop(CO_CANmodule_t *CANmodule)
+{
+    CO_TWAIinstance_t *inst = &twaiInstance[CANmodule->instance];
+    uint8_t parked = 0U;
+
+    if (!inst->tasksParked)
+    {
+        CANmodule->driverPause = true;
+        xTaskNotify(CANmodule->txTaskHandle, 0, eNoAction);
+        while (parked < CO_PARKED_TASKS)
+        {
+            /* CO_rxTask and CO_alertTask check driverPause between receive
+             * timeouts, end their waits. Repeated, a task may be just about
+             * to block. */
+            xTaskAbortDelay(CANmodule->rxTaskHandle);
+#if CONFIG_CO_TWAI_ALERT_TASK
+            xTaskAbortDelay(CANmodule->alertTaskHandle);
+#endif
+            if (xSemaphoreTake(CANmodule->xSemParkHdl, 1) == pdTRUE)
+            {
+                parked++;
+            }
+        }
+        inst->tasksParked = true;
+    }
+}
+
+static void CO_CANtasksResume(CO_CANmodule_t *CANmodule)
+{
+    CO_TWAIinstance_t *inst = &twaiInstance[CANmodule->instance];
+    uint8_t i;
+
+    __atomic_store_n(&CANmodule->driverPause, false, __ATOMIC_RELEASE);
+    if (inst->tasksParked)
+    {
+        inst->tasksParked = false;
+        for (i = 0U; i < CO_PARKED_TASKS; i++)
+        {
+            xSemaphoreGive(inst->resumeHdl[i]);
+        }
+    }
+}
+
+/* Install or reinstall TWAI driver with new timing or filter configuration,
+ * without deleting CO_txTask and CO_rxTask. Frames in the driver queues are
+ * lost. Tasks must be stopped by CO_CANtasksStop(). */
+static void CO_CANdriverInstall(CO_CANmodule_t *CANmodule)
+{
+    CO_TWAIinstance_t *inst = &twaiInstance[CANmodule->instance];
+    twai_status_info_t statusInfo = {0};
+    esp_err_t espRet;
+
+    if (inst->driverInstalled)
+    {
+        /* Driver can be uninstalled in bus-off state, but not while recovering */
+        espRet = CANmodule->backend->getStatusInfo(CANmodule->backendHandle, &statusInfo);
+        while ((espRet == ESP_OK) && (statusInfo.state == TWAI_STATE_RECOVERING))
+        {
+            vTaskDelay(1);
+            espRet = CANmodule->backend->getStatusInfo(CANmodule->backendHandle, &statusInfo);
+        }
+        if (espRet != ESP_OK)
+        {
+            /* State unknown, stop fails harmlessly, if driver is stopped */
+            ESP_LOGW(TAG, "getStatusInfo returns %d", espRet);
+            (void)CANmodule->backend->stop(CANmodule->backendHandle);
+        }
+        else if (statusInfo.state == TWAI_STATE_RUNNING)
+        {
+            ESP_ERROR_CHECK(CANmodule->backend->stop(CANmodule->backendHandle));
+        }
+        ESP_ERROR_CHECK(CANmodule->backend->uninstall(CANmodule->backendHandle));
+        inst->driverInstalled = false;
+    }
+    ESP_ERROR_CHECK(CANmodule->backend->install(&inst->generalConfig, &inst->timingConfig,
+                                                &inst->filterConfig, &CANmodule->backendHandle));
+    ESP_ERROR_CHECK(CANmodule->backend->start(CANmodule->backendHandle));
+    inst->driverInstalled = true;
+#if CONFIG_CO_BUS_OFF_RECOVERY
+    CANmodule->busOffState = CO_CAN_BUS_OFF_NONE;
+#endif
+#if CONFIG_CO_DRIVER_STATS
+    /* TWAI counters restart from zero */
+    memset(&CANmodule->statsStatusOld, 0, sizeof(CANmodule->statsStatusOld));
+#endif
+    ESP_LOGI(TAG, "Driver installed");
+}
+
+/* Install driver with parked tasks, tasks continue afterwards */
+static void CO_CANdriverReinstall(CO_CANmodule_t *CANmodule)
+{
+    CO_CANtasksStop(CANmodule);
+    CO_CANdriverInstall(CANmodule);
+    CO_CANtasksResume(CANmodule);
+}
+
+/* Bit rate switch requested by CO_CANsetBitRate(), called from
+ * CO_CANmodule_process(). Transmission stops for switchDelay_ms, the driver
+ * is reinstalled with new timing and transmission resumes after another
+ * switchDelay_ms, as CiA 305 requires. Returns true during the switch. */
+static bool_t CO_CANbitRateSwitchProcess(CO_CANmodule_t *CANmodule)
+{
+    CO_TWAIinstance_t *inst = &twaiInstance[CANmodule->instance];
+    int64_t delay_us = (int64_t)inst->switchDelay_ms * 1000;
+
+    if ((inst->switchState == CO_CAN_SWITCH_STOP) &&
+        ((esp_timer_get_time() - inst->switchStep_us) >= delay_us))
+    {
+        CO_CANtasksStop(CANmodule);
+        inst->timingConfig = *CO_CANtimingFind(inst->switchBitRate);
+        inst->bitRate = inst->switchBitRate;
+        CO_CANdriverInstall(CANmodule);
+        inst->switchState = CO_CAN_SWITCH_RESUME;
+        inst->switchStep_us = esp_timer_get_time();
+    }
+    if ((inst->switchState == CO_CAN_SWITCH_RESUME) &&
+        ((esp_timer_get_time() - inst->switchStep_us) >= delay_us))
+    {
+        CO_CANtasksResume(CANmodule);
+        inst->switchState = CO_CAN_SWITCH_NONE;
+        ESP_LOGI(TAG, "Bit rate %d kbit/s, switched in %ld us", inst->bitRate,
+                 (long)(esp_timer_get_time() - inst->switchStart_us));
+    }
+
+    return inst->switchState != CO_CAN_SWITCH_NONE;
+}
+
+#if CONFIG_CO_TWAI_HW_FILTER
+/* Identifiers accepted by one hardware filter */
+typedef struct
+{
+    uint16_t code;
+    uint16_t dontCare;
+    bool_t used;
+} CO_CANfilterCover_t;
+
+static void CO_CANfilterCoverAdd(CO_CANfilterCover_t *cover, uint16_t ident, uint16_t dontCare)
+{
+    if (!cover->used)
+    {
+        cover->code = ident;
+        cover->dontCare = dontCare;
+        cover->used = true;
+    }
+    else
+    {
+        cover->dontCare |= dontCare | (cover->code ^ ident);
+    }
+    cover->code &= ~cover->dontCare;
+}
+
+static uint32_t CO_CANfilterCoverCount(const CO_CANfilterCover_t *cover)
+{
+    return cover->used ? (1UL << __builtin_popcount(cover->dontCare)) : 0U;
+}
+
+/* Configured rxArray buffer, which receives 11-bit data frames */
+static bool_t CO_CANfilterUsesBuffer(const CO_CANrx_t *buffer)
+{
+    return (buffer->CANrx_callback != NULL) && ((buffer->ident & buffer->mask & 0x0800U) == 0U);
+}
+
+/* Cover buffers, for which split(buffer) is false with cover a, rest with cover b */
+static uint32_t CO_CANfilterPlanSplit(CO_CANmodule_t *CANmodule,
+                                      uint16_t threshold,
+                                      uint16_t bit,
+                                      CO_CANfilterCover_t *a,
+                                      CO_CANfilterCover_t *b)
+{
+    uint16_t i;
+
+    memset(a, 0, sizeof(*a));
+    memset(b, 0, sizeof(*b));
+    for (i = 0U; i < CANmodule->rxSize; i++)
+    {
+        CO_CANrx_t *buffer = &CANmodule->rxArray[i];
+        uint16_t ident = buffer->ident & 0x07FFU;
+        uint16_t dontCare = (uint16_t)~buffer->mask & 0x07FFU;
+        bool_t second = (bit != 0U) ? ((ident & bit) != 0U) : (ident >= threshold);
+
+        if (CO_CANfilterUsesBuffer(buffer))
+        {
+            CO_CANfilterCoverAdd(second ? b : a, ident, dontCare);
+        }
+    }
+    return CO_CANfilterCoverCount(a) + CO_CANfilterCoverCount(b);
+}
+
+/* Calculate single or dual acceptance filter, which accepts identifiers of all
+ * configured rxArray buffers and as few others as possible. Candidates for dual
+ * filter are rxArray split by identifier threshold or by single identifier bit.
+ * Returns number of accepted 11-bit identifiers. */
+static uint32_t CO_CANrxFilterPlan(CO_CANmodule_t *CANmodule, twai_filter_config_t *f_config)
+{
+    CO_CANfilterCover_t all, a, b, bestA, bestB;
+    uint32_t best, count;
+    uint16_t i;
+
+    /* threshold 0 puts all buffers into the second cover */
+    (void)CO_CANfilterPlanSplit(CANmodule, 0U, 0U, &a, &all);
+    best = CO_CANfilterCoverCount(&all);
+    if (best == 0U)
+    {
+        /* no buffers configured, don't filter */
+        *f_config = (twai_filter_config_t)TWAI_FILTER_CONFIG_ACCEPT_ALL();
+        return 0x800U;
+    }
+
+    memset(&bestA, 0, sizeof(bestA));
+    memset(&bestB, 0, sizeof(bestB));
+    for (i = 0U; i < (CANmodule->rxSize + 11U); i++)
+    {
+        if (i < CANmodule->rxSize)
+        {
+            if (!CO_CANfilterUsesBuffer(&CANmodule->rxArray[i]))
+            {
+                continue;
+            }
+            count = CO_CANfilterPlanSplit(CANmodule, CANmodule->rxArray[i].ident & 0x07FFU, 0U, &a, &b);
+        }
+        else
+        {
+            count = CO_CANfilterPlanSplit(CANmodule, 0U, 1U << (i - CANmodule->rxSize), &a, &b);
+        }
+        if (a.used && b.used && (count < best))
+        {
+            best = count;
+            bestA = a;
+            bestB = b;
+        }
+    }
+
+    /* Acceptance code and mask bit layout for standard frames. Mask bits set
+     * to 1 are don't care: RTR bits and data bits are not filtered. */
+    if (!bestA.used)
+    {
+        f_config->acceptance_code = (uint32_t)all.code << 21;
+        f_config->acceptance_mask = ((uint32_t)all.dontCare << 21) | 0x001FFFFFUL;
+        f_config->single_filter = true;
+    }
+    else
+    {
+        f_config->acceptance_code = ((uint32_t)bestA.code << 21) | ((uint32_t)bestB.code << 5);
+        f_config->acceptance_mask = ((uint32_t)bestA.dontCare << 21) | 0x001F0000UL |
+                                    ((uint32_t)bestB.dontCare << 5) | 0x0000001FUL;
+        f_config->single_filter = false;
+    }
 
-static bool bInstalled = false;
+    return (best < 0x800U) ? best : 0x800U;
+}
+
+/* True, if installed acceptance filter passes all identifiers of buffer. For
+ * dual filter, one of the two filters must pass all of them. */
+static bool_t CO_CANrxFilterCovers(const twai_filter_config_t *f_config, const CO_CANrx_t *buffer)
+{
+    uint16_t ident = buffer->ident & 0x07FFU;
+    uint16_t mask = buffer->mask & 0x07FFU;
+    uint8_t shift[2] = {21U, 5U};
+    uint8_t i;
+
+    for (i = 0U; i < (f_config->single_filter ? 1U : 2U); i++)
+    {
+        uint16_t code = (uint16_t)(f_config->acceptance_code >> shift[i]) & 0x07FFU;
+        uint16_t care = (uint16_t)~(f_config->acceptance_mask >> shift[i]) & 0x07FFU;
+
+        if (((care & ~mask) == 0U) && (((ident ^ code) & care) == 0U))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Plan acceptance filter for rxArray and reinstall the driver, if the filter
+ * changed or the driver is not installed yet. Frames in the TWAI queues are
+ * lost with the reinstall. Called from CO_CANsetNormalMode() and, after
+ * CO_CANrxBufferInit() in normal mode, from CO_CANmodule_process(). */
+static void CO_CANrxFilterInstall(CO_CANmodule_t *CANmodule)
+{
+    CO_TWAIinstance_t *inst = &twaiInstance[CANmodule->instance];
+    twai_filter_config_t f_config;
+    uint32_t accepted;
+
+    accepted = CO_CANrxFilterPlan(CANmodule, &f_config);
+    ESP_LOGI(TAG, "RX filter %s code:0x%08lx mask:0x%08lx, estimated rejection %lu%%",
+             f_config.single_filter ? "single" : "dual",
+             f_config.acceptance_code, f_config.acceptance_mask,
+             ((0x800U - accepted) * 100U) / 0x800U);
+    /* First install, or reinstall only if rxArray really changed */
+    if (!inst->driverInstalled ||
+        (f_config.acceptance_code != inst->filterConfig.acceptance_code) ||
+        (f_config.acceptance_mask != inst->filterConfig.acceptance_mask) ||
+        (f_config.single_filter != inst->filterConfig.single_filter))
+    {
+        inst->filterConfig = f_config;
+        CO_CANdriverReinstall(CANmodule);
+    }
+}
+#endif /* CONFIG_CO_TWAI_HW_FILTER */
 
 /******************************************************************************/
 void CO_CANsetConfigurationMode(void *CANptr)
@@ -86,7 +528,28 @@ void CO_CANsetConfigurationMode(void *CANptr)
 void CO_CANsetNormalMode(CO_CANmodule_t *CANmodule)
 {
     /* Put CAN module in normal mode */
+#if CONFIG_CO_TWAI_HW_FILTER
+    if (CANmodule->useCANrxFilters)
+    {
+        if (CANmodule->rxFrameCount > 0U)
+        {
+            ESP_LOGI(TAG, "RX filter measured: %lu frames received, %lu (%lu%%) not used",
+                     CANmodule->rxFrameCount, CANmodule->rxUnmatchedCount,
+                     (CANmodule->rxUnmatchedCount * 100U) / CANmodule->rxFrameCount);
+        }
+        CANmodule->rxFrameCount = 0U;
+        CANmodule->rxUnmatchedCount = 0U;
+
+        /* rxArray is configured now, program matching acceptance filter */
+        CANmodule->rxFilterUpdate = false;
+        CO_CANrxFilterInstall(CANmodule);
+    }
+#endif /* CONFIG_CO_TWAI_HW_FILTER */
 
+#if CONFIG_CO_TWAI_ALERT_TASK
+    /* CO_CANmodule_init() cleared CANerrorStatus, alerts report only changes */
+    CO_CANerrorUpdate(CANmodule);
+#endif
     CANmodule->CANnormal = true;
 }
 
@@ -100,6 +563,9 @@ CO_ReturnError_t CO_CANmodule_init(
     uint16_t txSize,
     uint16_t CANbitRate)
 {
+    const CO_CANptrTWAI_t *CANptrTWAI = (CANptr != NULL) ? (const CO_CANptrTWAI_t *)CANptr : &CANptrDefault;
+    CO_TWAIinstance_t *inst = NULL;
+    bool installed = false;
     uint16_t i;
 
     /* verify arguments */
@@ -108,6 +574,37 @@ CO_ReturnError_t CO_CANmodule_init(
         return CO_ERROR_ILLEGAL_ARGUMENT;
     }
 
+    /* Find driver instance of this CAN module or a free one */
+    for (i = 0U; i < CO_CAN_MODULE_INSTANCES; i++)
+    {
+        if (twaiInstance[i].CANmodule == CANmodule)
+        {
+            inst = &twaiInstance[i];
+            installed = true;
+            break;
+        }
+        if ((inst == NULL) && (twaiInstance[i].CANmodule == NULL))
+        {
+            inst = &twaiInstance[i];
+        }
+    }
+    if (inst == NULL)
+    {
+        ESP_LOGE(TAG, "All %d CAN module instances are used", CO_CAN_MODULE_INSTANCES);
+        return CO_ERROR_OUT_OF_MEMORY;
+    }
+    if (txSize > CONFIG_CO_TX_BUFFER_MAX)
+    {
+        ESP_LOGE(TAG, "txSize %d exceeds CO_TX_BUFFER_MAX", txSize);
+        return CO_ERROR_ILLEGAL_ARGUMENT;
+    }
+    const twai_timing_config_t *timing = CO_CANtimingFind(CANbitRate);
+    if (timing == NULL)
+    {
+        /* Baudrate not found */
+        return CO_ERROR_ILLEGAL_BAUDRATE;
+    }
+
 #if CONFIG_CO_LED_ENABLE
     gpio_config_t io_conf;
     uint64_t pinMask = 0ULL;
@@ -143,6 +640,14 @@ CO_ReturnError_t CO_CANmodule_init(
 #endif
 #endif /* CONFIG_CO_LED_ENABLE */
 
+    if (installed)
+    {
+        /* Communication reset, tasks must not use the buffers meanwhile.
+         * Bit rate of unfinished switch is replaced by CANbitRate. */
+        CO_CANtasksStop(CANmodule);
+        inst->switchState = CO_CAN_SWITCH_NONE;
+    }
+
     /* Configure object variables */
     CANmodule->CANptr = CANptr;
     CANmodule->rxArray = rxArray;
@@ -151,11 +656,21 @@ CO_ReturnError_t CO_CANmodule_init(
     CANmodule->txSize = txSize;
     CANmodule->CANerrorStatus = 0;
     CANmodule->CANnormal = false;
+#if CONFIG_CO_TWAI_HW_FILTER
+    CANmodule->useCANrxFilters = true;
+#else
     CANmodule->useCANrxFilters = false;
+#endif
     CANmodule->bufferInhibitFlag = false;
     CANmodule->firstCANtxMessage = true;
-    CANmodule->CANtxCount = 0U;
+    __atomic_store_n(&CANmodule->CANtxCount, 0U, __ATOMIC_RELAXED);
     CANmodule->errOld = 0U;
+    if (!installed)
+    {
+        portMUX_INITIALIZE(&CANmodule->xSpinlockCanSend);
+        /* CO_txTask starts waiting for notification */
+        CANmodule->txIdle = true;
+    }
 
     for (i = 0U; i < rxSize; i++)
     {
@@ -163,143 +678,312 @@ CO_ReturnError_t CO_CANmodule_init(
         rxArray[i].mask = 0xFFFFU;
         rxArray[i].object = NULL;
         rxArray[i].CANrx_callback = NULL;
+#if CONFIG_CO_DRIVER_STATS
+        rxArray[i].frameCount = 0U;
+#endif
     }
+#if CONFIG_CO_RX_DISPATCH_TABLE
+    memset(CANmodule->rxDispatch, CO_CAN_RX_DISPATCH_NONE, sizeof(CANmodule->rxDispatch));
+#endif
     for (i = 0U; i < txSize; i++)
     {
-        txArray[i].bufferFull = false;
+        __atomic_store_n(&txArray[i].bufferFull, false, __ATOMIC_RELAXED);
+#if CONFIG_CO_DRIVER_STATS
+        txArray[i].frameCount = 0U;
+#endif
     }
-
-    /* Configure CAN module registers */
-    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CONFIG_CO_TWAI_TX_GPIO, CONFIG_CO_TWAI_RX_GPIO, TWAI_MODE_NORMAL);
-    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
-    twai_timing_config_t t_config;
-    for (i = 0; i < (sizeof(baudrate_config) / sizeof(baudrate_config[0])); i++)
+    for (i = 0U; i < CO_CAN_TX_PENDING_WORDS; i++)
     {
-        if (CANbitRate == baudrate_config[i].kbps)
-        {
-            t_config = baudrate_config[i].timing_config;
-            break;
-        }
+        __atomic_store_n(&CANmodule->txPending[i], 0U, __ATOMIC_RELEASE);
     }
-    if (i >= (sizeof(baudrate_config) / sizeof(baudrate_config[0])))
+#if CONFIG_CO_DRIVER_STATS
+    memset(&CANmodule->stats, 0, sizeof(CANmodule->stats));
+    if (!installed)
     {
-        /* Baudrate not found */
-        return CO_ERROR_ILLEGAL_BAUDRATE;
+        memset(&CANmodule->statsStatusOld, 0, sizeof(CANmodule->statsStatusOld));
     }
+#endif
+
+    /* Configure CAN module registers */
+    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT_V2(CANptrTWAI->controllerId, CANptrTWAI->txGpio, CANptrTWAI->rxGpio, TWAI_MODE_NORMAL);
+    g_config.tx_queue_len = CONFIG_CO_TWAI_TX_QUEUE_LEN;
+#if CONFIG_CO_TWAI_ALERT_TASK && CONFIG_CO_DRIVER_STATS
+    g_config.alerts_enabled = CO_CAN_ERROR_ALERTS | CO_CAN_STATS_ALERTS;
+#elif CONFIG_CO_TWAI_ALERT_TASK
+    g_config.alerts_enabled = CO_CAN_ERROR_ALERTS;
+#elif CONFIG_CO_BUS_OFF_RECOVERY
+    g_config.alerts_enabled = CO_CAN_BUS_OFF_ALERTS;
+#endif
+    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    twai_timing_config_t t_config = *timing;
 
     /* Install TWAI driver */
-    if (bInstalled != true)
+    if (!installed)
     {
         /* create Mutex */
-        CANmodule->xMutexCanSendHdl = xSemaphoreCreateRecursiveMutexStatic(&(CANmodule->xMutexCanSendBuf));
         CANmodule->xMutexEmcyHdl = xSemaphoreCreateRecursiveMutexStatic(&(CANmodule->xMutexEmcyBuf));
         CANmodule->xMutexODHdl = xSemaphoreCreateRecursiveMutexStatic(&(CANmodule->xMutexODBuf));
+        CANmodule->xSemParkHdl = xSemaphoreCreateCountingStatic(CO_PARKED_TASKS, 0, &(CANmodule->xSemParkBuf));
+        for (i = 0U; i < CO_PARKED_TASKS; i++)
+        {
+            inst->resumeHdl[i] = xSemaphoreCreateBinaryStatic(&inst->resumeBuf[i]);
+        }
+        inst->tasksParked = false;
+        inst->switchState = CO_CAN_SWITCH_NONE;
+#if CONFIG_CO_BUS_OFF_RECOVERY
+        CANmodule->busOffState = CO_CAN_BUS_OFF_NONE;
+        CANmodule->busOffDelay_ms = 0U;
+#endif
+#if CONFIG_CO_TWAI_HW_FILTER
+        CANmodule->rxFrameCount = 0U;
+        CANmodule->rxUnmatchedCount = 0U;
+        CANmodule->rxFilterUpdate = false;
+#endif
 
         /* Install TWAI */
-        ESP_ERROR_CHECK(twai_driver_install(&g_config, &t_config, &f_config));
-        ESP_LOGI(TAG, "Driver installed");
-        ESP_ERROR_CHECK(twai_start());
+        CANmodule->backend = (CANptrTWAI->backend != NULL) ? CANptrTWAI->backend : &CO_CANbackendTWAI;
+        inst->generalConfig = g_config;
+        inst->timingConfig = t_config;
+        inst->filterConfig = f_config;
+        inst->bitRate = CANbitRate;
+#if CONFIG_CO_TWAI_HW_FILTER
+        /* Acceptance filter is known after the stack configured rxArray, so
+         * CO_CANsetNormalMode() installs the driver. Tasks park meanwhile. */
+        inst->driverInstalled = false;
+        CANmodule->driverPause = true;
+        ESP_LOGI(TAG, "Driver %s on controller %d, install deferred", CANmodule->backend->name, CANptrTWAI->controllerId);
+#else
+        CANmodule->driverPause = false;
+        ESP_ERROR_CHECK(CANmodule->backend->install(&g_config, &t_config, &f_config, &CANmodule->backendHandle));
+        ESP_LOGI(TAG, "Driver %s installed on controller %d", CANmodule->backend->name, CANptrTWAI->controllerId);
+        ESP_ERROR_CHECK(CANmodule->backend->start(CANmodule->backendHandle));
         ESP_LOGI(TAG, "Driver started");
+        inst->driverInstalled = true;
+#endif
 
-        bInstalled = true;
+        inst->CANmodule = CANmodule;
+        CANmodule->instance = (uint8_t)(inst - &twaiInstance[0]);
 
         /* Create Tx tasks */
         ESP_LOGI(TAG, "Creating Tx Task");
-        xCoTxTaskHandle = xTaskCreateStaticPinnedToCore(
+        CANmodule->txTaskHandle = xTaskCreateStaticPinnedToCore(
             CO_txTask,
             "CO_tx",
             CONFIG_CO_TX_TASK_STACK_SIZE,
             (void *)CANmodule,
             CONFIG_CO_TX_TASK_PRIORITY,
-            &xCoTxStack[0],
-            &xCoTxTaskBuffer,
-            CONFIG_CO_TASK_CORE);
-        if (xCoTxTaskHandle == NULL)
+            &inst->txStack[0],
+            &inst->txTaskBuffer,
+            CANptrTWAI->txTaskCore);
+        if (CANmodule->txTaskHandle == NULL)
         {
             ESP_LOGE(TAG, "txTask creation failed");
             return CO_ERROR_OUT_OF_MEMORY;
         }
         /* Create Rx tasks */
         ESP_LOGI(TAG, "Creating Rx Task");
-        xCoRxTaskHandle = xTaskCreateStaticPinnedToCore(
+        CANmodule->rxTaskHandle = xTaskCreateStaticPinnedToCore(
             CO_rxTask,
             "CO_rx",
             CONFIG_CO_RX_TASK_STACK_SIZE,
             (void *)CANmodule,
             CONFIG_CO_RX_TASK_PRIORITY,
-            &xCoRxStack[0],
-            &xCoRxTaskBuffer,
-            CONFIG_CO_TASK_CORE);
-        if (xCoRxTaskHandle == NULL)
+            &inst->rxStack[0],
+            &inst->rxTaskBuffer,
+            CANptrTWAI->rxTaskCore);
+        if (CANmodule->rxTaskHandle == NULL)
         {
             ESP_LOGE(TAG, "rxTask creation failed");
             return CO_ERROR_OUT_OF_MEMORY;
         }
+#if CONFIG_CO_TWAI_ALERT_TASK
+        /* Create alert task */
+        ESP_LOGI(TAG, "Creating Alert Task");
+        CANmodule->alertTaskHandle = xTaskCreateStaticPinnedToCore(
+            CO_alertTask,
+            "CO_alert",
+            CONFIG_CO_ALERT_TASK_STACK_SIZE,
+            (void *)CANmodule,
+            CONFIG_CO_ALERT_TASK_PRIORITY,
+            &inst->alertStack[0],
+            &inst->alertTaskBuffer,
+            CANptrTWAI->rxTaskCore);
+        if (CANmodule->alertTaskHandle == NULL)
+        {
+            ESP_LOGE(TAG, "alertTask creation failed");
+            return CO_ERROR_OUT_OF_MEMORY;
+        }
+#endif
+    }
+    else if (CANbitRate != inst->bitRate)
+    {
+        /* Bit rate changed by LSS, keep tasks and reinstall the driver */
+        inst->timingConfig = t_config;
+        inst->bitRate = CANbitRate;
+        CO_CANdriverReinstall(CANmodule);
+        ESP_LOGI(TAG, "Bit rate %d kbit/s", CANbitRate);
     }
     else
     {
         ESP_LOGI(TAG, "Driver already installed");
+        if (inst->driverInstalled)
+        {
+            /* else tasks stay parked until CO_CANsetNormalMode() installs it */
+            CO_CANtasksResume(CANmodule);
+        }
     }
 
     return CO_ERROR_NO;
 }
 
+/******************************************************************************/
+bool_t CO_CANcheckBitRate(uint16_t bitRate)
+{
+    return CO_CANtimingFind(bitRate) != NULL;
+}
+
+/******************************************************************************/
+bool_t CO_CANsetBitRate(CO_CANmodule_t *CANmodule, uint16_t bitRate, uint16_t switchDelay_ms)
+{
+    CO_TWAIinstance_t *inst;
+
+    if ((CANmodule == NULL) || (twaiInstance[CANmodule->instance].CANmodule != CANmodule) ||
+        (CO_CANtimingFind(bitRate) == NULL))
+    {
+        return false;
+    }
+
+    inst = &twaiInstance[CANmodule->instance];
+    inst->switchBitRate = bitRate;
+    inst->switchDelay_ms = switchDelay_ms;
+    inst->switchStart_us = esp_timer_get_time();
+    inst->switchStep_us = inst->switchStart_us;
+    inst->switchState = CO_CAN_SWITCH_STOP;
+    /* CO_txTask stops after the actual frame, other frames stay pending */
+    CANmodule->driverPause = true;
+    xTaskNotify(CANmodule->txTaskHandle, 0, eNoAction);
+
+    return true;
+}
+
 /******************************************************************************/
 void CO_CANmodule_disable(CO_CANmodule_t *CANmodule)
 {
-    if (CANmodule != NULL)
+    uint8_t i;
+
+    if ((CANmodule != NULL) && (twaiInstance[CANmodule->instance].CANmodule == CANmodule))
     {
         /* Take all mutex before deleting it */
-        xSemaphoreTakeRecursive(CANmodule->xMutexCanSendHdl, portMAX_DELAY);
         xSemaphoreTakeRecursive(CANmodule->xMutexEmcyHdl, portMAX_DELAY);
         xSemaphoreTakeRecursive(CANmodule->xMutexODHdl, portMAX_DELAY);
 
         /* Delete Tx and Rx Tasks */
-        vTaskDelete(xCoTxTaskHandle);
-        xCoTxTaskHandle = NULL;
-        vTaskDelete(xCoRxTaskHandle);
-        xCoRxTaskHandle = NULL;
+        vTaskDelete(CANmodule->txTaskHandle);
+        CANmodule->txTaskHandle = NULL;
+        vTaskDelete(CANmodule->rxTaskHandle);
+        CANmodule->rxTaskHandle = NULL;
+#if CONFIG_CO_TWAI_ALERT_TASK
+        vTaskDelete(CANmodule->alertTaskHandle);
+        CANmodule->alertTaskHandle = NULL;
+#endif
         ESP_LOGI(TAG, "tx and rx tasks deleted");
 
         /* As holder of mutex, it is safe to delete it */
-        vSemaphoreDelete(CANmodule->xMutexCanSendHdl);
         vSemaphoreDelete(CANmodule->xMutexEmcyHdl);
         vSemaphoreDelete(CANmodule->xMutexODHdl);
-        CANmodule->xMutexCanSendHdl = NULL;
+        vSemaphoreDelete(CANmodule->xSemParkHdl);
+        for (i = 0U; i < CO_PARKED_TASKS; i++)
+        {
+            vSemaphoreDelete(twaiInstance[CANmodule->instance].resumeHdl[i]);
+        }
         CANmodule->xMutexEmcyHdl = NULL;
         CANmodule->xMutexODHdl = NULL;
+        CANmodule->xSemParkHdl = NULL;
         ESP_LOGI(TAG, "mutex deleted");
 
         /* Uninstall TWAI */
-        ESP_ERROR_CHECK(twai_stop());
-        ESP_LOGI(TAG, "Driver stopped");
-        ESP_ERROR_CHECK(twai_driver_uninstall());
-        ESP_LOGI(TAG, "Driver uninstalled");
+        if (twaiInstance[CANmodule->instance].driverInstalled)
+        {
+            ESP_ERROR_CHECK(CANmodule->backend->stop(CANmodule->backendHandle));
+            ESP_LOGI(TAG, "Driver stopped");
+            ESP_ERROR_CHECK(CANmodule->backend->uninstall(CANmodule->backendHandle));
+            ESP_LOGI(TAG, "Driver uninstalled");
+            twaiInstance[CANmodule->instance].driverInstalled = false;
+        }
 
-        bInstalled = false;
+        CANmodule->backendHandle = NULL;
+        twaiInstance[CANmodule->instance].CANmodule = NULL;
     }
 }
 
 /******************************************************************************/
-CO_ReturnError_t CO_CANrxBufferInit(
-    CO_CANmodule_t *CANmodule,
-    uint16_t index,
-    uint16_t ident,
-    uint16_t mask,
-    bool_t rtr,
-    void *object,
-    void (*CANrx_callback)(void *object, void *message))
+#if CONFIG_CO_RX_DISPATCH_TABLE
+/* Find the lowest index of configured rxArray buffer, which matches 11-bit
+ * CAN identifier. This is the same buffer, which linear search would find. */
+static uint8_t CO_CANrxDispatchFind(CO_CANmodule_t *CANmodule, uint16_t ident)
 {
-    CO_ReturnError_t ret = CO_ERROR_NO;
+    uint16_t i;
 
-    if ((CANmodule != NULL) && (object != NULL) && (CANrx_callback != NULL) && (index < CANmodule->rxSize))
+    for (i = 0U; i < CANmodule->rxSize; i++)
     {
-        /* buffer, which will be configured */
-        CO_CANrx_t *buffer = &CANmodule->rxArray[index];
-
-        /* Configure object variables */
-        buffer->object = object;
-        buffer->CANrx_callback = CANrx_callback;
+        CO_CANrx_t *buffer = &CANmodule->rxArray[i];
+
+        if ((buffer->CANrx_callback != NULL) && (((ident ^ buffer->ident) & buffer->mask) == 0U))
+        {
+            return (uint8_t)i;
+        }
+    }
+    return CO_CAN_RX_DISPATCH_NONE;
+}
+
+/* Recalculate dispatch table entries for all identifiers covered by ident/mask. */
+static void CO_CANrxDispatchUpdate(CO_CANmodule_t *CANmodule, uint16_t ident, uint16_t mask)
+{
+    uint16_t fixedBits = ident & mask & 0x07FFU;
+    uint16_t freeBits = (uint16_t)~mask & 0x07FFU;
+    uint16_t bits = freeBits;
+
+    if ((CANmodule->rxSize >= CO_CAN_RX_DISPATCH_NONE) || ((ident & mask & 0x0800U) != 0U))
+    {
+        /* Table not used or RTR buffer, which never matches 11-bit identifier */
+        return;
+    }
+
+    /* iterate all combinations of the masked out bits */
+    do
+    {
+        uint16_t id = fixedBits | bits;
+
+        CANmodule->rxDispatch[id] = CO_CANrxDispatchFind(CANmodule, id);
+        bits = (bits - 1U) & freeBits;
+    } while (bits != freeBits);
+}
+#endif /* CONFIG_CO_RX_DISPATCH_TABLE */
+
+/******************************************************************************/
+CO_ReturnError_t CO_CANrxBufferInit(
+    CO_CANmodule_t *CANmodule,
+    uint16_t index,
+    uint16_t ident,
+    uint16_t mask,
+    bool_t rtr,
+    void *object,
+    void (*CANrx_callback)(void *object, void *message))
+{
+    CO_ReturnError_t ret = CO_ERROR_NO;
+
+    if ((CANmodule != NULL) && (object != NULL) && (CANrx_callback != NULL) && (index < CANmodule->rxSize))
+    {
+        /* buffer, which will be configured */
+        CO_CANrx_t *buffer = &CANmodule->rxArray[index];
+#if CONFIG_CO_RX_DISPATCH_TABLE
+        uint16_t identOld = buffer->ident;
+        uint16_t maskOld = buffer->mask;
+#endif
+
+        /* Configure object variables */
+        buffer->object = object;
+        buffer->CANrx_callback = CANrx_callback;
 
         /* CAN identifier and CAN mask, bit aligned with CAN module. Different on different microcontrollers. */
         buffer->ident = ident & 0x07FFU;
@@ -309,10 +993,22 @@ CO_ReturnError_t CO_CANrxBufferInit(
         }
         buffer->mask = (mask & 0x07FFU) | 0x0800U;
 
-        /* Set CAN hardware module filter and mask. */
-        if (CANmodule->useCANrxFilters)
+#if CONFIG_CO_RX_DISPATCH_TABLE
+        /* Release identifiers of previous configuration, then claim new ones */
+        CO_CANrxDispatchUpdate(CANmodule, identOld, maskOld);
+        CO_CANrxDispatchUpdate(CANmodule, buffer->ident, buffer->mask);
+#endif
+
+        /* Set CAN hardware module filter and mask. Buffer configured in normal
+         * mode, for example RPDO COB-ID written by SDO, may be rejected by
+         * installed filter. CO_CANmodule_process() installs a new one. */
+#if CONFIG_CO_TWAI_HW_FILTER
+        if (CANmodule->useCANrxFilters && CANmodule->CANnormal && CO_CANfilterUsesBuffer(buffer) &&
+            !CO_CANrxFilterCovers(&twaiInstance[CANmodule->instance].filterConfig, buffer))
         {
+            CANmodule->rxFilterUpdate = true;
         }
+#endif
     }
     else
     {
@@ -322,6 +1018,32 @@ CO_ReturnError_t CO_CANrxBufferInit(
     return ret;
 }
 
+/******************************************************************************/
+/* Clear pending bit of TX buffer. Returns true, if the bit was set and this
+ * caller removed it, so only one of CO_txTask and the stack owns the buffer. */
+static bool_t CO_CANtxPendingClear(CO_CANmodule_t *CANmodule, uint16_t index)
+{
+    uint32_t bit = 1UL << (index % 32U);
+
+    if ((__atomic_fetch_and(&CANmodule->txPending[index / 32U], ~bit, __ATOMIC_ACQ_REL) & bit) != 0U)
+    {
+        /* Buffer was counted before its pending bit was set. Zero would be a
+         * bookkeeping error, don't let CANtxCount wrap around then. */
+        uint16_t count = __atomic_load_n(&CANmodule->CANtxCount, __ATOMIC_RELAXED);
+        do
+        {
+            if (count == 0U)
+            {
+                ESP_LOGE(TAG, "CANtxCount underflow, buffer %d", index);
+                break;
+            }
+        } while (!__atomic_compare_exchange_n(&CANmodule->CANtxCount, &count, count - 1U,
+                                              true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        return true;
+    }
+    return false;
+}
+
 /******************************************************************************/
 CO_CANtx_t *CO_CANtxBufferInit(
     CO_CANmodule_t *CANmodule,
@@ -337,36 +1059,105 @@ CO_CANtx_t *CO_CANtxBufferInit(
     {
         /* get specific buffer */
         buffer = &CANmodule->txArray[index];
+
+        buffer->flags = rtr ? TWAI_MSG_FLAG_RTR : TWAI_MSG_FLAG_NONE;
         buffer->ident = (uint32_t)ident & 0x07FFU;
-        if (rtr)
+        buffer->DLC = noOfBytes;
+        if (CO_CANtxPendingClear(CANmodule, index))
         {
-            buffer->ident |= 0x0800U;
+            /* dropped message pending with previous configuration */
+            __atomic_store_n(&buffer->bufferFull, false, __ATOMIC_RELEASE);
         }
-        buffer->DLC = noOfBytes;
-        buffer->bufferFull = false;
         buffer->syncFlag = syncFlag;
     }
 
     return buffer;
 }
 
+#if CONFIG_CO_DRIVER_STATS
 /******************************************************************************/
-CO_ReturnError_t CO_CANsend(CO_CANmodule_t *CANmodule, CO_CANtx_t *buffer)
+_Static_assert(sizeof(CO_CANstats_t) == (CO_CAN_STATS_VALUES * sizeof(uint32_t)), "CO_CANstats_t must contain only uint32_t");
+
+/* Raise counter to value, if it is lower. Called from several tasks. */
+static void CO_CANstatsMax(uint32_t *counter, uint32_t value)
 {
-    CO_ReturnError_t err = CO_ERROR_NO;
+    uint32_t old = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+    while ((value > old) &&
+           !__atomic_compare_exchange_n(counter, &old, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/* Counters are incremented atomically, so CO_CANmodule_getStats() can read
+ * and reset them from another task without losing a count */
+static void CO_CANstatsInc(uint32_t *counter)
+{
+    __atomic_fetch_add(counter, 1U, __ATOMIC_RELAXED);
+}
 
-    CO_LOCK_CAN_SEND(CANmodule);
+/* Add increase of TWAI counter since previous call */
+static void CO_CANstatsAdd(uint32_t *counter, uint32_t *old, uint32_t now)
+{
+    __atomic_fetch_add(counter, now - *old, __ATOMIC_RELAXED);
+    *old = now;
+}
 
-    /* Verify overflow */
-    if (buffer->bufferFull)
+/* Count TX residence time in histogram bin floor(log2(time_us)) */
+static void CO_CANstatsResidence(CO_CANmodule_t *CANmodule, CO_CANtx_t *buffer)
+{
+    uint32_t time_us = (uint32_t)esp_timer_get_time() - buffer->sendTime_us;
+    uint32_t bin = (time_us < 2U) ? 0U : (31U - (uint32_t)__builtin_clz(time_us));
+
+    if (bin >= CO_CAN_STATS_RESIDENCE_BINS)
     {
-        if (!CANmodule->firstCANtxMessage)
+        bin = CO_CAN_STATS_RESIDENCE_BINS - 1U;
+    }
+    CO_CANstatsInc(&CANmodule->stats.txResidence[bin]);
+}
+
+/******************************************************************************/
+void CO_CANmodule_getStats(CO_CANmodule_t *CANmodule, CO_CANstats_t *stats, bool_t reset)
+{
+    uint32_t *values;
+    uint32_t *copy = (uint32_t *)stats;
+    uint16_t i;
+
+    if ((CANmodule == NULL) || (stats == NULL))
+    {
+        return;
+    }
+    values = (uint32_t *)&CANmodule->stats;
+
+    /* Counters are written by other tasks. Each one is read and reset in one
+     * atomic step, so no count is lost or counted twice, but the values are
+     * not taken at the same instant. */
+    for (i = 0U; i < CO_CAN_STATS_VALUES; i++)
+    {
+        copy[i] = reset ? __atomic_exchange_n(&values[i], 0U, __ATOMIC_RELAXED)
+                        : __atomic_load_n(&values[i], __ATOMIC_RELAXED);
+    }
+    if (reset)
+    {
+        for (i = 0U; i < CANmodule->rxSize; i++)
         {
-            /* don't set error, if bootup message is still on buffers */
-            CANmodule->CANerrorStatus |= CO_CAN_ERRTX_OVERFLOW;
+            __atomic_store_n(&CANmodule->rxArray[i].frameCount, 0U, __ATOMIC_RELAXED);
+        }
+        for (i = 0U; i < CANmodule->txSize; i++)
+        {
+            __atomic_store_n(&CANmodule->txArray[i].frameCount, 0U, __ATOMIC_RELAXED);
         }
-        err = CO_ERROR_TX_OVERFLOW;
     }
+}
+#endif /* CONFIG_CO_DRIVER_STATS */
+
+/******************************************************************************/
+CO_ReturnError_t CO_CANsend(CO_CANmodule_t *CANmodule, CO_CANtx_t *buffer)
+{
+    CO_ReturnError_t err = CO_ERROR_NO;
+    uint16_t index = (uint16_t)(buffer - CANmodule->txArray);
+    bool_t wakeTxTask = false;
+    bool_t bufferWasFull;
 
 #if CONFIG_CO_DEBUG_DRIVER_CAN_SEND
     ESP_LOGI(TAG, "CANTX id: 0x%lx, dlc: %d, data: [%d %d %d %d %d %d %d %d]",
@@ -382,10 +1173,53 @@ CO_ReturnError_t CO_CANsend(CO_CANmodule_t *CANmodule, CO_CANtx_t *buffer)
              buffer->data[7]);
 #endif
 
-    buffer->bufferFull = true;
-    CANmodule->CANtxCount++;
-    xTaskNotify(xCoTxTaskHandle, 0, eNoAction);
-    CO_UNLOCK_CAN_SEND(CANmodule);
+    /* Verify overflow, buffer stays full until CO_txTask copied it to TWAI */
+    bufferWasFull = __atomic_exchange_n(&buffer->bufferFull, true, __ATOMIC_ACQUIRE);
+    if (bufferWasFull && CANmodule->driverPause &&
+        ((__atomic_load_n(&CANmodule->txPending[index / 32U], __ATOMIC_ACQUIRE) & (1UL << (index % 32U))) != 0U))
+    {
+        /* Transmission is paused for driver reinstall. Frame still waits in
+         * the buffer and will be sent with the data just written. */
+    }
+    else if (bufferWasFull)
+    {
+        if (!CANmodule->firstCANtxMessage)
+        {
+            /* don't set error, if bootup message is still on buffers */
+            __atomic_fetch_or(&CANmodule->CANerrorStatus, CO_CAN_ERRTX_OVERFLOW, __ATOMIC_RELAXED);
+        }
+        err = CO_ERROR_TX_OVERFLOW;
+#if CONFIG_CO_DRIVER_STATS
+        __atomic_fetch_add(&CANmodule->stats.txOverflow, 1U, __ATOMIC_RELAXED);
+#endif
+        CO_TRACE(CO_TRACE_CAN_SEND_OVERFLOW, buffer->ident);
+    }
+    else
+    {
+        uint16_t txCount;
+
+#if CONFIG_CO_DRIVER_STATS
+        buffer->sendTime_us = (uint32_t)esp_timer_get_time();
+#endif
+        /* Count before pending bit, so CANtxCount never underflows. CO_txTask
+         * drains all pending buffers, wake it only if it was idle. Pending bit
+         * is set before txIdle is read, CO_txTask does it the other way round,
+         * so one of both sees the buffer. */
+        txCount = __atomic_add_fetch(&CANmodule->CANtxCount, 1U, __ATOMIC_RELAXED);
+        __atomic_fetch_or(&CANmodule->txPending[index / 32U], 1UL << (index % 32U), __ATOMIC_SEQ_CST);
+        wakeTxTask = __atomic_exchange_n(&CANmodule->txIdle, false, __ATOMIC_SEQ_CST);
+#if CONFIG_CO_DRIVER_STATS
+        CO_CANstatsMax(&CANmodule->stats.txCountHighWater, txCount);
+#else
+        (void)txCount;
+#endif
+        CO_TRACE(CO_TRACE_CAN_SEND, buffer->ident);
+    }
+
+    if (wakeTxTask)
+    {
+        xTaskNotify(CANmodule->txTaskHandle, 0, eNoAction);
+    }
 
     return err;
 }
@@ -395,126 +1229,331 @@ void CO_CANclearPendingSyncPDOs(CO_CANmodule_t *CANmodule)
 {
     uint32_t tpdoDeleted = 0U;
 
-    CO_LOCK_CAN_SEND(CANmodule);
     /* Abort message from CAN module, if there is synchronous TPDO.
      * Take special care with this functionality. */
-    if (/*messageIsOnCanBuffer && */ CANmodule->bufferInhibitFlag)
+    if (/*messageIsOnCanBuffer && */ __atomic_exchange_n(&CANmodule->bufferInhibitFlag, false, __ATOMIC_RELAXED))
     {
         /* clear TXREQ */
-        CANmodule->bufferInhibitFlag = false;
         tpdoDeleted = 1U;
     }
     /* delete also pending synchronous TPDOs in TX buffers */
-    if (CANmodule->CANtxCount != 0U)
+    if (__atomic_load_n(&CANmodule->CANtxCount, __ATOMIC_RELAXED) != 0U)
     {
         uint16_t i;
         CO_CANtx_t *buffer = &CANmodule->txArray[0];
-        for (i = CANmodule->txSize; i > 0U; i--)
+        for (i = 0U; i < CANmodule->txSize; i++)
         {
-            if (buffer->bufferFull)
+            /* message already in TWAI queue is not pending any more */
+            if (buffer->syncFlag && CO_CANtxPendingClear(CANmodule, i))
             {
-                if (buffer->syncFlag)
-                {
-                    buffer->bufferFull = false;
-                    CANmodule->CANtxCount--;
-                    tpdoDeleted = 2U;
-                }
+                __atomic_store_n(&buffer->bufferFull, false, __ATOMIC_RELEASE);
+                tpdoDeleted = 2U;
             }
             buffer++;
         }
     }
-    CO_UNLOCK_CAN_SEND(CANmodule);
 
     if (tpdoDeleted != 0U)
     {
-        CANmodule->CANerrorStatus |= CO_CAN_ERRTX_PDO_LATE;
+        __atomic_fetch_or(&CANmodule->CANerrorStatus, CO_CAN_ERRTX_PDO_LATE, __ATOMIC_RELAXED);
     }
 }
 
 /******************************************************************************/
-/* Get error counters from the module. If necessary, function may use
- * different way to determine errors. */
-static uint16_t rxErrors = 0, txErrors = 0, overflow = 0;
+#if CONFIG_CO_BUS_OFF_RECOVERY
+/* Bus-off recovery, driven by TWAI alerts. After bus-off it waits back-off
+ * time, initiates recovery and starts controller, when it has recovered. */
+static void CO_CANbusOffProcess(CO_CANmodule_t *CANmodule, uint32_t alerts)
+{
+    uint32_t now_us = (uint32_t)esp_timer_get_time();
 
-void CO_CANmodule_process(CO_CANmodule_t *CANmodule)
+    switch (CANmodule->busOffState)
+    {
+    case CO_CAN_BUS_OFF_NONE:
+        if ((alerts & TWAI_ALERT_BUS_OFF) != 0U)
+        {
+            /* double back-off time, if bus-off repeats soon after recovery */
+            if ((CANmodule->busOffDelay_ms != 0U) &&
+                ((now_us - CANmodule->busOffRecovered_us) < (CONFIG_CO_BUS_OFF_BACKOFF_MAX_MS * 1000U)))
+            {
+                CANmodule->busOffDelay_ms *= 2U;
+                if (CANmodule->busOffDelay_ms > CONFIG_CO_BUS_OFF_BACKOFF_MAX_MS)
+                {
+                    CANmodule->busOffDelay_ms = CONFIG_CO_BUS_OFF_BACKOFF_MAX_MS;
+                }
+            }
+            else
+            {
+                CANmodule->busOffDelay_ms = CONFIG_CO_BUS_OFF_BACKOFF_MS;
+            }
+            CANmodule->busOffTime_us = now_us;
+            CANmodule->busOffState = CO_CAN_BUS_OFF_BACKOFF;
+            ESP_LOGW(TAG, "Bus-off, recovery in %lu ms", (unsigned long)CANmodule->busOffDelay_ms);
+        }
+        break;
+
+    case CO_CAN_BUS_OFF_BACKOFF:
+        if ((now_us - CANmodule->busOffTime_us) >= (CANmodule->busOffDelay_ms * 1000U))
+        {
+            if (CANmodule->backend->initiateRecovery(CANmodule->backendHandle) == ESP_OK)
+            {
+                CANmodule->busOffState = CO_CAN_BUS_OFF_RECOVERING;
+            }
+        }
+        break;
+
+    case CO_CAN_BUS_OFF_RECOVERING:
+        if ((alerts & TWAI_ALERT_BUS_RECOVERED) != 0U)
+        {
+            if (CANmodule->backend->start(CANmodule->backendHandle) == ESP_OK)
+            {
+#if CONFIG_CO_DRIVER_STATS
+                __atomic_store_n(&CANmodule->stats.busOffRecoveryLast_us, now_us - CANmodule->busOffTime_us,
+                                 __ATOMIC_RELAXED);
+                CO_CANstatsMax(&CANmodule->stats.busOffRecoveryMax_us, now_us - CANmodule->busOffTime_us);
+#endif
+                CANmodule->busOffRecovered_us = now_us;
+                CANmodule->busOffState = CO_CAN_BUS_OFF_NONE;
+                ESP_LOGI(TAG, "Bus-off recovered in %lu us", (unsigned long)(now_us - CANmodule->busOffTime_us));
+            }
+        }
+        break;
+
+    default:
+        CANmodule->busOffState = CO_CAN_BUS_OFF_NONE;
+        break;
+    }
+}
+#endif /* CONFIG_CO_BUS_OFF_RECOVERY */
+
+/* Calculate error flags of CANerrorStatus from TWAI status, other flags are
+ * kept. */
+static uint16_t CO_CANerrorStatusCalc(uint16_t status, uint16_t txErrors, uint16_t rxErrors,
+                                      uint16_t overflow, bool_t busOff)
+{
+    if (busOff)
+    {
+        status |= CO_CAN_ERRTX_BUS_OFF;
+    }
+    else
+    {
+        /* recalculate CANerrorStatus, first clear some flags */
+        status &= 0xFFFF ^ (CO_CAN_ERRTX_BUS_OFF |
+                            CO_CAN_ERRRX_WARNING | CO_CAN_ERRRX_PASSIVE |
+                            CO_CAN_ERRTX_WARNING | CO_CAN_ERRTX_PASSIVE);
+
+        /* rx bus warning or passive */
+        if (rxErrors >= 128)
+        {
+            status |= CO_CAN_ERRRX_WARNING | CO_CAN_ERRRX_PASSIVE;
+        }
+        else if (rxErrors >= 96)
+        {
+            status |= CO_CAN_ERRRX_WARNING;
+        }
+
+        /* tx bus warning or passive */
+        if (txErrors >= 128)
+        {
+            status |= CO_CAN_ERRTX_WARNING | CO_CAN_ERRTX_PASSIVE;
+        }
+        else if (txErrors >= 96)
+        {
+            status |= CO_CAN_ERRTX_WARNING;
+        }
+
+        /* if not tx passive clear also overflow */
+        if ((status & CO_CAN_ERRTX_PASSIVE) == 0)
+        {
+            status &= 0xFFFF ^ CO_CAN_ERRTX_OVERFLOW;
+        }
+    }
+
+    if (overflow != 0)
+    {
+        /* CAN RX bus overflow */
+        status |= CO_CAN_ERRRX_OVERFLOW;
+    }
+
+    return status;
+}
+
+/* Read TWAI status and update CANerrorStatus, if error counters or state
+ * changed. CANerrorStatus is also written by CO_CANsend() from other tasks. */
+static void CO_CANerrorUpdate(CO_CANmodule_t *CANmodule)
 {
     uint32_t err;
     twai_status_info_t statusInfo;
     esp_err_t espRet = ESP_OK;
+    uint16_t rxErrors, txErrors, overflow;
+    bool_t busOff;
 
-    espRet = twai_get_status_info(&statusInfo);
+    espRet = CANmodule->backend->getStatusInfo(CANmodule->backendHandle, &statusInfo);
     if (espRet != ESP_OK)
     {
-        ESP_LOGW(TAG, "twai_get_status_info returns %d", espRet);
+        ESP_LOGW(TAG, "getStatusInfo returns %d", espRet);
         return;
     }
 
+#if CONFIG_CO_DRIVER_STATS
+    CO_CANstatsInc(&CANmodule->stats.statusReads);
+    CO_CANstatsAdd(&CANmodule->stats.rxOverrun, &CANmodule->statsStatusOld.rx_overrun_count, statusInfo.rx_overrun_count);
+    CO_CANstatsAdd(&CANmodule->stats.rxMissed, &CANmodule->statsStatusOld.rx_missed_count, statusInfo.rx_missed_count);
+    CO_CANstatsAdd(&CANmodule->stats.arbLost, &CANmodule->statsStatusOld.arb_lost_count, statusInfo.arb_lost_count);
+    CO_CANstatsAdd(&CANmodule->stats.busErrors, &CANmodule->statsStatusOld.bus_error_count, statusInfo.bus_error_count);
+#endif
+
     txErrors = (uint16_t)(statusInfo.tx_error_counter);
     rxErrors = (uint16_t)(statusInfo.rx_error_counter);
     overflow = (uint16_t)(statusInfo.rx_overrun_count);
+    /* TWAI error counters saturate, bus-off is reported by controller state */
+    busOff = (statusInfo.state == TWAI_STATE_BUS_OFF) || (statusInfo.state == TWAI_STATE_RECOVERING);
+#if CONFIG_CO_BUS_OFF_RECOVERY
+    busOff = busOff || (CANmodule->busOffState != CO_CAN_BUS_OFF_NONE);
+#endif
 
-    err = ((uint32_t)txErrors << 16) | ((uint32_t)rxErrors << 8) | overflow;
+    err = ((uint32_t)busOff << 31) | ((uint32_t)txErrors << 16) | ((uint32_t)rxErrors << 8) | overflow;
 
     if (CANmodule->errOld != err)
     {
-        uint16_t status = CANmodule->CANerrorStatus;
+        uint16_t status = __atomic_load_n(&CANmodule->CANerrorStatus, __ATOMIC_RELAXED);
+        uint16_t statusNew;
 
         CANmodule->errOld = err;
-
-        if (txErrors >= 256U)
+        do
         {
-            /* bus off */
-            status |= CO_CAN_ERRTX_BUS_OFF;
-        }
-        else
+            statusNew = CO_CANerrorStatusCalc(status, txErrors, rxErrors, overflow, busOff);
+        } while (!__atomic_compare_exchange_n(&CANmodule->CANerrorStatus, &status, statusNew,
+                                              false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#if CONFIG_CO_DRIVER_STATS
+        if (((statusNew & CO_CAN_ERRTX_BUS_OFF) != 0U) && ((status & CO_CAN_ERRTX_BUS_OFF) == 0U))
         {
-            /* recalculate CANerrorStatus, first clear some flags */
-            status &= 0xFFFF ^ (CO_CAN_ERRTX_BUS_OFF |
-                                CO_CAN_ERRRX_WARNING | CO_CAN_ERRRX_PASSIVE |
-                                CO_CAN_ERRTX_WARNING | CO_CAN_ERRTX_PASSIVE);
+            CO_CANstatsInc(&CANmodule->stats.busOff);
+        }
+#endif
+    }
+}
 
-            /* rx bus warning or passive */
-            if (rxErrors >= 128)
-            {
-                status |= CO_CAN_ERRRX_WARNING | CO_CAN_ERRRX_PASSIVE;
-            }
-            else if (rxErrors >= 96)
-            {
-                status |= CO_CAN_ERRRX_WARNING;
-            }
+/* Get error counters from the module. If necessary, function may use
+ * different way to determine errors. */
+void CO_CANmodule_process(CO_CANmodule_t *CANmodule)
+{
+    if (CO_CANbitRateSwitchProcess(CANmodule))
+    {
+        /* Driver is stopped or just reinstalled, CANerrorStatus is kept */
+        return;
+    }
+#if CONFIG_CO_TWAI_HW_FILTER
+    if (CANmodule->rxFilterUpdate)
+    {
+        CANmodule->rxFilterUpdate = false;
+        CO_CANrxFilterInstall(CANmodule);
+    }
+#endif
+#if CONFIG_CO_TWAI_ALERT_TASK
+    /* CANerrorStatus is updated by CO_alertTask */
+#else
+    CO_TRACE(CO_TRACE_MODULE_PROCESS_BEGIN, 0);
+#if CONFIG_CO_BUS_OFF_RECOVERY
+    uint32_t alerts = 0;
 
-            /* tx bus warning or passive */
-            if (txErrors >= 128)
-            {
-                status |= CO_CAN_ERRTX_WARNING | CO_CAN_ERRTX_PASSIVE;
-            }
-            else if (rxErrors >= 96)
-            {
-                status |= CO_CAN_ERRTX_WARNING;
-            }
+    if (CANmodule->backend->readAlerts(CANmodule->backendHandle, &alerts, 0) != ESP_OK)
+    {
+        alerts = 0;
+    }
+    CO_CANbusOffProcess(CANmodule, alerts);
+#endif
+    CO_CANerrorUpdate(CANmodule);
+    CO_TRACE(CO_TRACE_MODULE_PROCESS_END, CANmodule->CANerrorStatus);
+#endif /* CONFIG_CO_TWAI_ALERT_TASK */
+}
 
-            /* if not tx passive clear also overflow */
-            if ((status & CO_CAN_ERRTX_PASSIVE) == 0)
+/******************************************************************************/
+/* Take pending buffer with the lowest CAN identifier from txPending bitmap.
+ * This is the message, which would win arbitration on the bus. Buffer stays
+ * bufferFull until it is copied into TWAI queue. Returns NULL, if no buffer is
+ * pending. */
+static CO_CANtx_t *CO_CANtxTakePending(CO_CANmodule_t *CANmodule)
+{
+    CO_CANtx_t *pCanTx;
+    uint16_t indexFound;
+    uint16_t w;
+
+    do
+    {
+        pCanTx = NULL;
+        indexFound = 0U;
+        for (w = 0U; w < CO_CAN_TX_PENDING_WORDS; w++)
+        {
+            uint32_t pending = __atomic_load_n(&CANmodule->txPending[w], __ATOMIC_ACQUIRE);
+
+            /* visit only pending buffers, there are usually a few */
+            while (pending != 0U)
             {
-                status &= 0xFFFF ^ CO_CAN_ERRTX_OVERFLOW;
+                uint16_t index = (uint16_t)(w * 32U + __builtin_ctzl(pending));
+                CO_CANtx_t *buffer = &CANmodule->txArray[index];
+
+                if ((pCanTx == NULL) || (CO_CAN_TX_PRIORITY(buffer) < CO_CAN_TX_PRIORITY(pCanTx)))
+                {
+                    pCanTx = buffer;
+                    indexFound = index;
+                }
+                pending &= pending - 1U;
             }
         }
+        /* retry, if buffer was dropped by the stack in the meantime */
+    } while ((pCanTx != NULL) && !CO_CANtxPendingClear(CANmodule, indexFound));
+
+    if (pCanTx != NULL)
+    {
+        CANmodule->bufferInhibitFlag = pCanTx->syncFlag;
+    }
+
+    return pCanTx;
+}
+
+/* True, if any bit of txPending bitmap is set */
+static bool_t CO_CANtxAnyPending(CO_CANmodule_t *CANmodule)
+{
+    uint16_t w;
 
-        if (overflow != 0)
+    for (w = 0U; w < CO_CAN_TX_PENDING_WORDS; w++)
+    {
+        if (__atomic_load_n(&CANmodule->txPending[w], __ATOMIC_SEQ_CST) != 0U)
         {
-            /* CAN RX bus overflow */
-            status |= CO_CAN_ERRRX_OVERFLOW;
+            return true;
         }
+    }
+    return false;
+}
 
-        CANmodule->CANerrorStatus = status;
+/* Result of transmission of pCanTx, buffer is released */
+static void CO_CANtxDone(CO_CANmodule_t *CANmodule, CO_CANtx_t *pCanTx, esp_err_t espRet)
+{
+    CO_TRACE(CO_TRACE_TX_END, espRet);
+    if (ESP_OK == espRet)
+    {
+        /* First CAN message (bootup) was sent successfully */
+        CANmodule->firstCANtxMessage = false;
+#if CONFIG_CO_DRIVER_STATS
+        CO_CANstatsInc(&CANmodule->stats.txFrames);
+        CO_CANstatsInc(&pCanTx->frameCount);
+#endif
+    }
+    else
+    {
+#if CONFIG_CO_DRIVER_STATS
+        CO_CANstatsInc(&CANmodule->stats.txFailed);
+#endif
+        ESP_LOGE(TAG, "Failed Tx. id:0x%lx err:0x%x", pCanTx->ident, espRet);
     }
+    /* Buffer may be filled again, while message is in TWAI queue */
+    __atomic_store_n(&pCanTx->bufferFull, false, __ATOMIC_RELEASE);
 }
 
-/******************************************************************************/
 static void CO_txTask(void *pxParam)
 {
     uint32_t notificationValue;
-    twai_message_t tx_msg;
     CO_CANtx_t *pCanTx;
     esp_err_t espRet;
     CO_CANmodule_t *CANmodule = (CO_CANmodule_t *)pxParam;
@@ -523,77 +1562,135 @@ static void CO_txTask(void *pxParam)
     while (1)
     {
         xTaskNotifyWait(ULONG_MAX, ULONG_MAX, &notificationValue, portMAX_DELAY);
+        if (CANmodule->driverPause)
+        {
+            CO_CANtaskPark(CANmodule, CO_PARK_TX);
+        }
 
-        CO_LOCK_CAN_SEND(CANmodule);
-        /* First CAN message (bootup) was sent successfully */
-        CANmodule->firstCANtxMessage = false;
         /* clear flag from previous message */
         CANmodule->bufferInhibitFlag = false;
-        /* Are there any new messages waiting to be send */
-        while (CANmodule->CANtxCount > 0U)
+        /* Drain all pending messages. CO_CANsend() never waits for the
+         * hardware, while TWAI queue is full. On driverPause the remaining
+         * messages stay pending until the task resumes. */
+        while (!CANmodule->driverPause && ((pCanTx = CO_CANtxTakePending(CANmodule)) != NULL))
+        {
+            /* twai_transmit() copies frame directly from the buffer */
+#if CONFIG_CO_DRIVER_STATS
+            CO_CANstatsResidence(CANmodule, pCanTx);
+#endif
+            CO_TRACE(CO_TRACE_TX_BEGIN, pCanTx->ident);
+            espRet = CANmodule->backend->transmit(CANmodule->backendHandle, &pCanTx->frame, pdMS_TO_TICKS(CO_TX_TASK_WAIT_MS));
+            CO_CANtxDone(CANmodule, pCanTx, espRet);
+        }
+        if (CANmodule->driverPause)
+        {
+            /* park in the next loop */
+            xTaskNotify(CANmodule->txTaskHandle, 0, eNoAction);
+        }
+        else
         {
-            /* search through whole array of pointers to transmit message buffers. */
-            for (int i = 0; i < CANmodule->txSize; i++)
+            /* CO_CANsend() doesn't wake this task, while it is busy. Go idle,
+             * then catch buffers set pending meanwhile. If CO_CANsend() took
+             * txIdle first, its notification is already on the way. */
+            __atomic_store_n(&CANmodule->txIdle, true, __ATOMIC_SEQ_CST);
+            if (CO_CANtxAnyPending(CANmodule) && __atomic_exchange_n(&CANmodule->txIdle, false, __ATOMIC_SEQ_CST))
             {
-                pCanTx = &(CANmodule->txArray[i]);
-                if (pCanTx->bufferFull)
-                {
-                    memset(&tx_msg, 0, sizeof(tx_msg));
-                    tx_msg.identifier = pCanTx->ident;
-                    tx_msg.data_length_code = pCanTx->DLC;
-                    memcpy(tx_msg.data, pCanTx->data, TWAI_FRAME_MAX_DLC);
-
-                    espRet = twai_transmit(&tx_msg, pdMS_TO_TICKS(1000));
-                    if (ESP_OK == espRet)
-                    {
-                        pCanTx->bufferFull = false;
-                    }
-                    else
-                    {
-                        ESP_LOGE(TAG, "Failed Tx. id:%d err:0x%x", i, espRet);
-                    }
-                    CANmodule->CANtxCount--;
-                    CANmodule->bufferInhibitFlag = pCanTx->syncFlag;
-                    break; /* exit for loop */
-                }
+                xTaskNotify(CANmodule->txTaskHandle, 0, eNoAction);
             }
         }
-        CO_UNLOCK_CAN_SEND(CANmodule);
     }
 }
 
-static void CO_rxTask(void *pxParam)
+#if CONFIG_CO_TWAI_ALERT_TASK
+/* Waits for TWAI alerts and updates CANerrorStatus and bus-off recovery only
+ * after an alert, so CO_CANmodule_process() does not access the driver. */
+static void CO_alertTask(void *pxParam)
 {
-    twai_message_t rx_msg;
     CO_CANmodule_t *CANmodule = (CO_CANmodule_t *)pxParam;
-    ESP_LOGI(TAG, "rx task running");
+    uint32_t alerts;
+    TickType_t wait;
+    ESP_LOGI(TAG, "alert task running");
 
     while (1)
     {
-        twai_message_t *rcvMsg;    /* pointer to received message in CAN module */
-        uint16_t index;            /* index of received message */
-        uint32_t rcvMsgIdent;      /* identifier of the received message */
-        CO_CANrx_t *buffer = NULL; /* receive message buffer from CO_CANmodule_t object. */
-        bool_t msgMatched = false;
+        if (CANmodule->driverPause)
+        {
+            CO_CANtaskPark(CANmodule, CO_PARK_ALERT);
+        }
+        wait = pdMS_TO_TICKS(CO_RX_TASK_WAIT_MS);
+#if CONFIG_CO_BUS_OFF_RECOVERY
+        if (CANmodule->busOffState == CO_CAN_BUS_OFF_BACKOFF)
+        {
+            /* check back-off time every tick */
+            wait = 1;
+        }
+#endif
+        if (CANmodule->backend->readAlerts(CANmodule->backendHandle, &alerts, wait) != ESP_OK)
+        {
+            alerts = 0;
+        }
+#if CONFIG_CO_DRIVER_STATS
+        if ((alerts & TWAI_ALERT_RX_QUEUE_FULL) != 0U)
+        {
+            CO_CANstatsInc(&CANmodule->stats.rxQueueFull);
+        }
+#endif
+#if CONFIG_CO_BUS_OFF_RECOVERY
+        CO_CANbusOffProcess(CANmodule, alerts);
+#endif
+#if CONFIG_CO_DRIVER_STATS
+        if ((alerts & (CO_CAN_ERROR_ALERTS | CO_CAN_STATS_ALERTS)) != 0U)
+#else
+        if ((alerts & CO_CAN_ERROR_ALERTS) != 0U)
+#endif
+        {
+            CO_CANerrorUpdate(CANmodule);
+        }
+    }
+}
+#endif /* CONFIG_CO_TWAI_ALERT_TASK */
 
-        twai_receive(&rx_msg, portMAX_DELAY);
+/* Find rxArray buffer of received frame and call its callback */
+static void CO_CANrxProcess(CO_CANmodule_t *CANmodule, CO_CANrxMsg_t *rcvMsg)
+{
+    uint16_t index;            /* index of received message */
+    uint32_t rcvMsgIdent;      /* identifier of the received message */
+    CO_CANrx_t *buffer = NULL; /* receive message buffer from CO_CANmodule_t object. */
+    bool_t msgMatched = false;
 
 #if CONFIG_CO_DEBUG_DRIVER_CAN_RECEIVE
-        ESP_LOGI(TAG, "CANRX id: 0x%lx, dlc: %d, data: [%d %d %d %d %d %d %d %d]",
-                 rx_msg.identifier,
-                 rx_msg.data_length_code,
-                 rx_msg.data[0],
-                 rx_msg.data[1],
-                 rx_msg.data[2],
-                 rx_msg.data[3],
-                 rx_msg.data[4],
-                 rx_msg.data[5],
-                 rx_msg.data[6],
-                 rx_msg.data[7]);
+    ESP_LOGI(TAG, "CANRX id: 0x%lx, dlc: %d, data: [%d %d %d %d %d %d %d %d]",
+             rcvMsg->identifier,
+             rcvMsg->data_length_code,
+             rcvMsg->data[0],
+             rcvMsg->data[1],
+             rcvMsg->data[2],
+             rcvMsg->data[3],
+             rcvMsg->data[4],
+             rcvMsg->data[5],
+             rcvMsg->data[6],
+             rcvMsg->data[7]);
 #endif /* CONFIG_CO_DEBUG_DRIVER_CAN_RECEIVE */
 
-        rcvMsg = &rx_msg;
-        rcvMsgIdent = rx_msg.identifier;
+    rcvMsgIdent = rcvMsg->identifier;
+    CO_TRACE(CO_TRACE_RX_BEGIN, rcvMsgIdent);
+#if CONFIG_CO_RX_DISPATCH_TABLE
+    if (CANmodule->rxSize < CO_CAN_RX_DISPATCH_NONE)
+    {
+        /* Dispatch table holds rxArray index for each standard 11-bit identifier. */
+        if (rcvMsgIdent <= 0x07FFU)
+        {
+            index = CANmodule->rxDispatch[rcvMsgIdent];
+            if (index != CO_CAN_RX_DISPATCH_NONE)
+            {
+                buffer = &CANmodule->rxArray[index];
+                msgMatched = true;
+            }
+        }
+    }
+    else
+#endif /* CONFIG_CO_RX_DISPATCH_TABLE */
+    {
         /* CAN module filters are not used, message with any standard 11-bit identifier */
         /* has been received. Search rxArray form CANmodule for the same CAN-ID. */
         buffer = &CANmodule->rxArray[0];
@@ -606,11 +1703,51 @@ static void CO_rxTask(void *pxParam)
             }
             buffer++;
         }
+    }
 
-        /* Call specific function, which will process the message */
-        if (msgMatched && (buffer != NULL) && (buffer->CANrx_callback != NULL))
+#if CONFIG_CO_TWAI_HW_FILTER
+    CANmodule->rxFrameCount++;
+    if (!msgMatched)
+    {
+        CANmodule->rxUnmatchedCount++;
+    }
+#endif
+#if CONFIG_CO_DRIVER_STATS
+    CO_CANstatsInc(&CANmodule->stats.rxFrames);
+    if (msgMatched)
+    {
+        CO_CANstatsInc(&buffer->frameCount);
+    }
+    else
+    {
+        CO_CANstatsInc(&CANmodule->stats.rxUnmatched);
+    }
+#endif
+
+    /* Call specific function, which will process the message */
+    if (msgMatched && (buffer != NULL) && (buffer->CANrx_callback != NULL))
+    {
+        buffer->CANrx_callback(buffer->object, (void *)rcvMsg);
+    }
+    CO_TRACE(CO_TRACE_RX_END, msgMatched ? (uint32_t)(buffer - CANmodule->rxArray) : 0xFFFFU);
+}
+
+static void CO_rxTask(void *pxParam)
+{
+    CO_CANrxMsg_t rx_msg;
+    CO_CANmodule_t *CANmodule = (CO_CANmodule_t *)pxParam;
+    ESP_LOGI(TAG, "rx task running");
+
+    while (1)
+    {
+        if (CANmodule->driverPause)
+        {
+            CO_CANtaskPark(CANmodule, CO_PARK_RX);
+        }
+        if (CANmodule->backend->receive(CANmodule->backendHandle, &rx_msg, pdMS_TO_TICKS(CO_RX_TASK_WAIT_MS)) != ESP_OK)
         {
-            buffer->CANrx_callback(buffer->object, (void *)rcvMsg);
+            continue;
         }
+        CO_CANrxProcess(CANmodule, &rx_msg);
     }
-}
\ No newline at end of file
+}
@@ -36,6 +36,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "driver/twai.h"
+#include "CO_CANbackend.h"
 
 #ifdef CO_DRIVER_CUSTOM
 #include "CO_driver_custom.h"
@@ -61,10 +62,42 @@ typedef uint_fast8_t bool_t;
 typedef float float32_t;
 typedef double float64_t;
 
+/* CANopen objects are global variables, CO_new() does not use heap */
+#if CONFIG_CO_STATIC_ALLOCATION
+#define CO_USE_GLOBALS
+#endif
+
+/* TWAI controller of CAN module, passed as CANptr to CO_CANinit(). If CANptr
+ * is NULL, controller and GPIOs from Kconfig are used. backend may replace
+ * the on-chip controller, see CO_CANbackend.h. */
+typedef struct
+{
+    const CO_CANbackend_t *backend; /* NULL: on-chip TWAI controller */
+    int controllerId;
+    int txGpio;
+    int rxGpio;
+    BaseType_t rxTaskCore; /* core affinity of rx task */
+    BaseType_t txTaskCore; /* core affinity of tx task */
+} CO_CANptrTWAI_t;
+
+/* Received CAN message, as it is received by twai_receive() */
+typedef twai_message_t CO_CANrxMsg_t;
+
 /* Access to received CAN message */
-#define CO_CANrxMsg_readIdent(msg) ((uint16_t)(((twai_message_t *)msg)->identifier))
-#define CO_CANrxMsg_readDLC(msg) ((uint8_t)(((twai_message_t *)msg)->data_length_code))
-#define CO_CANrxMsg_readData(msg) ((uint8_t *)&(((twai_message_t *)msg)->data[0]))
+#define CO_CANrxMsg_readIdent(msg) ((uint16_t)(((const CO_CANrxMsg_t *)(msg))->identifier))
+#define CO_CANrxMsg_readDLC(msg) ((uint8_t)(((const CO_CANrxMsg_t *)(msg))->data_length_code))
+#define CO_CANrxMsg_readData(msg) ((uint8_t *)(((CO_CANrxMsg_t *)(msg))->data))
+
+#if CONFIG_CO_RX_DISPATCH_TABLE
+/* Number of RX dispatch table entries, one for each 11-bit CAN identifier */
+#define CO_CAN_RX_DISPATCH_SIZE 0x800U
+/* RX dispatch table entry without matching rxArray buffer. rxArray with more
+ * buffers than this value is searched linearly. */
+#define CO_CAN_RX_DISPATCH_NONE 0xFFU
+#endif /* CONFIG_CO_RX_DISPATCH_TABLE */
+
+/* Number of 32-bit words in bitmap of pending TX buffers */
+#define CO_CAN_TX_PENDING_WORDS ((CONFIG_CO_TX_BUFFER_MAX + 31) / 32)
 
 /* Received message object */
 typedef struct
@@ -73,22 +106,77 @@ typedef struct
     uint16_t mask;
     void *object;
     void (*CANrx_callback)(void *object, void *message);
+#if CONFIG_CO_DRIVER_STATS
+    uint32_t frameCount; /* frames dispatched to this buffer */
+#endif
 } CO_CANrx_t;
 
-/* Transmit message object */
+/* Transmit message object. flags, ident, DLC and data overlay twai_message_t,
+ * so buffer is passed to twai_transmit() without building a copy. */
 typedef struct
 {
-    uint32_t ident;
-    uint8_t DLC;
-    uint8_t data[8];
+    union
+    {
+        twai_message_t frame;
+        struct
+        {
+            uint32_t flags;
+            uint32_t ident;
+            uint8_t DLC;
+            uint8_t data[8];
+        };
+    };
     volatile bool_t bufferFull;
     volatile bool_t syncFlag;
+#if CONFIG_CO_DRIVER_STATS
+    uint32_t frameCount; /* frames passed to TWAI from this buffer */
+    uint32_t sendTime_us; /* time of CO_CANsend(), for residence time */
+#endif
 } CO_CANtx_t;
 
+#if CONFIG_CO_DRIVER_STATS
+/* Number of bins in TX residence time histogram */
+#define CO_CAN_STATS_RESIDENCE_BINS 16U
+
+/* Driver statistics. Frames per COB-ID are counted in frameCount of rxArray
+ * and txArray buffers. */
+typedef struct
+{
+    uint32_t rxFrames;         /* all frames received from TWAI */
+    uint32_t rxUnmatched;      /* received frames without matching rx buffer */
+    uint32_t txFrames;         /* frames passed to TWAI transmit queue */
+    uint32_t txFailed;         /* twai_transmit() failures */
+    uint32_t txOverflow;       /* CO_CANsend() on buffer, which is still full */
+    uint32_t txCountHighWater; /* maximum of CANtxCount */
+    uint32_t rxOverrun;        /* TWAI rx_overrun_count */
+    uint32_t rxMissed;         /* TWAI rx_missed_count */
+    uint32_t arbLost;          /* TWAI arb_lost_count */
+    uint32_t busErrors;        /* TWAI bus_error_count */
+    /* Time from CO_CANsend() to TWAI transmit queue. Bin 0 counts times below
+     * 2 us, bin n times from 2^n to 2^(n+1) us, last bin all longer. */
+    uint32_t txResidence[CO_CAN_STATS_RESIDENCE_BINS];
+    uint32_t busOff;               /* bus-off events */
+    uint32_t busOffRecoveryLast_us; /* bus-off to controller restart, last */
+    uint32_t busOffRecoveryMax_us;  /* bus-off to controller restart, maximum */
+    uint32_t rxQueueFull;           /* TWAI_ALERT_RX_QUEUE_FULL alerts */
+    uint32_t statusReads;           /* twai_get_status_info() calls */
+} CO_CANstats_t;
+/* Number of uint32_t values in CO_CANstats_t */
+#define CO_CAN_STATS_VALUES (15U + CO_CAN_STATS_RESIDENCE_BINS)
+#endif /* CONFIG_CO_DRIVER_STATS */
+
 /* CAN module object */
 typedef struct
 {
     void *CANptr;
+    const CO_CANbackend_t *backend;
+    void *backendHandle;
+    TaskHandle_t txTaskHandle;
+    TaskHandle_t rxTaskHandle;
+#if CONFIG_CO_TWAI_ALERT_TASK
+    TaskHandle_t alertTaskHandle;
+#endif
+    uint8_t instance;
     CO_CANrx_t *rxArray;
     uint16_t rxSize;
     CO_CANtx_t *txArray;
@@ -99,15 +187,57 @@ typedef struct
     volatile bool_t bufferInhibitFlag;
     volatile bool_t firstCANtxMessage;
     volatile uint16_t CANtxCount;
+    volatile bool_t txIdle; /* CO_txTask waits, CO_CANsend() must notify it */
     uint32_t errOld;
-    StaticSemaphore_t xMutexCanSendBuf;
-    SemaphoreHandle_t xMutexCanSendHdl;
+#if CONFIG_CO_BUS_OFF_RECOVERY
+    uint8_t busOffState;         /* see CO_CANbusOffProcess() */
+    uint32_t busOffDelay_ms;     /* actual back-off time, 0 before first bus-off */
+    uint32_t busOffTime_us;      /* time of bus-off */
+    uint32_t busOffRecovered_us; /* time of last restart after bus-off */
+#endif
+    uint32_t txPending[CO_CAN_TX_PENDING_WORDS];
+#if CONFIG_CO_RX_DISPATCH_TABLE
+    uint8_t rxDispatch[CO_CAN_RX_DISPATCH_SIZE];
+#endif
+    portMUX_TYPE xSpinlockCanSend;
     StaticSemaphore_t xMutexEmcyBuf;
     SemaphoreHandle_t xMutexEmcyHdl;
     StaticSemaphore_t xMutexODBuf;
     SemaphoreHandle_t xMutexODHdl;
+    volatile bool_t driverPause;
+    StaticSemaphore_t xSemParkBuf;
+    SemaphoreHandle_t xSemParkHdl;
+#if CONFIG_CO_TWAI_HW_FILTER
+    uint32_t rxFrameCount;
+    uint32_t rxUnmatchedCount;
+    volatile bool_t rxFilterUpdate; /* rxArray changed in normal mode */
+#endif
+#if CONFIG_CO_DRIVER_STATS
+    CO_CANstats_t stats;
+    twai_status_info_t statsStatusOld;
+#endif
 } CO_CANmodule_t;
 
+#if CONFIG_CO_DRIVER_STATS
+/* Copy driver statistics, counted since CO_CANmodule_init() or the last reset.
+ * TWAI counters are updated by CO_CANmodule_process(). If reset is true,
+ * module and per buffer counters start from zero. Each counter is copied and
+ * reset atomically, so counts are not lost between two calls, but counters
+ * are not a snapshot of one instant. */
+void CO_CANmodule_getStats(CO_CANmodule_t *CANmodule, CO_CANstats_t *stats, bool_t reset);
+#endif
+
+/* Return true, if bit rate in kbit/s is enabled in Kconfig "Supported Baud Rate" */
+bool_t CO_CANcheckBitRate(uint16_t bitRate);
+
+/* Switch running CAN module to bit rate in kbit/s (LSS activate bit timing).
+ * Transmission stops for switchDelay_ms, the driver is reinstalled with new
+ * timing and transmission resumes after another switchDelay_ms. Returns
+ * immediately, the switch runs in CO_CANmodule_process(), so delays are
+ * rounded up to its calls. Frames sent during the switch stay pending. Return false, if bit rate is not supported
+ * or module is not initialized. */
+bool_t CO_CANsetBitRate(CO_CANmodule_t *CANmodule, uint16_t bitRate, uint16_t switchDelay_ms);
+
 /* Data storage object for one entry */
 typedef struct
 {
@@ -117,11 +247,15 @@ typedef struct
     uint8_t attr;
     /* Additional variables (target specific) */
     void *addrNV;
+    uint16_t crc;   /* CRC of data in NVS, unchanged data is not written */
+    bool_t stored;  /* data with crc is in NVS */
 } CO_storage_entry_t;
 
-/* (un)lock critical section in CO_CANsend() */
-#define CO_LOCK_CAN_SEND(CAN_MODULE) (xSemaphoreTakeRecursive(CAN_MODULE->xMutexCanSendHdl, portMAX_DELAY))
-#define CO_UNLOCK_CAN_SEND(CAN_MODULE) (xSemaphoreGiveRecursive(CAN_MODULE->xMutexCanSendHdl))
+/* (un)lock critical section in CO_CANsend(). The driver itself updates TX
+ * buffer flags, pending bitmap and CANtxCount with atomic operations and does
+ * not use it. Spinlock, must not be nested or blocking. */
+#define CO_LOCK_CAN_SEND(CAN_MODULE) taskENTER_CRITICAL(&(CAN_MODULE)->xSpinlockCanSend)
+#define CO_UNLOCK_CAN_SEND(CAN_MODULE) taskEXIT_CRITICAL(&(CAN_MODULE)->xSpinlockCanSend)
 
 /* (un)lock critical section in CO_errorReport() or CO_errorReset() */
 #define CO_LOCK_EMCY(CAN_MODULE) (xSemaphoreTakeRecursive(CAN_MODULE->xMutexEmcyHdl, portMAX_DELAY))
@@ -131,19 +265,16 @@ typedef struct
 #define CO_LOCK_OD(CAN_MODULE) (xSemaphoreTakeRecursive(CAN_MODULE->xMutexODHdl, portMAX_DELAY))
 #define CO_UNLOCK_OD(CAN_MODULE) (xSemaphoreGiveRecursive(CAN_MODULE->xMutexODHdl))
 
-/* Synchronization between CAN receive and message processing threads. */
-#define CO_MemoryBarrier()
-#define CO_FLAG_READ(rxNew) ((rxNew) != NULL)
-#define CO_FLAG_SET(rxNew)  \
-    {                       \
-        CO_MemoryBarrier(); \
-        rxNew = (void *)1L; \
-    }
-#define CO_FLAG_CLEAR(rxNew) \
-    {                        \
-        CO_MemoryBarrier();  \
-        rxNew = NULL;        \
-    }
+/* Synchronization between CAN receive and message processing threads.
+ * CO_rxTask and the processing tasks may run on different cores. Contract:
+ * receive callback writes the message data, then publishes it with
+ * CO_FLAG_SET() (release). Processing task reads the data only after
+ * CO_FLAG_READ() returned true (acquire) and releases the buffer with
+ * CO_FLAG_CLEAR() (release), after data is consumed. */
+#define CO_MemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define CO_FLAG_READ(rxNew) (__atomic_load_n(&(rxNew), __ATOMIC_ACQUIRE) != NULL)
+#define CO_FLAG_SET(rxNew) __atomic_store_n(&(rxNew), (void *)1L, __ATOMIC_RELEASE)
+#define CO_FLAG_CLEAR(rxNew) __atomic_store_n(&(rxNew), NULL, __ATOMIC_RELEASE)
 
 /* Stack configuration override default values.
  * For more information see file CO_config.h. */
@@ -153,6 +284,32 @@ typedef struct
 #define CO_CONFIG_LEDS 0
 #endif
 
+#if CONFIG_CO_PERIODIC_TASK_STATS
+/* SYNC reception is timestamped from CO_SYNC callback */
+#define CO_CONFIG_GLOBAL_RT_FLAG_CALLBACK_PRE CO_CONFIG_FLAG_CALLBACK_PRE
+#endif
+
+#if CONFIG_CO_MAIN_TASK_EVENT_DRIVEN
+/* Received messages wake the main task, which sleeps until timerNext_us */
+#define CO_CONFIG_GLOBAL_FLAG_CALLBACK_PRE CO_CONFIG_FLAG_CALLBACK_PRE
+#define CO_CONFIG_GLOBAL_FLAG_TIMERNEXT CO_CONFIG_FLAG_TIMERNEXT
+#endif
+
+/* LSS slave answers fastscan directly from CO_rxTask, not from CO_process() */
+#if CONFIG_CO_LSS_MASTER
+#define CO_CONFIG_LSS (CO_CONFIG_LSS_SLAVE | CO_CONFIG_LSS_SLAVE_FASTSCAN_DIRECT_RESPOND | \
+                       CO_CONFIG_LSS_MASTER | CO_CONFIG_GLOBAL_FLAG_CALLBACK_PRE)
+#else
+#define CO_CONFIG_LSS (CO_CONFIG_LSS_SLAVE | CO_CONFIG_LSS_SLAVE_FASTSCAN_DIRECT_RESPOND | \
+                       CO_CONFIG_GLOBAL_FLAG_CALLBACK_PRE)
+#endif
+
+#if CONFIG_CO_LSS_MASTER_RESET_COMM
+/* NMT master sends reset communication after LSS fastscan */
+#define CO_CONFIG_NMT (CO_CONFIG_NMT_MASTER | CO_CONFIG_GLOBAL_FLAG_CALLBACK_PRE | \
+                       CO_CONFIG_GLOBAL_FLAG_TIMERNEXT)
+#endif
+
 #if CONFIG_CO_DEBUG_SDO
 #define CO_CONFIG_DEBUG (CO_CONFIG_DEBUG_SDO_CLIENT | CO_CONFIG_DEBUG_SDO_SERVER)
 #define CO_DEBUG_COMMON(msg) ESP_LOGI("CO_SDO", "%s", msg)
@@ -0,0 +1,335 @@
+/*
+ * CANopen data storage object for storing data into ESP32 NVS.
+ *
+ * @file        CO_storageNVS.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "CO_storageNVS.h"
+
+#if ((CO_CONFIG_STORAGE) & CO_CONFIG_STORAGE_ENABLE)
+
+static const char *TAG = "CO_storage";
+
+/* NVS keys of LSS configuration, they do not collide with "subXX" */
+#define CO_STORAGE_NVS_KEY_LSS_NODE_ID "lssNodeId"
+#define CO_STORAGE_NVS_KEY_LSS_BIT_RATE "lssBitRate"
+
+/* NVS handle of CONFIG_CO_STORAGE_NVS_NAMESPACE */
+static nvs_handle_t nvsHandle;
+/* Serializes writes from store command and auto storage, guards dataBuf */
+static StaticSemaphore_t xMutexWriteBuf;
+static SemaphoreHandle_t xMutexWriteHdl = NULL;
+/* Copy of one entry, so Object Dictionary is not locked during flash access */
+static uint8_t dataBuf[CONFIG_CO_STORAGE_BUFFER_SIZE];
+
+/* NVS key of entry, NVS_KEY_NAME_MAX_SIZE is enough */
+static void CO_storageNVS_key(const CO_storage_entry_t *entry, char *key)
+{
+    snprintf(key, NVS_KEY_NAME_MAX_SIZE, "sub%02X", entry->subIndexOD);
+}
+
+static uint16_t CO_storageNVS_crc(const void *data, size_t len)
+{
+    return esp_rom_crc16_le(0, (const uint8_t *)data, len);
+}
+
+/* Write data to NVS, if it changed. Called with xMutexWriteHdl taken. */
+static ODR_t CO_storageNVS_write(CO_storage_entry_t *entry, const void *data)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint16_t crc = CO_storageNVS_crc(data, entry->len);
+    esp_err_t err;
+
+    /* skip flash write, if data did not change */
+    if (entry->stored && (entry->crc == crc))
+    {
+        return ODR_OK;
+    }
+
+    /* NVS keeps previous blob, until the new one is complete */
+    CO_storageNVS_key(entry, key);
+    err = nvs_set_blob(nvsHandle, key, data, entry->len);
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvsHandle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Writing %s failed: %s", key, esp_err_to_name(err));
+        return ODR_HW;
+    }
+    entry->crc = crc;
+    entry->stored = true;
+
+    return ODR_OK;
+}
+
+/* Copy Object Dictionary data of entry to dataBuf and write it to NVS, if it
+ * changed. Called with xMutexWriteHdl taken. */
+static ODR_t CO_storageNVS_copyAndWrite(CO_storage_entry_t *entry, CO_CANmodule_t *CANmodule)
+{
+    CO_LOCK_OD(CANmodule);
+    memcpy(dataBuf, entry->addr, entry->len);
+    CO_UNLOCK_OD(CANmodule);
+
+    return CO_storageNVS_write(entry, dataBuf);
+}
+
+/******************************************************************************/
+ODR_t CO_storageNVS_writeEntry(CO_storage_entry_t *entry, const void *data)
+{
+    ODR_t ret;
+
+    xSemaphoreTake(xMutexWriteHdl, portMAX_DELAY);
+    ret = CO_storageNVS_write(entry, data);
+    xSemaphoreGive(xMutexWriteHdl);
+
+    return ret;
+}
+
+/*
+ * Function for writing data on "Store parameters" command - OD object 1010
+ *
+ * For more information see file CO_storage.h, CO_storage_entry_t.
+ */
+static ODR_t storeNVS(CO_storage_entry_t *entry, CO_CANmodule_t *CANmodule)
+{
+    ODR_t ret;
+
+    xSemaphoreTake(xMutexWriteHdl, portMAX_DELAY);
+    ret = CO_storageNVS_copyAndWrite(entry, CANmodule);
+    xSemaphoreGive(xMutexWriteHdl);
+
+    return ret;
+}
+
+/*
+ * Function for restoring data on "Restore default parameters" command - OD 1011
+ *
+ * For more information see file CO_storage.h, CO_storage_entry_t.
+ */
+static ODR_t restoreNVS(CO_storage_entry_t *entry, CO_CANmodule_t *CANmodule)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    esp_err_t err;
+
+    /* Without stored data, defaults are used after the next reset */
+    CO_storageNVS_key(entry, key);
+    xSemaphoreTake(xMutexWriteHdl, portMAX_DELAY);
+    err = nvs_erase_key(nvsHandle, key);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        err = ESP_OK;
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvsHandle);
+    }
+    if (err == ESP_OK)
+    {
+        entry->stored = false;
+    }
+    xSemaphoreGive(xMutexWriteHdl);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Erasing %s failed: %s", key, esp_err_to_name(err));
+        return ODR_HW;
+    }
+
+    return ODR_OK;
+}
+
+/******************************************************************************/
+uint32_t CO_storageNVS_autoProcess(CO_storage_t *storage)
+{
+    uint32_t errorMask = 0;
+    uint8_t i;
+
+    for (i = 0; i < storage->entriesCount; i++)
+    {
+        CO_storage_entry_t *entry = &storage->entries[i];
+        ODR_t ret;
+
+        if ((entry->attr & CO_storage_auto) == 0)
+        {
+            continue;
+        }
+
+        /* CRC of the copy decides, if the entry is written */
+        xSemaphoreTake(xMutexWriteHdl, portMAX_DELAY);
+        ret = CO_storageNVS_copyAndWrite(entry, storage->CANmodule);
+        xSemaphoreGive(xMutexWriteHdl);
+        if (ret != ODR_OK)
+        {
+            errorMask |= ((uint32_t)1) << (entry->subIndexOD & 0x1F);
+        }
+    }
+
+    return errorMask;
+}
+
+/******************************************************************************/
+bool_t CO_storageNVS_writeLSS(uint8_t nodeId, uint16_t bitRate)
+{
+    esp_err_t err;
+
+    xSemaphoreTake(xMutexWriteHdl, portMAX_DELAY);
+    err = nvs_set_u8(nvsHandle, CO_STORAGE_NVS_KEY_LSS_NODE_ID, nodeId);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_u16(nvsHandle, CO_STORAGE_NVS_KEY_LSS_BIT_RATE, bitRate);
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvsHandle);
+    }
+    xSemaphoreGive(xMutexWriteHdl);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Writing LSS configuration failed: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    return true;
+}
+
+/******************************************************************************/
+bool_t CO_storageNVS_readLSS(uint8_t *nodeId, uint16_t *bitRate)
+{
+    uint8_t id;
+    uint16_t rate;
+
+    if ((nvs_get_u8(nvsHandle, CO_STORAGE_NVS_KEY_LSS_NODE_ID, &id) != ESP_OK) ||
+        (nvs_get_u16(nvsHandle, CO_STORAGE_NVS_KEY_LSS_BIT_RATE, &rate) != ESP_OK))
+    {
+        return false;
+    }
+    *nodeId = id;
+    *bitRate = rate;
+
+    return true;
+}
+
+/******************************************************************************/
+CO_ReturnError_t CO_storageNVS_init(CO_storage_t *storage,
+                                    CO_CANmodule_t *CANmodule,
+                                    OD_entry_t *OD_1010_StoreParameters,
+                                    OD_entry_t *OD_1011_RestoreDefaultParameters,
+                                    CO_storage_entry_t *entries,
+                                    uint8_t entriesCount,
+                                    uint32_t *storageInitError)
+{
+    CO_ReturnError_t ret;
+    esp_err_t err;
+    uint8_t i;
+
+    /* verify arguments */
+    if ((storage == NULL) || (entries == NULL) || (entriesCount == 0) || (storageInitError == NULL))
+    {
+        return CO_ERROR_ILLEGAL_ARGUMENT;
+    }
+    *storageInitError = 0;
+    if (xMutexWriteHdl == NULL)
+    {
+        xMutexWriteHdl = xSemaphoreCreateMutexStatic(&xMutexWriteBuf);
+    }
+
+    /* Partition is not erased here, it may hold data of the application */
+    err = nvs_flash_init();
+    if (err == ESP_OK)
+    {
+        err = nvs_open(CONFIG_CO_STORAGE_NVS_NAMESPACE, NVS_READWRITE, &nvsHandle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "NVS not available: %s", esp_err_to_name(err));
+        return CO_ERROR_DATA_CORRUPT;
+    }
+
+    ret = CO_storage_init(storage,
+                          CANmodule,
+                          OD_1010_StoreParameters,
+                          OD_1011_RestoreDefaultParameters,
+                          storeNVS,
+                          restoreNVS,
+                          entries,
+                          entriesCount);
+    if (ret != CO_ERROR_NO)
+    {
+        return ret;
+    }
+
+    /* Read stored data into Object Dictionary variables */
+    for (i = 0; i < entriesCount; i++)
+    {
+        CO_storage_entry_t *entry = &entries[i];
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        size_t len = 0;
+
+        entry->stored = false;
+        if ((entry->addr == NULL) || (entry->len == 0) || (entry->subIndexOD < 2))
+        {
+            return CO_ERROR_ILLEGAL_ARGUMENT;
+        }
+        if (entry->len > sizeof(dataBuf))
+        {
+            ESP_LOGE(TAG, "Entry %02X has %u bytes, more than CONFIG_CO_STORAGE_BUFFER_SIZE",
+                     entry->subIndexOD, (unsigned)entry->len);
+            return CO_ERROR_ILLEGAL_ARGUMENT;
+        }
+
+        CO_storageNVS_key(entry, key);
+        err = nvs_get_blob(nvsHandle, key, NULL, &len);
+        if (err == ESP_ERR_NVS_NOT_FOUND)
+        {
+            /* never stored, keep defaults */
+            continue;
+        }
+        if ((err != ESP_OK) || (len != entry->len))
+        {
+            ESP_LOGW(TAG, "Stored %s not valid, using defaults", key);
+            *storageInitError |= ((uint32_t)1) << (entry->subIndexOD & 0x1F);
+            continue;
+        }
+
+        /* read into a copy, so defaults survive a failed read */
+        xSemaphoreTake(xMutexWriteHdl, portMAX_DELAY);
+        err = nvs_get_blob(nvsHandle, key, dataBuf, &len);
+        if (err == ESP_OK)
+        {
+            memcpy(entry->addr, dataBuf, len);
+            entry->crc = CO_storageNVS_crc(dataBuf, len);
+            entry->stored = true;
+        }
+        xSemaphoreGive(xMutexWriteHdl);
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Reading %s failed: %s", key, esp_err_to_name(err));
+            *storageInitError |= ((uint32_t)1) << (entry->subIndexOD & 0x1F);
+        }
+    }
+
+    return (*storageInitError != 0) ? CO_ERROR_DATA_CORRUPT : CO_ERROR_NO;
+}
+
+#endif /* (CO_CONFIG_STORAGE) & CO_CONFIG_STORAGE_ENABLE */
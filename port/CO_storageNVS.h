@@ -0,0 +1,98 @@
+/*
+ * CANopen data storage object for storing data into ESP32 NVS.
+ *
+ * @file        CO_storageNVS.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_STORAGE_NVS_H
+#define CO_STORAGE_NVS_H
+
+#include "storage/CO_storage.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Initialize data storage object in NVS.
+ *
+ * Opens NVS namespace CONFIG_CO_STORAGE_NVS_NAMESPACE, initializes
+ * CO_storage_t and copies stored data of each entry to entry->addr. Each
+ * entry is one NVS blob with key "subXX", where XX is subIndexOD. Entries
+ * without stored data keep their default values. Call once, before
+ * communication reset loop.
+ *
+ * storageInitError: If function returns CO_ERROR_DATA_CORRUPT, bit mask of
+ * subIndexOD values, where stored data were not valid.
+ *
+ * Return CO_ERROR_NO, CO_ERROR_DATA_CORRUPT (stored data not valid, defaults
+ * are used) or CO_ERROR_ILLEGAL_ARGUMENT, also if an entry is longer than
+ * CONFIG_CO_STORAGE_BUFFER_SIZE.
+ */
+CO_ReturnError_t CO_storageNVS_init(CO_storage_t *storage,
+                                    CO_CANmodule_t *CANmodule,
+                                    OD_entry_t *OD_1010_StoreParameters,
+                                    OD_entry_t *OD_1011_RestoreDefaultParameters,
+                                    CO_storage_entry_t *entries,
+                                    uint8_t entriesCount,
+                                    uint32_t *storageInitError);
+
+/*
+ * Write data of entry to NVS, if it differs from data stored before.
+ *
+ * data is a copy of entry->addr, entry->len bytes long. It is taken by the
+ * caller under CO_LOCK_OD, so flash is not written with Object Dictionary
+ * locked.
+ *
+ * Return ODR_OK or ODR_HW.
+ */
+ODR_t CO_storageNVS_writeEntry(CO_storage_entry_t *entry, const void *data);
+
+/*
+ * Write changed entries with CO_storage_auto attribute to NVS.
+ *
+ * Each entry is copied under CO_LOCK_OD to a static buffer. Only an entry,
+ * whose copy differs from NVS by CRC, is written, with Object Dictionary
+ * unlocked. Call periodically from a low priority task, the period coalesces
+ * changes.
+ *
+ * Return bit mask of subIndexOD values, which could not be written.
+ */
+uint32_t CO_storageNVS_autoProcess(CO_storage_t *storage);
+
+/*
+ * Write node ID and bit rate in kbit/s of LSS "store configuration" command
+ * to NVS. Call after CO_storageNVS_init().
+ *
+ * Return false, if NVS could not be written.
+ */
+bool_t CO_storageNVS_writeLSS(uint8_t nodeId, uint16_t bitRate);
+
+/*
+ * Read node ID and bit rate stored by CO_storageNVS_writeLSS(). Values are
+ * not verified. Call after CO_storageNVS_init().
+ *
+ * Return false, if no LSS configuration is stored.
+ */
+bool_t CO_storageNVS_readLSS(uint8_t *nodeId, uint16_t *bitRate);
+
+#ifdef __cplusplus
+}
+#endif /*__cplusplus*/
+
+#endif /* CO_STORAGE_NVS_H */
@@ -0,0 +1,97 @@
+/*
+ * Trace buffer for CANopenNode driver and processing tasks.
+ *
+ * @file        CO_trace.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "CO_trace.h"
+
+#if CONFIG_CO_TRACE
+
+#define CO_TRACE_BUFFER_SIZE CONFIG_CO_TRACE_BUFFER_SIZE
+_Static_assert((CO_TRACE_BUFFER_SIZE & (CO_TRACE_BUFFER_SIZE - 1)) == 0, "CO_TRACE_BUFFER_SIZE must be power of two");
+
+static CO_trace_record_t traceBuffer[CO_TRACE_BUFFER_SIZE];
+/* Free running index of the next record, only incremented */
+static uint32_t traceHead = 0;
+/* traceHead at the end of last CO_traceDump() */
+static uint32_t traceDumped = 0;
+
+/******************************************************************************/
+void CO_trace(CO_trace_event_t event, uint32_t arg)
+{
+    uint32_t index = __atomic_fetch_add(&traceHead, 1U, __ATOMIC_RELAXED);
+    CO_trace_record_t *record = &traceBuffer[index & (CO_TRACE_BUFFER_SIZE - 1U)];
+
+    /* Each caller owns its slot, no lock is needed. seq is invalid while the
+     * record is written and set last, so CO_traceDump() sees complete
+     * records only. */
+    __atomic_store_n(&record->seq, 0U, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->time_us = (uint32_t)esp_timer_get_time();
+    record->event = (uint8_t)event;
+    record->core = (uint8_t)xPortGetCoreID();
+    record->arg = arg;
+    __atomic_store_n(&record->seq, index + 1U, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************/
+void CO_traceDump(void)
+{
+    uint32_t head = __atomic_load_n(&traceHead, __ATOMIC_ACQUIRE);
+    uint32_t first = traceDumped;
+    uint32_t lost;
+    uint32_t i;
+
+    /* Records since last dump, at most the whole buffer */
+    if ((head - first) > CO_TRACE_BUFFER_SIZE)
+    {
+        first = head - CO_TRACE_BUFFER_SIZE;
+    }
+    lost = first - traceDumped;
+    for (i = first; i != head; i++)
+    {
+        const CO_trace_record_t *slot = &traceBuffer[i & (CO_TRACE_BUFFER_SIZE - 1U)];
+        CO_trace_record_t record;
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        record = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((seq != (i + 1U)) || (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq))
+        {
+            /* still written or already overwritten by a newer record */
+            lost++;
+            continue;
+        }
+        printf("CO_TRACE,%lu,%u,%u,%lu\n",
+               (unsigned long)record.time_us,
+               (unsigned)record.event,
+               (unsigned)record.core,
+               (unsigned long)record.arg);
+    }
+    if (lost > 0U)
+    {
+        printf("CO_TRACE_LOST,%lu\n", (unsigned long)lost);
+    }
+    traceDumped = head;
+}
+
+#endif /* CONFIG_CO_TRACE */
@@ -0,0 +1,85 @@
+/*
+ * Trace buffer for CANopenNode driver and processing tasks.
+ *
+ * @file        CO_trace.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_TRACE_H
+#define CO_TRACE_H
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Trace events. Numbers are used by tools/co_trace2json.py, append only. */
+typedef enum
+{
+    CO_TRACE_CAN_SEND = 0,         /* arg: CAN identifier */
+    CO_TRACE_CAN_SEND_OVERFLOW,    /* arg: CAN identifier */
+    CO_TRACE_TX_BEGIN,             /* arg: CAN identifier */
+    CO_TRACE_TX_END,               /* arg: esp_err_t of twai_transmit() */
+    CO_TRACE_RX_BEGIN,             /* arg: CAN identifier */
+    CO_TRACE_RX_END,               /* arg: rxArray index, 0xFFFF if not matched */
+    CO_TRACE_PROCESS_BEGIN,        /* arg: 0 */
+    CO_TRACE_PROCESS_END,          /* arg: CO_NMT_reset_cmd_t */
+    CO_TRACE_SYNC_BEGIN,           /* arg: 0 */
+    CO_TRACE_SYNC_END,             /* arg: 1, if SYNC was received or transmitted */
+    CO_TRACE_RPDO_BEGIN,           /* arg: 0 */
+    CO_TRACE_RPDO_END,             /* arg: 0 */
+    CO_TRACE_TPDO_BEGIN,           /* arg: 0 */
+    CO_TRACE_TPDO_END,             /* arg: 0 */
+    CO_TRACE_MODULE_PROCESS_BEGIN, /* arg: 0 */
+    CO_TRACE_MODULE_PROCESS_END,   /* arg: CANerrorStatus */
+} CO_trace_event_t;
+
+/* One record in trace buffer, 16 bytes */
+typedef struct
+{
+    uint32_t time_us; /* lower 32 bits of esp_timer_get_time() */
+    uint8_t event;    /* CO_trace_event_t */
+    uint8_t core;     /* core, which recorded the event */
+    uint16_t reserved;
+    uint32_t arg;
+    uint32_t seq;     /* index of the record plus one, 0 while it is written */
+} CO_trace_record_t;
+
+#if CONFIG_CO_TRACE
+/* Record event. Lock free, callable from any task on any core. Oldest events
+ * are overwritten, when buffer is full. */
+void CO_trace(CO_trace_event_t event, uint32_t arg);
+
+/* Print events recorded since the last dump to console, oldest event first,
+ * one "CO_TRACE,<time_us>,<event>,<core>,<arg>" line per event. Feed captured
+ * log to tools/co_trace2json.py. Tracing continues meanwhile: events, which
+ * are overwritten or still written, are skipped and counted in a final
+ * "CO_TRACE_LOST,<count>" line. Call from one task only. */
+void CO_traceDump(void);
+
+#define CO_TRACE(event, arg) CO_trace((event), (uint32_t)(arg))
+#else
+#define CO_TRACE(event, arg)
+#endif /* CONFIG_CO_TRACE */
+
+#ifdef __cplusplus
+}
+#endif /*__cplusplus*/
+
+#endif /* CO_TRACE_H */
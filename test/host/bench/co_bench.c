@@ -0,0 +1,863 @@
+/*
+ * Bus-load benchmark of the port on the virtual CAN bus. Simulated nodes drive
+ * the driver of our node at a configurable bit rate and bus load. CANopenNode
+ * itself is not linked: small emulations of CO_periodicTask (SYNC and PDOs)
+ * and CO_mainTask (SDO server, CO_CANmodule_process()) run on the driver API,
+ * so the figures are those of the port. Results are printed as JSON.
+ *
+ *   co_bench [-b kbit/s] [-l load %] [-d ms] [-n nodes] [-s scenario] [-o file]
+ *
+ * Scenarios:
+ *   sync_pdo      SYNC followed by 64 RPDOs from n nodes, 4 TPDOs answer each
+ *                 SYNC. Latency SYNC to first TPDO.
+ *   sdo_segmented SDO upload with 7 bytes per request. Latency request to
+ *                 response.
+ *   sdo_block     SDO block upload, 127 segments per sub-block. Latency
+ *                 request or acknowledge to the first response.
+ *   hb_flood      Heartbeat of 127 nodes, all consumed.
+ *   nmt_reset     Communication resets through CO_CANmodule_init(). Latency
+ *                 of one reset.
+ *   dispatch      Unthrottled frames over all 11-bit identifiers to 128 RX
+ *                 buffers. CPU time of CO_rxTask per frame.
+ *
+ * @file        co_bench.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "301/CO_driver.h"
+#include "test_common.h"
+
+#define BENCH_NODE_ID 0x10U
+#define BENCH_RX_SIZE 160U
+#define BENCH_TX_SIZE 8U
+#define BENCH_SAMPLES_MAX (1UL << 20)
+#define BENCH_HB_NODES 127U
+#define BENCH_RPDOS 64U
+#define BENCH_TPDOS 4U
+#define BENCH_SDO_SIZE 4096U
+#define BENCH_SDO_BLKSIZE 127U
+#define BENCH_RESETS 200U
+#define BENCH_TASK_STACK 4096U
+/* Bits of a standard data frame without stuff bits, as the virtual bus */
+#define BENCH_FRAME_BITS(dlc) (47U + 8U * (dlc))
+
+/* RPDO i of our node is TPDO 1 to 4 of nodes 0x20 to 0x2F */
+#define BENCH_RPDO_IDENT(i) (0x180U + 0x100U * ((i) / 16U) + 0x20U + ((i) % 16U))
+#define BENCH_SDO_QUEUE 4U
+
+/* TX buffers of our node */
+#define BENCH_TX_TPDO 0U
+#define BENCH_TX_SDO BENCH_TPDOS
+
+typedef struct
+{
+    uint32_t bitRate;
+    uint32_t load;
+    uint32_t duration_ms;
+    uint32_t nodes;
+    const char *scenario;
+} benchOptions_t;
+
+/* Emulated CO_periodicTask and CO_mainTask of our node */
+typedef struct
+{
+    const char *name;
+    TaskHandle_t handle;
+    StaticTask_t buffer;
+    StackType_t stack[BENCH_TASK_STACK];
+} benchTask_t;
+
+/* CPU time of all tasks of our node */
+typedef struct
+{
+    uint64_t rx, tx, alert, periodic, main;
+} benchCpu_t;
+
+static benchOptions_t opt = {1000U, 50U, 2000U, 8U, NULL};
+static FILE *out;
+static bool firstScenario = true;
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[BENCH_RX_SIZE];
+static CO_CANtx_t txArray[BENCH_TX_SIZE];
+static benchTask_t periodicTask = {.name = "periodic_task"};
+static benchTask_t mainTask = {.name = "main_task"};
+static volatile bool_t benchRunning;
+/* Held by emulated tasks while they use CANmodule and by communication reset,
+ * as CO_mainTask does both in CANopenNode */
+static pthread_mutex_t benchLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Latency samples, written by the bus thread from benchMonitor() */
+static int64_t samples[BENCH_SAMPLES_MAX];
+static uint32_t sampleCount;
+static uint32_t monitorRequest; /* CAN identifier, which starts a sample */
+static uint32_t monitorResponse;
+static int64_t monitorStart_us; /* 0, if no sample is open */
+static uint32_t rxCallbacks;
+
+/* SYNC received, TPDOs are sent by periodic task */
+static volatile bool_t syncReceived;
+
+/* SDO requests from CO_rxTask to main task */
+static uint8_t sdoQueue[BENCH_SDO_QUEUE][8];
+static uint32_t sdoHead, sdoTail;
+
+/******************************************************************************/
+static int compareSample(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Samples are sorted */
+static int64_t percentile(uint32_t perMille)
+{
+    uint32_t index;
+
+    if (sampleCount == 0U)
+    {
+        return 0;
+    }
+    index = (uint32_t)(((uint64_t)sampleCount * perMille) / 1000U);
+    return samples[(index < sampleCount) ? index : (sampleCount - 1U)];
+}
+
+static void sampleAdd(int64_t value)
+{
+    uint32_t n = __atomic_load_n(&sampleCount, __ATOMIC_RELAXED);
+
+    if (n < BENCH_SAMPLES_MAX)
+    {
+        samples[n] = value;
+        __atomic_store_n(&sampleCount, n + 1U, __ATOMIC_RELEASE);
+    }
+}
+
+/* Sample from the end of request frame to the end of first response of our
+ * node, both on the bus */
+static void benchMonitor(void *arg, const hostPort_t *sender, const twai_message_t *message, int64_t time_us)
+{
+    (void)arg;
+    if (message->identifier == monitorRequest)
+    {
+        monitorStart_us = time_us;
+    }
+    else if ((message->identifier == monitorResponse) && (monitorStart_us != 0) &&
+             (sender == hostController(0)))
+    {
+        sampleAdd(time_us - monitorStart_us);
+        monitorStart_us = 0;
+    }
+}
+
+static void monitorStart(uint32_t request, uint32_t response)
+{
+    hostBusSetMonitor(NULL, NULL);
+    sampleCount = 0U;
+    monitorRequest = request;
+    monitorResponse = response;
+    monitorStart_us = 0;
+    hostBusSetMonitor(benchMonitor, NULL);
+}
+
+/******************************************************************************/
+static void benchCpuGet(benchCpu_t *cpu)
+{
+    cpu->rx = hostTaskCpuTime_us(CANmodule.rxTaskHandle);
+    cpu->tx = hostTaskCpuTime_us(CANmodule.txTaskHandle);
+#if CONFIG_CO_TWAI_ALERT_TASK
+    cpu->alert = hostTaskCpuTime_us(CANmodule.alertTaskHandle);
+#else
+    cpu->alert = 0U;
+#endif
+    cpu->periodic = hostTaskCpuTime_us(periodicTask.handle);
+    cpu->main = hostTaskCpuTime_us(mainTask.handle);
+}
+
+/* Time in us, which frames of dlc bytes occupy at opt.bitRate */
+static uint64_t busTime_us(uint32_t frames, uint8_t dlc)
+{
+    return ((uint64_t)frames * BENCH_FRAME_BITS(dlc) * 1000U) / opt.bitRate;
+}
+
+/* Period, in which bus time_us gives opt.load */
+static uint64_t loadPeriod_us(uint64_t time_us)
+{
+    return (time_us * 100U) / opt.load;
+}
+
+/******************************************************************************/
+/* CANopen rx callbacks, called from CO_rxTask */
+static void rxCount(void *object, void *message)
+{
+    (void)object;
+    (void)message;
+    __atomic_fetch_add(&rxCallbacks, 1U, __ATOMIC_RELAXED);
+}
+
+static void rxSync(void *object, void *message)
+{
+    rxCount(object, message);
+    syncReceived = true;
+}
+
+static void rxSdo(void *object, void *message)
+{
+    uint32_t head = __atomic_load_n(&sdoHead, __ATOMIC_RELAXED);
+
+    rxCount(object, message);
+    if ((head - __atomic_load_n(&sdoTail, __ATOMIC_ACQUIRE)) < BENCH_SDO_QUEUE)
+    {
+        memcpy(sdoQueue[head % BENCH_SDO_QUEUE], CO_CANrxMsg_readData(message), 8);
+        __atomic_store_n(&sdoHead, head + 1U, __ATOMIC_RELEASE);
+    }
+    xTaskNotifyGive(mainTask.handle);
+}
+
+/* CO_periodicTask runs every millisecond, TPDOs go out after SYNC */
+static void benchPeriodicTask(void *arg)
+{
+    uint8_t i;
+
+    (void)arg;
+    while (1)
+    {
+        vTaskDelay(1);
+        pthread_mutex_lock(&benchLock);
+        if (benchRunning && __atomic_exchange_n(&syncReceived, false, __ATOMIC_ACQUIRE))
+        {
+            for (i = 0U; i < BENCH_TPDOS; i++)
+            {
+                txArray[BENCH_TX_TPDO + i].data[0]++;
+                (void)CO_CANsend(&CANmodule, &txArray[BENCH_TX_TPDO + i]);
+            }
+        }
+        pthread_mutex_unlock(&benchLock);
+    }
+}
+
+/* SDO upload server, state of the transfer */
+static uint32_t sdoOffset;
+static uint8_t sdoBlkSize;
+static uint8_t sdoData[BENCH_SDO_SIZE];
+
+/* CO_SDOserver_process() waits for the free TX buffer between its calls */
+static void sdoSend(const uint8_t data[8])
+{
+    CO_CANtx_t *buffer = &txArray[BENCH_TX_SDO];
+
+    while (__atomic_load_n(&buffer->bufferFull, __ATOMIC_ACQUIRE))
+    {
+        hostSleep_us(20);
+    }
+    memcpy(buffer->data, data, 8);
+    (void)CO_CANsend(&CANmodule, buffer);
+}
+
+static void sdoSubBlock(void)
+{
+    uint8_t seq;
+
+    for (seq = 1U; (seq <= sdoBlkSize) && (sdoOffset < BENCH_SDO_SIZE); seq++)
+    {
+        uint8_t seg[8] = {seq};
+        uint32_t n = BENCH_SDO_SIZE - sdoOffset;
+
+        n = (n < 7U) ? n : 7U;
+        memcpy(&seg[1], &sdoData[sdoOffset], n);
+        sdoOffset += n;
+        if (sdoOffset == BENCH_SDO_SIZE)
+        {
+            seg[0] |= 0x80U;
+        }
+        sdoSend(seg);
+    }
+}
+
+/* Command specifiers of CiA 301 SDO upload, expedited transfer not used */
+static void sdoProcess(const uint8_t req[8])
+{
+    uint8_t resp[8] = {0};
+    uint32_t n;
+
+    switch (req[0] & 0xE3U)
+    {
+        case 0x40U: /* initiate upload */
+            resp[0] = 0x41U;
+            memcpy(&resp[1], &req[1], 3);
+            resp[4] = (uint8_t)BENCH_SDO_SIZE;
+            resp[5] = (uint8_t)(BENCH_SDO_SIZE >> 8);
+            sdoOffset = 0U;
+            sdoSend(resp);
+            break;
+        case 0x60U: /* upload segment, with toggle bit */
+            n = BENCH_SDO_SIZE - sdoOffset;
+            n = (n < 7U) ? n : 7U;
+            resp[0] = (uint8_t)((req[0] & 0x10U) | ((7U - n) << 1));
+            memcpy(&resp[1], &sdoData[sdoOffset], n);
+            sdoOffset += n;
+            if (sdoOffset == BENCH_SDO_SIZE)
+            {
+                resp[0] |= 0x01U;
+            }
+            sdoSend(resp);
+            break;
+        case 0xA0U: /* block upload initiate */
+            resp[0] = 0xC2U;
+            memcpy(&resp[1], &req[1], 3);
+            resp[4] = (uint8_t)BENCH_SDO_SIZE;
+            resp[5] = (uint8_t)(BENCH_SDO_SIZE >> 8);
+            sdoBlkSize = req[4];
+            sdoOffset = 0U;
+            sdoSend(resp);
+            break;
+        case 0xA3U: /* block upload start */
+            sdoSubBlock();
+            break;
+        case 0xA2U: /* block acknowledge */
+            sdoBlkSize = req[2];
+            if (sdoOffset < BENCH_SDO_SIZE)
+            {
+                sdoSubBlock();
+            }
+            else
+            {
+                n = BENCH_SDO_SIZE % 7U;
+                resp[0] = (uint8_t)(0xC1U | (((n == 0U) ? 0U : (7U - n)) << 2));
+                sdoSend(resp);
+            }
+            break;
+        default: /* block upload end, response from client */
+            break;
+    }
+}
+
+/* CO_mainTask wakes on SDO requests, else every millisecond */
+static void benchMainTask(void *arg)
+{
+    uint32_t tail;
+
+    (void)arg;
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, 1);
+        pthread_mutex_lock(&benchLock);
+        if (benchRunning)
+        {
+            tail = __atomic_load_n(&sdoTail, __ATOMIC_RELAXED);
+            while (tail != __atomic_load_n(&sdoHead, __ATOMIC_ACQUIRE))
+            {
+                sdoProcess(sdoQueue[tail % BENCH_SDO_QUEUE]);
+                tail++;
+                __atomic_store_n(&sdoTail, tail, __ATOMIC_RELEASE);
+            }
+            CO_CANmodule_process(&CANmodule);
+        }
+        pthread_mutex_unlock(&benchLock);
+    }
+}
+
+static void taskCreate(benchTask_t *task, TaskFunction_t function, UBaseType_t priority)
+{
+    task->handle = xTaskCreateStaticPinnedToCore(function, task->name, BENCH_TASK_STACK, NULL, priority,
+                                                 task->stack, &task->buffer, tskNO_AFFINITY);
+    CHECK(task->handle != NULL);
+}
+
+/******************************************************************************/
+/* Communication reset of our node, buffers are configured by the scenario
+ * until benchStart() */
+static void benchReset(uint16_t rxSize)
+{
+    uint8_t i;
+
+    pthread_mutex_lock(&benchLock);
+    benchRunning = false;
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, rxSize, txArray, BENCH_TX_SIZE, (uint16_t)opt.bitRate),
+             CO_ERROR_NO);
+    for (i = 0U; i < BENCH_TPDOS; i++)
+    {
+        CHECK(CO_CANtxBufferInit(&CANmodule, BENCH_TX_TPDO + i, 0x180U + 0x100U * i + BENCH_NODE_ID,
+                                 false, 8, false) != NULL);
+    }
+    CHECK(CO_CANtxBufferInit(&CANmodule, BENCH_TX_SDO, 0x580U + BENCH_NODE_ID, false, 8, false) != NULL);
+    syncReceived = false;
+    sdoTail = sdoHead;
+    rxCallbacks = 0U;
+}
+
+static void benchStart(void)
+{
+    CO_CANstats_t stats;
+
+    CO_CANsetNormalMode(&CANmodule);
+    CO_CANmodule_getStats(&CANmodule, &stats, true);
+    benchRunning = true;
+    pthread_mutex_unlock(&benchLock);
+}
+
+/* JSON record of one scenario, latency only if samples were taken */
+static void report(const char *name, const char *latencyName, int64_t elapsed_us, uint64_t busFrames,
+                   const benchCpu_t *cpu0, const char *extra)
+{
+    CO_CANstats_t stats;
+    benchCpu_t cpu1;
+    double elapsed_s = (double)elapsed_us / 1e6;
+
+    CHECK(hostBusWaitIdle(2000));
+    hostBusSetMonitor(NULL, NULL);
+    pthread_mutex_lock(&benchLock);
+    benchRunning = false;
+    CO_CANmodule_process(&CANmodule);
+    CO_CANmodule_getStats(&CANmodule, &stats, false);
+    pthread_mutex_unlock(&benchLock);
+    benchCpuGet(&cpu1);
+    qsort(samples, sampleCount, sizeof(samples[0]), compareSample);
+
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"duration_s\": %.3f, \"bus_frames_per_s\": %.0f, "
+                 "\"rx_frames_per_s\": %.0f, \"tx_frames_per_s\": %.0f,\n",
+            firstScenario ? "" : ",", name, elapsed_s, (double)busFrames / elapsed_s,
+            (double)stats.rxFrames / elapsed_s, (double)stats.txFrames / elapsed_s);
+    fprintf(out, "     \"rx_overruns\": %lu, \"rx_missed\": %lu, \"rx_queue_full\": %lu, "
+                 "\"tx_overflow\": %lu, \"tx_count_high_water\": %lu,\n",
+            (unsigned long)stats.rxOverrun, (unsigned long)stats.rxMissed, (unsigned long)stats.rxQueueFull,
+            (unsigned long)stats.txOverflow, (unsigned long)stats.txCountHighWater);
+    if (latencyName != NULL)
+    {
+        fprintf(out, "     \"latency_us\": {\"name\": \"%s\", \"samples\": %lu, \"p50\": %lld, "
+                     "\"p99\": %lld, \"p999\": %lld, \"max\": %lld},\n",
+                latencyName, (unsigned long)sampleCount, (long long)percentile(500U),
+                (long long)percentile(990U), (long long)percentile(999U), (long long)percentile(1000U));
+    }
+    if (extra != NULL)
+    {
+        fprintf(out, "     %s,\n", extra);
+    }
+    fprintf(out, "     \"cpu_us\": {\"rx_task\": %llu, \"tx_task\": %llu, \"alert_task\": %llu, "
+                 "\"periodic_task\": %llu, \"main_task\": %llu}}",
+            (unsigned long long)(cpu1.rx - cpu0->rx), (unsigned long long)(cpu1.tx - cpu0->tx),
+            (unsigned long long)(cpu1.alert - cpu0->alert), (unsigned long long)(cpu1.periodic - cpu0->periodic),
+            (unsigned long long)(cpu1.main - cpu0->main));
+    fflush(out);
+    firstScenario = false;
+}
+
+/******************************************************************************/
+static void scenarioSyncPdo(void)
+{
+    hostPort_t *nodes[BENCH_RPDOS];
+    uint32_t nNodes = (opt.nodes < BENCH_RPDOS) ? opt.nodes : BENCH_RPDOS;
+    uint32_t frames = 1U + BENCH_RPDOS + BENCH_TPDOS;
+    uint64_t period_us = loadPeriod_us(busTime_us(1U, 0U) + busTime_us(frames - 1U, 8U));
+    twai_message_t sync = {.identifier = 0x080U, .data_length_code = 0};
+    hostPort_t *syncNode = hostNodeOpen(1, 1);
+    uint64_t busFrames;
+    benchCpu_t cpu0;
+    int64_t start_us, next_us;
+    uint32_t i;
+
+    CHECK(syncNode != NULL);
+    for (i = 0U; i < nNodes; i++)
+    {
+        nodes[i] = hostNodeOpen(1, BENCH_RPDOS);
+        CHECK(nodes[i] != NULL);
+    }
+    benchReset(1U + BENCH_RPDOS);
+    CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 0, 0x080, 0x7FF, false, &CANmodule, rxSync), CO_ERROR_NO);
+    for (i = 0U; i < BENCH_RPDOS; i++)
+    {
+        CHECK_EQ(CO_CANrxBufferInit(&CANmodule, (uint16_t)(1U + i), BENCH_RPDO_IDENT(i), 0x7FF, false, &CANmodule, rxCount),
+                 CO_ERROR_NO);
+    }
+    benchStart();
+    monitorStart(0x080U, 0x180U + BENCH_NODE_ID);
+
+    benchCpuGet(&cpu0);
+    busFrames = hostBusFrames();
+    start_us = next_us = hostTime_us();
+    while ((hostTime_us() - start_us) < (int64_t)opt.duration_ms * 1000)
+    {
+        CHECK_EQ(hostNodeSend(syncNode, &sync, 1000), ESP_OK);
+        for (i = 0U; i < BENCH_RPDOS; i++)
+        {
+            twai_message_t pdo = {.identifier = BENCH_RPDO_IDENT(i), .data_length_code = 8, .data = {(uint8_t)i}};
+
+            CHECK_EQ(hostNodeSend(nodes[i % nNodes], &pdo, 1000), ESP_OK);
+        }
+        next_us += (int64_t)period_us;
+        if (next_us > hostTime_us())
+        {
+            hostSleep_us((uint32_t)(next_us - hostTime_us()));
+        }
+    }
+    report("sync_pdo", "sync_to_tpdo", hostTime_us() - start_us, hostBusFrames() - busFrames, &cpu0, NULL);
+
+    hostNodeClose(syncNode);
+    for (i = 0U; i < nNodes; i++)
+    {
+        hostNodeClose(nodes[i]);
+    }
+}
+
+/* SDO client, returns response to request */
+static void sdoRequestSend(hostPort_t *client, const uint8_t req[8], twai_message_t *resp)
+{
+    twai_message_t msg = {.identifier = 0x600U + BENCH_NODE_ID, .data_length_code = 8};
+
+    memcpy(msg.data, req, 8);
+    CHECK_EQ(hostNodeSend(client, &msg, 100), ESP_OK);
+    do
+    {
+        CHECK_EQ(hostNodeReceive(client, resp, NULL, 1000), ESP_OK);
+    } while (resp->identifier != (0x580U + BENCH_NODE_ID));
+}
+
+static void scenarioSdo(bool block)
+{
+    hostPort_t *client = hostNodeOpen(BENCH_SDO_BLKSIZE + 8U, 1);
+    uint64_t transferred = 0U;
+    uint64_t busFrames;
+    benchCpu_t cpu0;
+    int64_t start_us, elapsed_us;
+    char extra[64];
+
+    CHECK(client != NULL);
+    benchReset(1U);
+    CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 0, 0x600U + BENCH_NODE_ID, 0x7FF, false, &CANmodule, rxSdo),
+             CO_ERROR_NO);
+    benchStart();
+    monitorStart(0x600U + BENCH_NODE_ID, 0x580U + BENCH_NODE_ID);
+
+    benchCpuGet(&cpu0);
+    busFrames = hostBusFrames();
+    start_us = hostTime_us();
+    while ((hostTime_us() - start_us) < (int64_t)opt.duration_ms * 1000)
+    {
+        uint8_t req[8] = {block ? 0xA0U : 0x40U, 0x00, 0x20, 0x00, (uint8_t)BENCH_SDO_BLKSIZE};
+        twai_message_t resp;
+        uint8_t toggle = 0U;
+
+        sdoRequestSend(client, req, &resp);
+        CHECK_EQ(resp.data[0], block ? 0xC2U : 0x41U);
+        if (!block)
+        {
+            do
+            {
+                uint8_t seg[8] = {(uint8_t)(0x60U | toggle)};
+
+                sdoRequestSend(client, seg, &resp);
+                CHECK_EQ(resp.data[0] & 0x10U, toggle);
+                transferred += 7U - ((resp.data[0] >> 1) & 0x07U);
+                toggle ^= 0x10U;
+            } while ((resp.data[0] & 0x01U) == 0U);
+        }
+        else
+        {
+            uint8_t start[8] = {0xA3U};
+            bool last = false;
+
+            sdoRequestSend(client, start, &resp);
+            while (!last)
+            {
+                uint8_t ack[8] = {0xA2U, 0, (uint8_t)BENCH_SDO_BLKSIZE};
+                uint8_t seq = 1U;
+
+                /* first segment is resp, the rest follows without request */
+                while (1)
+                {
+                    CHECK_EQ(resp.data[0] & 0x7FU, seq);
+                    last = (resp.data[0] & 0x80U) != 0U;
+                    transferred += 7U;
+                    if (last || (seq == BENCH_SDO_BLKSIZE))
+                    {
+                        break;
+                    }
+                    seq++;
+                    CHECK_EQ(hostNodeReceive(client, &resp, NULL, 1000), ESP_OK);
+                }
+                ack[1] = seq;
+                sdoRequestSend(client, ack, &resp);
+            }
+            /* block end, last segment had unused bytes */
+            CHECK_EQ(resp.data[0] & 0xE3U, 0xC1U);
+            transferred -= (resp.data[0] >> 2) & 0x07U;
+            {
+                uint8_t end[8] = {0xA1U};
+                twai_message_t msg = {.identifier = 0x600U + BENCH_NODE_ID, .data_length_code = 8};
+
+                memcpy(msg.data, end, 8);
+                CHECK_EQ(hostNodeSend(client, &msg, 100), ESP_OK);
+            }
+        }
+    }
+    elapsed_us = hostTime_us() - start_us;
+    CHECK_EQ(transferred % BENCH_SDO_SIZE, 0U);
+    snprintf(extra, sizeof(extra), "\"sdo_bytes_per_s\": %.0f", (double)transferred * 1e6 / (double)elapsed_us);
+    report(block ? "sdo_block" : "sdo_segmented", block ? "sdo_request_to_segment" : "sdo_request_to_response",
+           elapsed_us, hostBusFrames() - busFrames, &cpu0, extra);
+    hostNodeClose(client);
+}
+
+static void scenarioHbFlood(void)
+{
+    static hostPort_t *nodes[BENCH_HB_NODES + 1U];
+    uint64_t period_us = loadPeriod_us(busTime_us(BENCH_HB_NODES - 1U, 1U));
+    uint64_t busFrames;
+    uint32_t sent = 0U;
+    benchCpu_t cpu0;
+    int64_t start_us, next_us, elapsed_us;
+    char extra[64];
+    uint16_t n;
+
+    for (n = 1U; n <= BENCH_HB_NODES; n++)
+    {
+        nodes[n] = (n == BENCH_NODE_ID) ? NULL : hostNodeOpen(1, 1);
+    }
+    benchReset(BENCH_HB_NODES);
+    for (n = 1U; n <= BENCH_HB_NODES; n++)
+    {
+        CHECK_EQ(CO_CANrxBufferInit(&CANmodule, (uint16_t)(n - 1U), 0x700U + n, 0x7FF, false, &CANmodule, rxCount),
+                 CO_ERROR_NO);
+    }
+    benchStart();
+
+    benchCpuGet(&cpu0);
+    busFrames = hostBusFrames();
+    start_us = next_us = hostTime_us();
+    while ((hostTime_us() - start_us) < (int64_t)opt.duration_ms * 1000)
+    {
+        for (n = 1U; n <= BENCH_HB_NODES; n++)
+        {
+            twai_message_t hb = {.identifier = 0x700U + n, .data_length_code = 1, .data = {0x05}};
+
+            if ((nodes[n] != NULL) && (hostNodeSend(nodes[n], &hb, 0) == ESP_OK))
+            {
+                sent++;
+            }
+        }
+        next_us += (int64_t)period_us;
+        if (next_us > hostTime_us())
+        {
+            hostSleep_us((uint32_t)(next_us - hostTime_us()));
+        }
+    }
+    elapsed_us = hostTime_us() - start_us;
+    CHECK(hostBusWaitIdle(2000));
+    snprintf(extra, sizeof(extra), "\"hb_sent\": %lu, \"hb_consumed\": %lu", (unsigned long)sent,
+             (unsigned long)__atomic_load_n(&rxCallbacks, __ATOMIC_RELAXED));
+    report("hb_flood", NULL, elapsed_us, hostBusFrames() - busFrames, &cpu0, extra);
+    for (n = 1U; n <= BENCH_HB_NODES; n++)
+    {
+        if (nodes[n] != NULL)
+        {
+            hostNodeClose(nodes[n]);
+        }
+    }
+}
+
+static void scenarioNmtReset(void)
+{
+    uint32_t installs = hostInstallCount();
+    benchCpu_t cpu0;
+    int64_t start_us;
+    char extra[64];
+    uint32_t n;
+
+    benchCpuGet(&cpu0);
+    sampleCount = 0U;
+    start_us = hostTime_us();
+    for (n = 0U; n < BENCH_RESETS; n++)
+    {
+        uint8_t nodeId = (uint8_t)(1U + (n % 127U));
+        int64_t reset_us = hostTime_us();
+
+        /* CO_CANinit() and buffers of CO_CANopenInit() */
+        benchReset(4U);
+        CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 0, 0x000, 0x7FF, false, &CANmodule, rxCount), CO_ERROR_NO);
+        CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 1, 0x080, 0x7FF, false, &CANmodule, rxSync), CO_ERROR_NO);
+        CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 2, 0x200 + nodeId, 0x7FF, false, &CANmodule, rxCount), CO_ERROR_NO);
+        CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 3, 0x600 + nodeId, 0x7FF, false, &CANmodule, rxSdo), CO_ERROR_NO);
+        benchStart();
+        sampleAdd(hostTime_us() - reset_us);
+    }
+    snprintf(extra, sizeof(extra), "\"resets\": %lu, \"driver_installs\": %lu", (unsigned long)BENCH_RESETS,
+             (unsigned long)(hostInstallCount() - installs));
+    report("nmt_reset", "reset", hostTime_us() - start_us, 0U, &cpu0, extra);
+}
+
+/* Frames received or lost by our node */
+static uint64_t rxCounted(void)
+{
+    CO_CANstats_t stats;
+
+    pthread_mutex_lock(&benchLock);
+    CO_CANmodule_getStats(&CANmodule, &stats, false);
+    pthread_mutex_unlock(&benchLock);
+    return (uint64_t)stats.rxFrames + stats.rxMissed;
+}
+
+static void scenarioDispatch(void)
+{
+    hostPort_t *node = hostNodeOpen(1, 4);
+    uint64_t frames = 0U;
+    uint64_t busFrames;
+    benchCpu_t cpu0, cpu1;
+    int64_t start_us, elapsed_us;
+    char extra[96];
+    uint16_t i, id = 0U;
+
+    CHECK(node != NULL);
+    hostBusSetRealTime(false);
+    benchReset(128U);
+    for (i = 0U; i < 128U; i++)
+    {
+        /* identifiers of a typical node: PDOs, SDO, heartbeat of 32 nodes */
+        uint16_t ident = (uint16_t)(((i / 32U) == 3U) ? (0x700U + 1U + (i % 32U))
+                                                      : (0x180U + 0x100U * (i / 32U) + 1U + (i % 32U)));
+
+        CHECK_EQ(CO_CANrxBufferInit(&CANmodule, i, ident, 0x7FF, false, &CANmodule, rxCount), CO_ERROR_NO);
+    }
+    benchStart();
+
+    benchCpuGet(&cpu0);
+    busFrames = hostBusFrames();
+    start_us = hostTime_us();
+    while ((hostTime_us() - start_us) < (int64_t)opt.duration_ms * 1000)
+    {
+        /* chunks, which fit into TWAI receive queue */
+        for (i = 0U; i < 4U; i++)
+        {
+            twai_message_t msg = {.identifier = id, .data_length_code = 8};
+
+            CHECK_EQ(hostNodeSend(node, &msg, 100), ESP_OK);
+            id = (id + 1U) & 0x7FFU;
+        }
+        frames += 4U;
+        CHECK(WAIT_FOR(rxCounted() >= frames, 1000));
+    }
+    elapsed_us = hostTime_us() - start_us;
+    benchCpuGet(&cpu1);
+    snprintf(extra, sizeof(extra), "\"dispatch_table\": %s, \"rx_task_cpu_ns_per_frame\": %.0f",
+             CONFIG_CO_RX_DISPATCH_TABLE ? "true" : "false", (double)(cpu1.rx - cpu0.rx) * 1000.0 / (double)frames);
+    report("dispatch", NULL, elapsed_us, hostBusFrames() - busFrames, &cpu0, extra);
+    hostNodeClose(node);
+    hostBusSetRealTime(true);
+}
+
+/******************************************************************************/
+static bool selected(const char *name)
+{
+    return (opt.scenario == NULL) || (strcmp(opt.scenario, name) == 0);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-b kbit/s] [-l load %%] [-d ms] [-n nodes] [-s scenario] [-o file]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *file = NULL;
+    uint32_t i;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:l:d:n:s:o:")) != -1)
+    {
+        switch (c)
+        {
+            case 'b':
+                opt.bitRate = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                opt.load = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                opt.duration_ms = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                opt.nodes = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                opt.scenario = optarg;
+                break;
+            case 'o':
+                file = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!CO_CANcheckBitRate((uint16_t)opt.bitRate) || (opt.load == 0U) || (opt.load > 100U) || (opt.nodes == 0U))
+    {
+        usage(argv[0]);
+    }
+    out = (file != NULL) ? fopen(file, "w") : stdout;
+    CHECK(out != NULL);
+    for (i = 0U; i < BENCH_SDO_SIZE; i++)
+    {
+        sdoData[i] = (uint8_t)i;
+    }
+
+    hostBusSetBitRate(opt.bitRate);
+    hostBusSetRealTime(true);
+    benchReset(1U);
+    benchStart();
+    taskCreate(&periodicTask, benchPeriodicTask, CONFIG_CO_RX_TASK_PRIORITY - 1U);
+    taskCreate(&mainTask, benchMainTask, CONFIG_CO_RX_TASK_PRIORITY - 2U);
+
+    fprintf(out, "{\"bench\": \"co_bench\", \"bit_rate_kbps\": %lu, \"load_percent\": %lu, \"nodes\": %lu,\n"
+                 " \"config\": {\"dispatch_table\": %s, \"hw_filter\": %s, \"alert_task\": %s},\n"
+                 " \"scenarios\": [",
+            (unsigned long)opt.bitRate, (unsigned long)opt.load, (unsigned long)opt.nodes,
+            CONFIG_CO_RX_DISPATCH_TABLE ? "true" : "false", CONFIG_CO_TWAI_HW_FILTER ? "true" : "false",
+            CONFIG_CO_TWAI_ALERT_TASK ? "true" : "false");
+    if (selected("sync_pdo"))
+    {
+        scenarioSyncPdo();
+    }
+    if (selected("sdo_segmented"))
+    {
+        scenarioSdo(false);
+    }
+    if (selected("sdo_block"))
+    {
+        scenarioSdo(true);
+    }
+    if (selected("hb_flood"))
+    {
+        scenarioHbFlood();
+    }
+    if (selected("nmt_reset"))
+    {
+        scenarioNmtReset();
+    }
+    if (selected("dispatch"))
+    {
+        scenarioDispatch();
+    }
+    fprintf(out, "\n]}\n");
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
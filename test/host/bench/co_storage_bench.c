@@ -0,0 +1,245 @@
+/*
+ * Storage benchmark of CO_storageNVS on the simulated NVS flash of the host
+ * build. Flash time is accumulated with typical SPI NOR figures, see
+ * shim/nvs_sim.c, CPU time is measured. Results are printed as JSON.
+ *
+ *   co_storage_bench [-e entries] [-s bytes] [-d dirty] [-r rounds] [-p pages] [-o file]
+ *
+ * Phases:
+ *   store_all       Store command (object 0x1010) on all changed entries.
+ *   store_unchanged Store command again, nothing is written.
+ *   auto            rounds of CO_storageNVS_autoProcess(), each after a change
+ *                   of d entries. Write amplification is bytes programmed per
+ *                   byte of changed entries, erases show page wear.
+ *   restore         Reset and CO_storageNVS_init(), which scans the flash and
+ *                   reads all entries.
+ *
+ * @file        co_storage_bench.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include "CO_storageNVS.h"
+#include "test_common.h"
+
+#define BENCH_ENTRIES_MAX 32U
+
+typedef struct
+{
+    uint32_t entries;
+    uint32_t size;
+    uint32_t dirty;
+    uint32_t rounds;
+    uint32_t pages;
+} benchOptions_t;
+
+static benchOptions_t opt = {
+    .entries = 16U,
+    .size = 64U,
+    .dirty = 1U,
+    .rounds = 1000U,
+    .pages = 6U,
+};
+static FILE *out;
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[1];
+static CO_CANtx_t txArray[1];
+static CO_storage_t storage;
+static CO_storage_entry_t entries[BENCH_ENTRIES_MAX];
+static uint8_t data[BENCH_ENTRIES_MAX][CONFIG_CO_STORAGE_BUFFER_SIZE];
+static uint8_t expected[BENCH_ENTRIES_MAX][CONFIG_CO_STORAGE_BUFFER_SIZE];
+
+/* Change one byte of entry, also in the expected data */
+static void change(uint32_t entry, uint32_t n)
+{
+    uint32_t offset = n % opt.size;
+
+    data[entry][offset]++;
+    expected[entry][offset] = data[entry][offset];
+}
+
+/* JSON record of one phase, payload is the bytes of changed entries */
+static void report(const char *name, int64_t cpu_us, uint64_t payload, uint32_t errors, bool last)
+{
+    hostFlashStats_t stats;
+
+    hostFlashStats(&stats, true);
+    fprintf(out, "    {\"name\": \"%s\", \"flash_us\": %llu, \"cpu_us\": %lld, \"bytes_programmed\": %llu, "
+                 "\"bytes_read\": %llu,\n",
+            name, (unsigned long long)stats.time_us, (long long)cpu_us, (unsigned long long)stats.bytesProgrammed,
+            (unsigned long long)stats.bytesRead);
+    fprintf(out, "     \"programs\": %lu, \"erases\": %lu, \"erase_min\": %lu, \"erase_max\": %lu, "
+                 "\"write_amplification\": %.2f, \"errors\": %lu}%s\n",
+            (unsigned long)stats.programs, (unsigned long)stats.erases, (unsigned long)stats.eraseMin,
+            (unsigned long)stats.eraseMax, (payload > 0U) ? (double)stats.bytesProgrammed / (double)payload : 0.0,
+            (unsigned long)errors, last ? "" : ",");
+    fflush(out);
+}
+
+static void phaseStore(const char *name, bool changeAll)
+{
+    uint32_t errors = 0U;
+    int64_t start_us;
+    uint32_t i;
+
+    if (changeAll)
+    {
+        for (i = 0U; i < opt.entries; i++)
+        {
+            change(i, i);
+        }
+    }
+    start_us = hostTime_us();
+    for (i = 0U; i < opt.entries; i++)
+    {
+        if (storage.store(&entries[i], &CANmodule) != ODR_OK)
+        {
+            errors++;
+        }
+    }
+    report(name, hostTime_us() - start_us, changeAll ? (uint64_t)opt.entries * opt.size : 0U, errors, false);
+}
+
+static void phaseAuto(void)
+{
+    uint32_t errors = 0U;
+    int64_t cpu_us = 0;
+    uint32_t next = 0U;
+    uint32_t round, i;
+
+    for (round = 0U; round < opt.rounds; round++)
+    {
+        int64_t start_us;
+
+        for (i = 0U; i < opt.dirty; i++)
+        {
+            change(next, round);
+            next = (next + 1U) % opt.entries;
+        }
+        start_us = hostTime_us();
+        if (CO_storageNVS_autoProcess(&storage) != 0U)
+        {
+            errors++;
+        }
+        cpu_us += hostTime_us() - start_us;
+    }
+    report("auto", cpu_us, (uint64_t)opt.rounds * opt.dirty * opt.size, errors, false);
+}
+
+static void phaseRestore(void)
+{
+    uint32_t storageInitError = 0U;
+    uint32_t errors = 0U;
+    int64_t start_us;
+    uint32_t i;
+
+    memset(data, 0, sizeof(data));
+    hostFlashReboot();
+    start_us = hostTime_us();
+    if (CO_storageNVS_init(&storage, &CANmodule, NULL, NULL, entries, (uint8_t)opt.entries, &storageInitError) !=
+        CO_ERROR_NO)
+    {
+        errors++;
+    }
+    for (i = 0U; i < opt.entries; i++)
+    {
+        if (memcmp(data[i], expected[i], opt.size) != 0)
+        {
+            errors++;
+        }
+    }
+    report("restore", hostTime_us() - start_us, 0U, errors, true);
+    CHECK_EQ(errors, 0U);
+}
+
+/******************************************************************************/
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-e entries] [-s bytes] [-d dirty] [-r rounds] [-p pages] [-o file]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t storageInitError = 0U;
+    const char *file = NULL;
+    uint32_t i;
+    int c;
+
+    while ((c = getopt(argc, argv, "e:s:d:r:p:o:")) != -1)
+    {
+        switch (c)
+        {
+            case 'e':
+                opt.entries = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                opt.size = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                opt.dirty = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                opt.rounds = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                opt.pages = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                file = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if ((opt.entries == 0U) || (opt.entries > BENCH_ENTRIES_MAX) || (opt.size == 0U) ||
+        (opt.size > CONFIG_CO_STORAGE_BUFFER_SIZE) || (opt.dirty > opt.entries) || (opt.pages < 2U))
+    {
+        usage(argv[0]);
+    }
+    out = (file != NULL) ? fopen(file, "w") : stdout;
+    CHECK(out != NULL);
+
+    for (i = 0U; i < opt.entries; i++)
+    {
+        entries[i].addr = data[i];
+        entries[i].len = opt.size;
+        entries[i].subIndexOD = (uint8_t)(2U + i);
+        entries[i].attr = CO_storage_cmd | CO_storage_auto | CO_storage_restore;
+    }
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, 1, txArray, 1, 1000), CO_ERROR_NO);
+    hostFlashFormat(opt.pages);
+    CHECK_EQ(CO_storageNVS_init(&storage, &CANmodule, NULL, NULL, entries, (uint8_t)opt.entries, &storageInitError),
+             CO_ERROR_NO);
+    hostFlashStats(&(hostFlashStats_t){0}, true);
+
+    fprintf(out, "{\"bench\": \"co_storage_bench\", \"entries\": %lu, \"entry_size\": %lu, \"dirty\": %lu, "
+                 "\"rounds\": %lu, \"flash_pages\": %lu,\n \"phases\": [\n",
+            (unsigned long)opt.entries, (unsigned long)opt.size, (unsigned long)opt.dirty,
+            (unsigned long)opt.rounds, (unsigned long)opt.pages);
+    phaseStore("store_all", true);
+    phaseStore("store_unchanged", false);
+    phaseAuto();
+    phaseRestore();
+    fprintf(out, "]}\n");
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    CO_CANmodule_disable(&CANmodule);
+    return 0;
+}
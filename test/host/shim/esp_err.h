@@ -0,0 +1,61 @@
+/*
+ * ESP-IDF error codes for the host build of the port.
+ *
+ * @file        esp_err.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_ESP_ERR_H
+#define HOST_ESP_ERR_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+
+const char *esp_err_to_name(esp_err_t code);
+void hostErrorCheckFailed(esp_err_t code, const char *file, int line, const char *expression);
+
+/* Aborts the test, as ESP_ERROR_CHECK() aborts the firmware */
+#define ESP_ERROR_CHECK(x)                                         \
+    do                                                             \
+    {                                                              \
+        esp_err_t err_rc_ = (x);                                   \
+        if (err_rc_ != ESP_OK)                                     \
+        {                                                          \
+            hostErrorCheckFailed(err_rc_, __FILE__, __LINE__, #x); \
+        }                                                          \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_ESP_ERR_H */
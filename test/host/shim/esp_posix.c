@@ -0,0 +1,157 @@
+/*
+ * ESP-IDF time, logging and error functions on POSIX.
+ *
+ * @file        esp_posix.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "host.h"
+#include "nvs.h"
+
+static int64_t timeStart_ns;
+static esp_log_level_t logLevel = ESP_LOG_WARN;
+
+static int64_t hostClock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+__attribute__((constructor)) static void hostStart(void)
+{
+    const char *level = getenv("CO_HOST_LOG");
+
+    /* esp_timer starts at boot, time is never 0 */
+    timeStart_ns = hostClock_ns() - 1000000;
+    if ((level != NULL) && (level[0] >= '0') && (level[0] <= '5'))
+    {
+        logLevel = (esp_log_level_t)(level[0] - '0');
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (hostClock_ns() - timeStart_ns) / 1000;
+}
+
+int64_t hostTime_us(void)
+{
+    return esp_timer_get_time();
+}
+
+void hostSleep_us(uint32_t time_us)
+{
+    struct timespec ts = {.tv_sec = time_us / 1000000U, .tv_nsec = (long)(time_us % 1000000U) * 1000};
+
+    while (nanosleep(&ts, &ts) != 0)
+    {
+    }
+}
+
+void hostLog(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letter[] = "NEWIDV";
+    va_list args;
+
+    if (level > logLevel)
+    {
+        return;
+    }
+    va_start(args, format);
+    fprintf(stderr, "%c (%lld) %s: ", letter[level], (long long)(esp_timer_get_time() / 1000), tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    (void)tag;
+    logLevel = level;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_NVS_NOT_INITIALIZED:
+        return "ESP_ERR_NVS_NOT_INITIALIZED";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_READ_ONLY:
+        return "ESP_ERR_NVS_READ_ONLY";
+    case ESP_ERR_NVS_NOT_ENOUGH_SPACE:
+        return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+    case ESP_ERR_NVS_INVALID_LENGTH:
+        return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_NVS_VALUE_TOO_LONG:
+        return "ESP_ERR_NVS_VALUE_TOO_LONG";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+uint16_t esp_rom_crc16_le(uint16_t crc, uint8_t const *buf, uint32_t len)
+{
+    uint32_t i;
+    int bit;
+
+    crc = (uint16_t)~crc;
+    for (i = 0U; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1U) ? (uint16_t)((crc >> 1) ^ 0x8408U) : (uint16_t)(crc >> 1);
+        }
+    }
+    return (uint16_t)~crc;
+}
+
+void hostErrorCheckFailed(esp_err_t code, const char *file, int line, const char *expression)
+{
+    fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\nexpression: %s\n",
+            code, esp_err_to_name(code), file, line, expression);
+    abort();
+}
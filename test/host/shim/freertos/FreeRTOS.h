@@ -0,0 +1,103 @@
+/*
+ * FreeRTOS subset for the host build of the port, tasks are POSIX threads.
+ *
+ * @file        FreeRTOS.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint8_t StackType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+#define portTICK_PERIOD_MS (1000U / CONFIG_FREERTOS_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * CONFIG_FREERTOS_HZ) / 1000U))
+#define pdTICKS_TO_MS(ticks) ((uint32_t)(((uint64_t)(ticks) * 1000U) / CONFIG_FREERTOS_HZ))
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+/* Task control block, StaticTask_t of a shim task. Blocking calls wait on
+ * cond with the global shim lock, see freertos_posix.c. */
+struct hostTask
+{
+    pthread_t thread;
+    pthread_cond_t cond;
+    pthread_cond_t *waitCond; /* condition the task is blocked on, or NULL */
+    TaskFunction_t function;
+    void *param;
+    const char *name;
+    BaseType_t core;
+    uint32_t notifyValue;
+    bool notified;
+    bool abortWait; /* xTaskAbortDelay() */
+    bool deleted;   /* vTaskDelete(), task exits at next shim call */
+    bool exited;
+};
+typedef struct hostTask StaticTask_t;
+typedef struct hostTask *TaskHandle_t;
+
+/* Semaphore and mutex, StaticSemaphore_t of a shim semaphore */
+struct hostSemaphore
+{
+    pthread_cond_t cond;
+    uint32_t count;
+    uint32_t maxCount;
+    TaskHandle_t holder; /* mutex only */
+    uint32_t recursion;
+    bool mutex;
+};
+typedef struct hostSemaphore StaticSemaphore_t;
+typedef struct hostSemaphore *SemaphoreHandle_t;
+
+/* Spinlock, critical sections of different muxes don't exclude each other */
+typedef struct
+{
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {PTHREAD_MUTEX_INITIALIZER}
+#define portMUX_INITIALIZE(mux) pthread_mutex_init(&(mux)->mutex, NULL)
+#define taskENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define taskEXIT_CRITICAL(mux) pthread_mutex_unlock(&(mux)->mutex)
+#define portENTER_CRITICAL(mux) taskENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL(mux) taskEXIT_CRITICAL(mux)
+
+BaseType_t xPortGetCoreID(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_FREERTOS_H */
@@ -0,0 +1,52 @@
+/*
+ * FreeRTOS semaphore API for the host build of the port.
+ *
+ * @file        semphr.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_SEMPHR_H
+#define HOST_SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer);
+SemaphoreHandle_t xSemaphoreCreateCountingStatic(UBaseType_t maxCount,
+                                                 UBaseType_t initialCount,
+                                                 StaticSemaphore_t *buffer);
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer);
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t *buffer);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore);
+
+BaseType_t hostSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait, bool recursive);
+BaseType_t hostSemaphoreGive(SemaphoreHandle_t semaphore, bool recursive);
+#define xSemaphoreTake(semaphore, ticks) hostSemaphoreTake((semaphore), (ticks), false)
+#define xSemaphoreGive(semaphore) hostSemaphoreGive((semaphore), false)
+#define xSemaphoreTakeRecursive(semaphore, ticks) hostSemaphoreTake((semaphore), (ticks), true)
+#define xSemaphoreGiveRecursive(semaphore) hostSemaphoreGive((semaphore), true)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SEMPHR_H */
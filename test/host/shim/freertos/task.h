@@ -0,0 +1,76 @@
+/*
+ * FreeRTOS task API for the host build of the port.
+ *
+ * @file        task.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_TASK_H
+#define HOST_TASK_H
+
+#include <sched.h>
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+    eNoAction = 0,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite
+} eNotifyAction;
+
+/* Priority and stack are ignored, every task is a thread of its own */
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t function,
+                                           const char *name,
+                                           uint32_t stackDepth,
+                                           void *param,
+                                           UBaseType_t priority,
+                                           StackType_t *stack,
+                                           StaticTask_t *taskBuffer,
+                                           BaseType_t core);
+#define xTaskCreateStatic(function, name, stackDepth, param, priority, stack, taskBuffer) \
+    xTaskCreateStaticPinnedToCore(function, name, stackDepth, param, priority, stack, taskBuffer, tskNO_AFFINITY)
+
+/* Other task is deleted, when it calls the shim next time */
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskAbortDelay(TaskHandle_t task);
+#define taskYIELD() sched_yield()
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyWait(uint32_t bitsToClearOnEntry,
+                           uint32_t bitsToClearOnExit,
+                           uint32_t *notificationValue,
+                           TickType_t ticksToWait);
+/* long is 32 bits on the target, ULONG_MAX masks are truncated */
+#define xTaskNotifyWait(entry, exit, value, ticks) \
+    xTaskNotifyWait((uint32_t)(entry), (uint32_t)(exit), (value), (ticks))
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
+#define xTaskNotifyGive(task) xTaskNotify((task), 0, eIncrement)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_TASK_H */
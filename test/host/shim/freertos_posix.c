@@ -0,0 +1,469 @@
+/*
+ * FreeRTOS tasks, notifications and semaphores on POSIX threads.
+ *
+ * @file        freertos_posix.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "host.h"
+#include "host_kernel.h"
+
+static pthread_mutex_t kernelLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread TaskHandle_t taskSelf;
+
+void hostKernelLock(void)
+{
+    pthread_mutex_lock(&kernelLock);
+}
+
+void hostKernelUnlock(void)
+{
+    pthread_mutex_unlock(&kernelLock);
+}
+
+pthread_mutex_t *hostKernelMutex(void)
+{
+    return &kernelLock;
+}
+
+void hostCondInit(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+struct timespec *hostDeadline(struct timespec *deadline, TickType_t ticks)
+{
+    uint64_t ns;
+
+    if (ticks == portMAX_DELAY)
+    {
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    ns = (uint64_t)deadline->tv_nsec + (uint64_t)pdTICKS_TO_MS(ticks) * 1000000U;
+    deadline->tv_sec += (time_t)(ns / 1000000000U);
+    deadline->tv_nsec = (long)(ns % 1000000000U);
+    return deadline;
+}
+
+/* Task of the calling thread. Threads not created by the shim, like main(),
+ * get a task, so they can use notifications and semaphores. */
+static TaskHandle_t hostTaskSelf(void)
+{
+    if (taskSelf == NULL)
+    {
+        taskSelf = calloc(1, sizeof(StaticTask_t));
+        if (taskSelf == NULL)
+        {
+            abort();
+        }
+        hostCondInit(&taskSelf->cond);
+        taskSelf->thread = pthread_self();
+        taskSelf->name = "host";
+        taskSelf->core = tskNO_AFFINITY;
+    }
+    return taskSelf;
+}
+
+int hostWait(pthread_cond_t *cond, const struct timespec *deadline)
+{
+    TaskHandle_t self = hostTaskSelf();
+    int ret = 0;
+
+    if (self->deleted)
+    {
+        self->exited = true;
+        hostKernelUnlock();
+        pthread_exit(NULL);
+    }
+    if (!self->abortWait)
+    {
+        self->waitCond = cond;
+        ret = (deadline != NULL) ? pthread_cond_timedwait(cond, &kernelLock, deadline)
+                                 : pthread_cond_wait(cond, &kernelLock);
+        self->waitCond = NULL;
+    }
+    if (self->deleted)
+    {
+        self->exited = true;
+        hostKernelUnlock();
+        pthread_exit(NULL);
+    }
+    if (self->abortWait)
+    {
+        self->abortWait = false;
+        ret = ETIMEDOUT;
+    }
+    return ret;
+}
+
+/******************************************************************************/
+static void *hostTaskRun(void *arg)
+{
+    TaskHandle_t task = (TaskHandle_t)arg;
+
+    taskSelf = task;
+    task->function(task->param);
+    /* FreeRTOS task function must not return */
+    fprintf(stderr, "task %s returned\n", task->name);
+    abort();
+    return NULL;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t function,
+                                           const char *name,
+                                           uint32_t stackDepth,
+                                           void *param,
+                                           UBaseType_t priority,
+                                           StackType_t *stack,
+                                           StaticTask_t *taskBuffer,
+                                           BaseType_t core)
+{
+    char threadName[16];
+
+    (void)stackDepth;
+    (void)priority;
+    (void)stack;
+    memset(taskBuffer, 0, sizeof(*taskBuffer));
+    hostCondInit(&taskBuffer->cond);
+    taskBuffer->function = function;
+    taskBuffer->param = param;
+    taskBuffer->name = name;
+    taskBuffer->core = core;
+    if (pthread_create(&taskBuffer->thread, NULL, hostTaskRun, taskBuffer) != 0)
+    {
+        return NULL;
+    }
+    snprintf(threadName, sizeof(threadName), "%s", name);
+    pthread_setname_np(taskBuffer->thread, threadName);
+    return taskBuffer;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    TaskHandle_t self = hostTaskSelf();
+
+    if ((task == NULL) || (task == self))
+    {
+        hostKernelLock();
+        self->deleted = true;
+        self->exited = true;
+        hostKernelUnlock();
+        pthread_exit(NULL);
+    }
+    hostKernelLock();
+    task->deleted = true;
+    if (task->waitCond != NULL)
+    {
+        pthread_cond_broadcast(task->waitCond);
+    }
+    hostKernelUnlock();
+    pthread_join(task->thread, NULL);
+    pthread_cond_destroy(&task->cond);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    TaskHandle_t self = hostTaskSelf();
+    struct timespec deadline;
+
+    if (ticks == 0U)
+    {
+        sched_yield();
+        return;
+    }
+    hostKernelLock();
+    hostDeadline(&deadline, ticks);
+    while (hostWait(&self->cond, &deadline) != ETIMEDOUT)
+    {
+    }
+    hostKernelUnlock();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / (1000000 / CONFIG_FREERTOS_HZ));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return hostTaskSelf();
+}
+
+BaseType_t xTaskAbortDelay(TaskHandle_t task)
+{
+    BaseType_t ret = pdFAIL;
+
+    hostKernelLock();
+    if (task->waitCond != NULL)
+    {
+        task->abortWait = true;
+        pthread_cond_broadcast(task->waitCond);
+        ret = pdPASS;
+    }
+    hostKernelUnlock();
+    return ret;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    BaseType_t core = hostTaskSelf()->core;
+
+    return (core == tskNO_AFFINITY) ? 0 : core;
+}
+
+/******************************************************************************/
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    BaseType_t ret = pdPASS;
+
+    hostKernelLock();
+    switch (action)
+    {
+    case eSetBits:
+        task->notifyValue |= value;
+        break;
+    case eIncrement:
+        task->notifyValue++;
+        break;
+    case eSetValueWithOverwrite:
+        task->notifyValue = value;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (task->notified)
+        {
+            ret = pdFAIL;
+        }
+        else
+        {
+            task->notifyValue = value;
+        }
+        break;
+    default:
+        break;
+    }
+    task->notified = true;
+    pthread_cond_broadcast(&task->cond);
+    hostKernelUnlock();
+    return ret;
+}
+
+BaseType_t (xTaskNotifyWait)(uint32_t bitsToClearOnEntry,
+                           uint32_t bitsToClearOnExit,
+                           uint32_t *notificationValue,
+                           TickType_t ticksToWait)
+{
+    TaskHandle_t self = hostTaskSelf();
+    struct timespec deadline;
+    const struct timespec *pDeadline = hostDeadline(&deadline, ticksToWait);
+    BaseType_t ret = pdFALSE;
+
+    hostKernelLock();
+    if (!self->notified)
+    {
+        self->notifyValue &= ~bitsToClearOnEntry;
+        while (!self->notified && (ticksToWait != 0U))
+        {
+            if (hostWait(&self->cond, pDeadline) == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+    }
+    if (notificationValue != NULL)
+    {
+        *notificationValue = self->notifyValue;
+    }
+    if (self->notified)
+    {
+        self->notifyValue &= ~bitsToClearOnExit;
+        self->notified = false;
+        ret = pdTRUE;
+    }
+    hostKernelUnlock();
+    return ret;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+    TaskHandle_t self = hostTaskSelf();
+    struct timespec deadline;
+    const struct timespec *pDeadline = hostDeadline(&deadline, ticksToWait);
+    uint32_t value;
+
+    hostKernelLock();
+    while ((self->notifyValue == 0U) && (ticksToWait != 0U))
+    {
+        if (hostWait(&self->cond, pDeadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    value = self->notifyValue;
+    if (value != 0U)
+    {
+        self->notifyValue = (clearCountOnExit != pdFALSE) ? 0U : (value - 1U);
+    }
+    self->notified = false;
+    hostKernelUnlock();
+    return value;
+}
+
+/******************************************************************************/
+static SemaphoreHandle_t hostSemaphoreCreate(StaticSemaphore_t *buffer,
+                                             uint32_t maxCount,
+                                             uint32_t initialCount,
+                                             bool mutex)
+{
+    memset(buffer, 0, sizeof(*buffer));
+    hostCondInit(&buffer->cond);
+    buffer->maxCount = maxCount;
+    buffer->count = initialCount;
+    buffer->mutex = mutex;
+    return buffer;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer)
+{
+    return hostSemaphoreCreate(buffer, 1U, 0U, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCountingStatic(UBaseType_t maxCount,
+                                                 UBaseType_t initialCount,
+                                                 StaticSemaphore_t *buffer)
+{
+    return hostSemaphoreCreate(buffer, maxCount, initialCount, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+    return hostSemaphoreCreate(buffer, 1U, 1U, true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t *buffer)
+{
+    return hostSemaphoreCreate(buffer, 1U, 1U, true);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    pthread_cond_destroy(&semaphore->cond);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore)
+{
+    UBaseType_t count;
+
+    hostKernelLock();
+    count = semaphore->count;
+    hostKernelUnlock();
+    return count;
+}
+
+BaseType_t hostSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait, bool recursive)
+{
+    TaskHandle_t self = hostTaskSelf();
+    struct timespec deadline;
+    const struct timespec *pDeadline = hostDeadline(&deadline, ticksToWait);
+    BaseType_t ret = pdTRUE;
+
+    hostKernelLock();
+    if (recursive && (semaphore->holder == self))
+    {
+        semaphore->recursion++;
+    }
+    else
+    {
+        while ((semaphore->count == 0U) && (ret == pdTRUE))
+        {
+            if ((ticksToWait == 0U) || (hostWait(&semaphore->cond, pDeadline) == ETIMEDOUT))
+            {
+                ret = pdFALSE;
+            }
+        }
+        if (ret == pdTRUE)
+        {
+            semaphore->count--;
+            if (semaphore->mutex)
+            {
+                semaphore->holder = self;
+                semaphore->recursion = 1U;
+            }
+        }
+    }
+    hostKernelUnlock();
+    return ret;
+}
+
+BaseType_t hostSemaphoreGive(SemaphoreHandle_t semaphore, bool recursive)
+{
+    BaseType_t ret = pdTRUE;
+
+    (void)recursive;
+    hostKernelLock();
+    if (semaphore->mutex)
+    {
+        if (semaphore->holder != hostTaskSelf())
+        {
+            ret = pdFALSE;
+        }
+        else if (--semaphore->recursion == 0U)
+        {
+            semaphore->holder = NULL;
+            semaphore->count = 1U;
+            pthread_cond_broadcast(&semaphore->cond);
+        }
+    }
+    else if (semaphore->count >= semaphore->maxCount)
+    {
+        ret = pdFALSE;
+    }
+    else
+    {
+        semaphore->count++;
+        pthread_cond_broadcast(&semaphore->cond);
+    }
+    hostKernelUnlock();
+    return ret;
+}
+
+/******************************************************************************/
+uint64_t hostTaskCpuTime_us(TaskHandle_t task)
+{
+    clockid_t clock;
+    struct timespec ts;
+
+    if ((task == NULL) || task->exited || (pthread_getcpuclockid(task->thread, &clock) != 0) ||
+        (clock_gettime(clock, &ts) != 0))
+    {
+        return 0U;
+    }
+    return (uint64_t)ts.tv_sec * 1000000U + (uint64_t)ts.tv_nsec / 1000U;
+}
@@ -0,0 +1,123 @@
+/*
+ * Test access to the host shim: virtual CAN bus, simulated nodes, fault
+ * injection and task CPU time.
+ *
+ * @file        host.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "driver/twai.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Virtual bus. A bus thread arbitrates the head frames of all transmit queues
+ * like CAN does, lowest identifier first, and delivers the winner to all other
+ * ports. Ports are TWAI controllers installed by the driver or simulated nodes
+ * opened by the test. With real time on, each frame occupies the bus for its
+ * bit time (47 + 8 * DLC bits, without stuff bits), else frames take no time.
+ * A port, whose bit rate differs from the bus, gets bus errors only.
+ */
+typedef struct twai_obj_t hostPort_t;
+
+/* Callback for every frame on the bus, from the bus thread. time_us is the
+ * end of the frame. It must not block, but may send frames. */
+typedef void (*hostMonitor_t)(void *arg, const hostPort_t *sender, const twai_message_t *message, int64_t time_us);
+
+/* Bus bit rate in kbit/s, 0 accepts every port (default) */
+void hostBusSetBitRate(uint32_t kbps);
+/* Frames occupy the bus for their bit time at the bus bit rate, or at the
+ * bit rate of the sender, if the bus accepts every port */
+void hostBusSetRealTime(bool realTime);
+/* Stop arbitration, frames stay in the transmit queues until released */
+void hostBusHold(bool hold);
+void hostBusSetMonitor(hostMonitor_t monitor, void *arg);
+/* Number of frames on the bus since start */
+uint64_t hostBusFrames(void);
+/* Wait until all transmit queues are empty, false on timeout */
+bool hostBusWaitIdle(uint32_t timeout_ms);
+
+/* Simulated node, receives every frame of other ports */
+hostPort_t *hostNodeOpen(uint32_t rxQueueLen, uint32_t txQueueLen);
+void hostNodeClose(hostPort_t *node);
+esp_err_t hostNodeSend(hostPort_t *node, const twai_message_t *message, uint32_t timeout_ms);
+/* time_us, if not NULL, is the end of the frame on the bus */
+esp_err_t hostNodeReceive(hostPort_t *node, twai_message_t *message, int64_t *time_us, uint32_t timeout_ms);
+
+/* Port of installed TWAI controller, NULL if not installed */
+hostPort_t *hostController(int controllerId);
+/* Bit rate of the port in kbit/s */
+uint32_t hostPortBitRate(const hostPort_t *port);
+void hostPortFilter(const hostPort_t *port, twai_filter_config_t *filter);
+/* Number of twai_driver_install_v2() calls since start */
+uint32_t hostInstallCount(void);
+
+/* Fault injection. Controller goes bus-off: transmit queue is dropped and
+ * alerts ABOVE_ERR_WARN, ERR_PASS and BUS_OFF are raised. Recovery takes
+ * 128 * 11 bit times, at least recoveryMin_us. */
+void hostPortBusOff(hostPort_t *port);
+void hostPortSetRecoveryTime(uint32_t recoveryMin_us);
+/* Set error counters, alerts for warning and passive limits are raised */
+void hostPortSetErrorCounters(hostPort_t *port, uint32_t txErrors, uint32_t rxErrors);
+
+/*
+ * Simulated NVS flash. Pages of 4096 bytes hold 126 entries of 32 bytes,
+ * items are appended to the active page and old versions are marked erased,
+ * as NVS does. When only one free page is left, the live items of the page
+ * with most erased entries are moved to it and the page is erased. A blob
+ * takes one header entry and its data entries in one page. Flash time is not
+ * spent, but accumulated with typical SPI NOR figures.
+ */
+typedef struct
+{
+    uint64_t bytesProgrammed; /* entries and entry state bitmaps */
+    uint64_t bytesRead;
+    uint32_t programs;
+    uint32_t erases;
+    uint32_t eraseMin; /* erase count of the least and most erased page */
+    uint32_t eraseMax;
+    uint64_t time_us; /* simulated flash time */
+} hostFlashStats_t;
+
+/* Erase the whole flash of pages pages (default 6) and reset statistics.
+ * NVS must be initialized again. */
+void hostFlashFormat(uint32_t pages);
+/* Forget RAM state of NVS as a reset does, flash content is kept */
+void hostFlashReboot(void);
+void hostFlashStats(hostFlashStats_t *stats, bool reset);
+
+/* Time of the shim in microseconds, same as esp_timer_get_time() */
+int64_t hostTime_us(void);
+/* CPU time used by a task so far */
+uint64_t hostTaskCpuTime_us(TaskHandle_t task);
+/* Sleep the calling thread, without shim task state */
+void hostSleep_us(uint32_t time_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_H */
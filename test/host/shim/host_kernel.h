@@ -0,0 +1,41 @@
+/*
+ * Internal interface of the host shim. All blocking calls of the shim wait
+ * on a condition variable with one global lock, so a task can be woken by
+ * vTaskDelete() or xTaskAbortDelay() wherever it blocks.
+ *
+ * @file        host_kernel.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_KERNEL_H
+#define HOST_KERNEL_H
+
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+
+void hostKernelLock(void);
+void hostKernelUnlock(void);
+/* For threads of the shim, which are not tasks */
+pthread_mutex_t *hostKernelMutex(void);
+/* Condition variable on CLOCK_MONOTONIC */
+void hostCondInit(pthread_cond_t *cond);
+/* Absolute deadline after ticks, NULL for portMAX_DELAY */
+struct timespec *hostDeadline(struct timespec *deadline, TickType_t ticks);
+/* Wait with the kernel lock. Returns 0 after signal, ETIMEDOUT after
+ * deadline or xTaskAbortDelay(). Deleted task exits here. */
+int hostWait(pthread_cond_t *cond, const struct timespec *deadline);
+
+#endif /* HOST_KERNEL_H */
@@ -0,0 +1,602 @@
+/*
+ * NVS on a simulated flash, see host.h. Accounts programmed and read bytes,
+ * page erases and flash time, for the storage benchmark.
+ *
+ * @file        nvs_sim.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "host.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#define FLASH_PAGES_DEFAULT 6U
+#define FLASH_PAGES_MAX 64U
+#define FLASH_PAGE_ENTRIES 126U
+#define FLASH_ENTRY_SIZE 32U
+/* Page header and entry state bitmap */
+#define FLASH_PAGE_HEADER_SIZE 64U
+/* Bytes of one program operation */
+#define FLASH_PROGRAM_SIZE 256U
+/* Typical SPI NOR figures: page program, sector erase, 10 Mbyte/s read */
+#define FLASH_PROGRAM_NS 400000U
+#define FLASH_ERASE_NS 45000000U
+#define FLASH_READ_NS_PER_BYTE 100U
+
+#define NVS_NAMESPACES_MAX 8U
+#define NVS_TYPE_U8 0x01U
+#define NVS_TYPE_U16 0x02U
+#define NVS_TYPE_BLOB 0x42U
+#define NVS_BLOB_MAX ((FLASH_PAGE_ENTRIES - 1U) * FLASH_ENTRY_SIZE)
+
+typedef enum
+{
+    ENTRY_EMPTY,
+    ENTRY_WRITTEN,
+    ENTRY_ERASED
+} entryState_t;
+
+typedef enum
+{
+    PAGE_FREE,
+    PAGE_ACTIVE,
+    PAGE_FULL
+} pageState_t;
+
+/* Header entry of an item, primitive values follow in data of this entry */
+typedef struct
+{
+    uint8_t ns;
+    uint8_t type;
+    uint8_t span;
+    uint16_t len;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+} itemHeader_t;
+
+typedef struct
+{
+    pageState_t state;
+    uint32_t seq;
+    uint32_t eraseCount;
+    uint32_t next;   /* first empty entry */
+    uint32_t erased; /* erased entries */
+    uint8_t entryState[FLASH_PAGE_ENTRIES];
+    itemHeader_t header[FLASH_PAGE_ENTRIES];
+    uint8_t data[FLASH_PAGE_ENTRIES][FLASH_ENTRY_SIZE];
+} flashPage_t;
+
+/* Location of a live item, RAM state of NVS */
+typedef struct
+{
+    uint16_t page;
+    uint16_t entry;
+} itemRef_t;
+
+static pthread_mutex_t nvsLock = PTHREAD_MUTEX_INITIALIZER;
+static flashPage_t pages[FLASH_PAGES_MAX];
+static uint32_t pageCount;
+static uint32_t seqNext;
+static bool formatted;
+static bool initialized;
+static flashPage_t *active;
+static itemRef_t items[FLASH_PAGES_MAX * FLASH_PAGE_ENTRIES];
+static uint32_t itemCount;
+/* Namespace names are kept in flash by NVS, handle is index + 1 */
+static char namespaces[NVS_NAMESPACES_MAX][NVS_KEY_NAME_MAX_SIZE];
+static bool namespaceReadOnly[NVS_NAMESPACES_MAX];
+static uint32_t namespaceCount;
+static hostFlashStats_t stats;
+static uint64_t time_ns;
+
+static void flashProgram(uint32_t bytes)
+{
+    uint32_t operations = (bytes + FLASH_PROGRAM_SIZE - 1U) / FLASH_PROGRAM_SIZE;
+
+    stats.bytesProgrammed += bytes;
+    stats.programs += operations;
+    time_ns += (uint64_t)operations * FLASH_PROGRAM_NS;
+}
+
+static void flashRead(uint32_t bytes)
+{
+    stats.bytesRead += bytes;
+    time_ns += (uint64_t)bytes * FLASH_READ_NS_PER_BYTE;
+}
+
+static void flashErase(flashPage_t *page)
+{
+    uint32_t eraseCount = page->eraseCount + 1U;
+
+    memset(page, 0, sizeof(*page));
+    page->state = PAGE_FREE;
+    page->eraseCount = eraseCount;
+    stats.erases++;
+    time_ns += FLASH_ERASE_NS;
+}
+
+/* Entry states are 2 bits in the bitmap, one word is programmed */
+static void entryStateSet(flashPage_t *page, uint32_t entry, uint32_t span, entryState_t state)
+{
+    memset(&page->entryState[entry], (int)state, span);
+    if (state == ENTRY_ERASED)
+    {
+        page->erased += span;
+    }
+    flashProgram(4U);
+}
+
+static uint32_t pageIndex(const flashPage_t *page)
+{
+    return (uint32_t)(page - pages);
+}
+
+static flashPage_t *pageFree(void)
+{
+    uint32_t i;
+
+    for (i = 0U; i < pageCount; i++)
+    {
+        if (pages[i].state == PAGE_FREE)
+        {
+            return &pages[i];
+        }
+    }
+    return NULL;
+}
+
+static void pageActivate(flashPage_t *page)
+{
+    page->state = PAGE_ACTIVE;
+    page->seq = seqNext++;
+    flashProgram(FLASH_ENTRY_SIZE);
+    active = page;
+}
+
+/* Copy item to the active page, which has room for it */
+static void itemCopy(const flashPage_t *from, uint32_t entry, itemRef_t *ref)
+{
+    uint32_t span = from->header[entry].span;
+    uint32_t to = active->next;
+
+    active->header[to] = from->header[entry];
+    memcpy(active->data[to], from->data[entry], span * FLASH_ENTRY_SIZE);
+    flashRead(span * FLASH_ENTRY_SIZE);
+    flashProgram(span * FLASH_ENTRY_SIZE);
+    entryStateSet(active, to, span, ENTRY_WRITTEN);
+    active->next += span;
+    ref->page = (uint16_t)pageIndex(active);
+    ref->entry = (uint16_t)to;
+}
+
+/* Make room for span entries in the active page. The last free page is
+ * reserved for moving live items of the page with most erased entries. */
+static esp_err_t pageReserve(uint32_t span)
+{
+    while ((active == NULL) || ((FLASH_PAGE_ENTRIES - active->next) < span))
+    {
+        flashPage_t *victim = NULL;
+        uint32_t freePages = 0U;
+        uint32_t i;
+
+        if (active != NULL)
+        {
+            active->state = PAGE_FULL;
+            active = NULL;
+        }
+        for (i = 0U; i < pageCount; i++)
+        {
+            if (pages[i].state == PAGE_FREE)
+            {
+                freePages++;
+            }
+            else if ((victim == NULL) || (pages[i].erased > victim->erased))
+            {
+                victim = &pages[i];
+            }
+        }
+        if (freePages > 1U)
+        {
+            pageActivate(pageFree());
+            continue;
+        }
+        if ((freePages == 0U) || (victim == NULL) || (victim->erased == 0U))
+        {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+
+        pageActivate(pageFree());
+        for (i = 0U; i < itemCount; i++)
+        {
+            if (&pages[items[i].page] == victim)
+            {
+                itemCopy(victim, items[i].entry, &items[i]);
+            }
+        }
+        flashErase(victim);
+    }
+    return ESP_OK;
+}
+
+static bool itemFind(uint8_t ns, const char *key, uint32_t *index)
+{
+    uint32_t i;
+
+    for (i = 0U; i < itemCount; i++)
+    {
+        const itemHeader_t *header = &pages[items[i].page].header[items[i].entry];
+
+        if ((header->ns == ns) && (strncmp(header->key, key, NVS_KEY_NAME_MAX_SIZE) == 0))
+        {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void itemErase(uint32_t index)
+{
+    flashPage_t *page = &pages[items[index].page];
+
+    entryStateSet(page, items[index].entry, page->header[items[index].entry].span, ENTRY_ERASED);
+    items[index] = items[--itemCount];
+}
+
+static esp_err_t handleCheck(nvs_handle_t handle, const char *key, bool write)
+{
+    if (!initialized)
+    {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if ((handle == 0U) || (handle > namespaceCount))
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (write && namespaceReadOnly[handle - 1U])
+    {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if ((key == NULL) || (strlen(key) >= NVS_KEY_NAME_MAX_SIZE))
+    {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    return ESP_OK;
+}
+
+/* Write a new version of the item and erase the old one after it, unless
+ * the value did not change */
+static esp_err_t nvsSet(nvs_handle_t handle, const char *key, uint8_t type, const void *value, size_t len)
+{
+    itemHeader_t header = {.ns = (uint8_t)handle, .type = type, .len = (uint16_t)len};
+    uint32_t index = 0U;
+    bool found;
+    esp_err_t err;
+
+    pthread_mutex_lock(&nvsLock);
+    err = handleCheck(handle, key, true);
+    if ((err == ESP_OK) && (len > NVS_BLOB_MAX))
+    {
+        err = ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+    if (err != ESP_OK)
+    {
+        pthread_mutex_unlock(&nvsLock);
+        return err;
+    }
+    strncpy(header.key, key, NVS_KEY_NAME_MAX_SIZE - 1U);
+    header.span = (uint8_t)((type == NVS_TYPE_BLOB) ? (1U + (len + FLASH_ENTRY_SIZE - 1U) / FLASH_ENTRY_SIZE) : 1U);
+
+    found = itemFind((uint8_t)handle, key, &index);
+    if (found)
+    {
+        const flashPage_t *page = &pages[items[index].page];
+        uint32_t entry = items[index].entry;
+        const uint8_t *old = (type == NVS_TYPE_BLOB) ? page->data[entry + 1U] : page->data[entry];
+
+        if ((page->header[entry].type == type) && (page->header[entry].len == len))
+        {
+            flashRead((uint32_t)len);
+            if (memcmp(old, value, len) == 0)
+            {
+                pthread_mutex_unlock(&nvsLock);
+                return ESP_OK;
+            }
+        }
+    }
+
+    err = pageReserve(header.span);
+    if (err == ESP_OK)
+    {
+        uint32_t entry = active->next;
+        itemRef_t ref = {.page = (uint16_t)pageIndex(active), .entry = (uint16_t)entry};
+
+        active->header[entry] = header;
+        memcpy((type == NVS_TYPE_BLOB) ? active->data[entry + 1U] : active->data[entry], value, len);
+        flashProgram(header.span * FLASH_ENTRY_SIZE);
+        entryStateSet(active, entry, header.span, ENTRY_WRITTEN);
+        active->next += header.span;
+        if (found)
+        {
+            /* old version may have been moved to make room */
+            flashPage_t *page = &pages[items[index].page];
+
+            entryStateSet(page, items[index].entry, page->header[items[index].entry].span, ENTRY_ERASED);
+            items[index] = ref;
+        }
+        else
+        {
+            items[itemCount++] = ref;
+        }
+    }
+    pthread_mutex_unlock(&nvsLock);
+    return err;
+}
+
+static esp_err_t nvsGet(nvs_handle_t handle, const char *key, uint8_t type, void *value, size_t *len)
+{
+    uint32_t index;
+    esp_err_t err;
+
+    pthread_mutex_lock(&nvsLock);
+    err = handleCheck(handle, key, false);
+    if ((err == ESP_OK) && !itemFind((uint8_t)handle, key, &index))
+    {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (err == ESP_OK)
+    {
+        const flashPage_t *page = &pages[items[index].page];
+        uint32_t entry = items[index].entry;
+        const itemHeader_t *header = &page->header[entry];
+
+        flashRead(FLASH_ENTRY_SIZE);
+        if (header->type != type)
+        {
+            err = ESP_ERR_NVS_NOT_FOUND;
+        }
+        else if (value == NULL)
+        {
+            *len = header->len;
+        }
+        else if (*len < header->len)
+        {
+            err = ESP_ERR_NVS_INVALID_LENGTH;
+        }
+        else
+        {
+            memcpy(value, (type == NVS_TYPE_BLOB) ? page->data[entry + 1U] : page->data[entry], header->len);
+            if (type == NVS_TYPE_BLOB)
+            {
+                flashRead(header->len);
+            }
+            *len = header->len;
+        }
+    }
+    pthread_mutex_unlock(&nvsLock);
+    return err;
+}
+
+/******************************************************************************/
+void hostFlashFormat(uint32_t pageCount_)
+{
+    pthread_mutex_lock(&nvsLock);
+    memset(pages, 0, sizeof(pages));
+    pageCount = (pageCount_ < 2U) ? 2U : ((pageCount_ > FLASH_PAGES_MAX) ? FLASH_PAGES_MAX : pageCount_);
+    seqNext = 0U;
+    formatted = true;
+    initialized = false;
+    active = NULL;
+    itemCount = 0U;
+    namespaceCount = 0U;
+    memset(&stats, 0, sizeof(stats));
+    time_ns = 0U;
+    pthread_mutex_unlock(&nvsLock);
+}
+
+void hostFlashReboot(void)
+{
+    pthread_mutex_lock(&nvsLock);
+    initialized = false;
+    active = NULL;
+    itemCount = 0U;
+    pthread_mutex_unlock(&nvsLock);
+}
+
+void hostFlashStats(hostFlashStats_t *stats_, bool reset)
+{
+    uint32_t i;
+
+    pthread_mutex_lock(&nvsLock);
+    stats.time_us = time_ns / 1000U;
+    stats.eraseMin = UINT32_MAX;
+    stats.eraseMax = 0U;
+    for (i = 0U; i < pageCount; i++)
+    {
+        stats.eraseMin = (pages[i].eraseCount < stats.eraseMin) ? pages[i].eraseCount : stats.eraseMin;
+        stats.eraseMax = (pages[i].eraseCount > stats.eraseMax) ? pages[i].eraseCount : stats.eraseMax;
+    }
+    *stats_ = stats;
+    if (reset)
+    {
+        memset(&stats, 0, sizeof(stats));
+        time_ns = 0U;
+    }
+    pthread_mutex_unlock(&nvsLock);
+}
+
+/* Scan all pages for items, as NVS does at init. Of two versions of an item,
+ * left by a reset between writing the new and erasing the old one, the newer
+ * is kept. */
+esp_err_t nvs_flash_init(void)
+{
+    uint32_t i, entry;
+
+    if (!formatted)
+    {
+        hostFlashFormat(FLASH_PAGES_DEFAULT);
+    }
+    pthread_mutex_lock(&nvsLock);
+    if (initialized)
+    {
+        pthread_mutex_unlock(&nvsLock);
+        return ESP_OK;
+    }
+    for (i = 0U; i < pageCount; i++)
+    {
+        flashPage_t *page = &pages[i];
+
+        flashRead(FLASH_PAGE_HEADER_SIZE);
+        if (page->state == PAGE_FREE)
+        {
+            continue;
+        }
+        if (page->state == PAGE_ACTIVE)
+        {
+            active = page;
+        }
+        for (entry = 0U; entry < page->next; entry += page->header[entry].span)
+        {
+            itemRef_t ref = {.page = (uint16_t)i, .entry = (uint16_t)entry};
+            uint32_t index;
+
+            flashRead(FLASH_ENTRY_SIZE);
+            if (page->entryState[entry] != ENTRY_WRITTEN)
+            {
+                continue;
+            }
+            if (!itemFind(page->header[entry].ns, page->header[entry].key, &index))
+            {
+                items[itemCount++] = ref;
+            }
+            else if (pages[items[index].page].seq < page->seq)
+            {
+                itemErase(index);
+                items[itemCount++] = ref;
+            }
+            else
+            {
+                entryStateSet(page, entry, page->header[entry].span, ENTRY_ERASED);
+            }
+        }
+    }
+    initialized = true;
+    pthread_mutex_unlock(&nvsLock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    uint32_t i;
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&nvsLock);
+    if (!initialized)
+    {
+        err = ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    else if ((namespace_name == NULL) || (strlen(namespace_name) >= NVS_KEY_NAME_MAX_SIZE))
+    {
+        err = ESP_ERR_NVS_INVALID_NAME;
+    }
+    else
+    {
+        for (i = 0U; (i < namespaceCount) && (strcmp(namespaces[i], namespace_name) != 0); i++)
+        {
+        }
+        if (i == NVS_NAMESPACES_MAX)
+        {
+            err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        else
+        {
+            if (i == namespaceCount)
+            {
+                strcpy(namespaces[namespaceCount++], namespace_name);
+            }
+            namespaceReadOnly[i] = (open_mode == NVS_READONLY);
+            *out_handle = i + 1U;
+        }
+    }
+    pthread_mutex_unlock(&nvsLock);
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return nvsSet(handle, key, NVS_TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value)
+{
+    return nvsSet(handle, key, NVS_TYPE_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return nvsSet(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    size_t len = sizeof(*out_value);
+
+    return nvsGet(handle, key, NVS_TYPE_U8, out_value, &len);
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *out_value)
+{
+    size_t len = sizeof(*out_value);
+
+    return nvsGet(handle, key, NVS_TYPE_U16, out_value, &len);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return nvsGet(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    uint32_t index;
+    esp_err_t err;
+
+    pthread_mutex_lock(&nvsLock);
+    err = handleCheck(handle, key, true);
+    if ((err == ESP_OK) && !itemFind((uint8_t)handle, key, &index))
+    {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (err == ESP_OK)
+    {
+        itemErase(index);
+    }
+    pthread_mutex_unlock(&nvsLock);
+    return err;
+}
+
+/* Items are written at once, as by NVS */
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void)handle;
+    return initialized ? ESP_OK : ESP_ERR_NVS_NOT_INITIALIZED;
+}
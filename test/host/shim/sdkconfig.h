@@ -0,0 +1,96 @@
+/*
+ * Kconfig values for the host build of the port. Defaults follow Kconfig,
+ * test targets override single options with compile definitions.
+ *
+ * @file        sdkconfig.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+#define CONFIG_FREERTOS_HZ 1000
+#define CONFIG_USE_CANOPENNODE 1
+
+/* TWAI Configuration */
+#define CONFIG_CO_TWAI_TX_GPIO 5
+#define CONFIG_CO_TWAI_RX_GPIO 4
+#define CONFIG_CO_BPS_25K 1
+#define CONFIG_CO_BPS_50K 1
+#define CONFIG_CO_BPS_100K 1
+#define CONFIG_CO_BPS_125K 1
+#define CONFIG_CO_BPS_250K 1
+#define CONFIG_CO_BPS_500K 1
+#define CONFIG_CO_BPS_800K 1
+#define CONFIG_CO_BPS_1M 1
+#ifndef CONFIG_CO_DEFAULT_BPS
+#define CONFIG_CO_DEFAULT_BPS 1000
+#endif
+#ifndef CONFIG_CO_RX_DISPATCH_TABLE
+#define CONFIG_CO_RX_DISPATCH_TABLE 1
+#endif
+#ifndef CONFIG_CO_TWAI_HW_FILTER
+#define CONFIG_CO_TWAI_HW_FILTER 0
+#endif
+#ifndef CONFIG_CO_TWAI_ALERT_TASK
+#define CONFIG_CO_TWAI_ALERT_TASK 1
+#endif
+#ifndef CONFIG_CO_BUS_OFF_RECOVERY
+#define CONFIG_CO_BUS_OFF_RECOVERY 1
+#endif
+#ifndef CONFIG_CO_BUS_OFF_BACKOFF_MS
+#define CONFIG_CO_BUS_OFF_BACKOFF_MS 100
+#endif
+#ifndef CONFIG_CO_BUS_OFF_BACKOFF_MAX_MS
+#define CONFIG_CO_BUS_OFF_BACKOFF_MAX_MS 5000
+#endif
+#ifndef CONFIG_CO_TWAI_TX_QUEUE_LEN
+#define CONFIG_CO_TWAI_TX_QUEUE_LEN 5
+#endif
+#ifndef CONFIG_CO_TX_BUFFER_MAX
+#define CONFIG_CO_TX_BUFFER_MAX 64
+#endif
+#ifndef CONFIG_CO_DRIVER_STATS
+#define CONFIG_CO_DRIVER_STATS 0
+#endif
+#ifndef CONFIG_CO_CAN_MODULE_INSTANCES
+#define CONFIG_CO_CAN_MODULE_INSTANCES 1
+#endif
+
+/* Storage */
+#define CONFIG_CO_STORAGE_NVS_NAMESPACE "canopen"
+#ifndef CONFIG_CO_STORAGE_BUFFER_SIZE
+#define CONFIG_CO_STORAGE_BUFFER_SIZE 256
+#endif
+
+/* Task Configuration */
+#define CONFIG_CO_TASK_CORE 0
+#define CONFIG_CO_RX_TASK_STACK_SIZE 4096
+#define CONFIG_CO_RX_TASK_PRIORITY 5
+#define CONFIG_CO_TX_TASK_STACK_SIZE 4096
+#define CONFIG_CO_TX_TASK_PRIORITY 5
+#define CONFIG_CO_ALERT_TASK_STACK_SIZE 2048
+#define CONFIG_CO_ALERT_TASK_PRIORITY 4
+
+/* Debug */
+#ifndef CONFIG_CO_TRACE
+#define CONFIG_CO_TRACE 0
+#endif
+#ifndef CONFIG_CO_TRACE_BUFFER_SIZE
+#define CONFIG_CO_TRACE_BUFFER_SIZE 1024
+#endif
+
+#endif /* HOST_SDKCONFIG_H */
@@ -0,0 +1,1018 @@
+/*
+ * TWAI driver on an in-process virtual CAN bus, optionally mirrored to a
+ * SocketCAN interface (CMake option CO_HOST_VCAN).
+ *
+ * @file        twai_vbus.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "driver/twai.h"
+#include "esp_timer.h"
+#include "host.h"
+#include "host_kernel.h"
+
+#if HOST_VCAN
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+/* Controllers and simulated nodes */
+#define HOST_PORTS 160
+
+typedef struct
+{
+    twai_message_t message;
+    int64_t time_us;
+} hostFrame_t;
+
+typedef struct
+{
+    hostFrame_t *slot;
+    uint32_t size;
+    uint32_t head;
+    uint32_t count;
+} hostQueue_t;
+
+struct twai_obj_t
+{
+    bool used;
+    bool controller; /* TWAI driver, else simulated node */
+    int controllerId;
+    uint32_t generation; /* changes, when the port is closed */
+    twai_state_t state;
+    uint32_t bitRate; /* kbit/s, 0 follows the bus */
+    twai_filter_config_t filter;
+    hostQueue_t txQueue; /* head frame is in the controller */
+    hostQueue_t rxQueue;
+    pthread_cond_t txCond;
+    pthread_cond_t rxCond;
+    pthread_cond_t alertCond;
+    uint32_t alertsEnabled;
+    uint32_t alertsPending;
+    twai_status_info_t status;
+    int64_t recovered_us; /* end of recovery in TWAI_STATE_RECOVERING */
+};
+
+static hostPort_t ports[HOST_PORTS];
+static pthread_once_t busOnce = PTHREAD_ONCE_INIT;
+static pthread_cond_t busCond;  /* bus thread waits for frames */
+static pthread_cond_t idleCond; /* hostBusWaitIdle() */
+static uint32_t busBitRate;
+static bool busRealTime;
+static bool busHold;
+static bool busBusy; /* frame is on the bus */
+static hostMonitor_t busMonitor;
+static void *busMonitorArg;
+static uint64_t busFrames;
+static uint32_t installCount;
+static uint32_t recoveryMin_us;
+#if HOST_VCAN
+static int vcanSocket = -1;
+#endif
+
+/******************************************************************************/
+static void hostQueueInit(hostQueue_t *queue, uint32_t size)
+{
+    queue->slot = calloc((size > 0U) ? size : 1U, sizeof(hostFrame_t));
+    if (queue->slot == NULL)
+    {
+        abort();
+    }
+    queue->size = size;
+    queue->head = 0U;
+    queue->count = 0U;
+}
+
+static bool hostQueuePush(hostQueue_t *queue, const hostFrame_t *frame)
+{
+    if (queue->count >= queue->size)
+    {
+        return false;
+    }
+    queue->slot[(queue->head + queue->count) % queue->size] = *frame;
+    queue->count++;
+    return true;
+}
+
+static bool hostQueuePop(hostQueue_t *queue, hostFrame_t *frame)
+{
+    if (queue->count == 0U)
+    {
+        return false;
+    }
+    *frame = queue->slot[queue->head];
+    queue->head = (queue->head + 1U) % queue->size;
+    queue->count--;
+    return true;
+}
+
+/******************************************************************************/
+static void hostAlert(hostPort_t *port, uint32_t alerts)
+{
+    port->alertsPending |= alerts & port->alertsEnabled;
+    if (port->alertsPending != 0U)
+    {
+        pthread_cond_broadcast(&port->alertCond);
+    }
+}
+
+static uint32_t hostPortRate(const hostPort_t *port)
+{
+    return (port->bitRate != 0U) ? port->bitRate : busBitRate;
+}
+
+static bool hostPortOnBus(const hostPort_t *port)
+{
+    return port->used && (!port->controller || (port->state == TWAI_STATE_RUNNING));
+}
+
+static bool hostPortRateMatches(const hostPort_t *port)
+{
+    return (busBitRate == 0U) || (port->bitRate == 0U) || (port->bitRate == busBitRate);
+}
+
+/* Standard and extended frames ordered as in arbitration, lower value wins */
+static uint32_t hostFramePriority(const twai_message_t *message)
+{
+    uint32_t base = message->extd ? (message->identifier >> 18) : message->identifier;
+    uint32_t extension = message->extd ? (message->identifier & 0x3FFFFU) : 0U;
+
+    return ((base & 0x7FFU) << 21) | ((uint32_t)message->extd << 20) | (extension << 1) | message->rtr;
+}
+
+/* Acceptance filter of standard frames, bit layout of the TWAI controller.
+ * Extended frames are compared by identifier only. */
+static bool hostFilterAccepts(const twai_filter_config_t *filter, const twai_message_t *message)
+{
+    uint32_t care = ~filter->acceptance_mask;
+    uint8_t data0 = (message->data_length_code > 0U) ? message->data[0] : 0U;
+    uint8_t data1 = (message->data_length_code > 1U) ? message->data[1] : 0U;
+    uint32_t bits;
+
+    if (message->extd)
+    {
+        bits = (message->identifier << 3) | ((uint32_t)message->rtr << 2);
+        if (filter->single_filter)
+        {
+            return ((bits ^ filter->acceptance_code) & care) == 0U;
+        }
+        return (((bits ^ filter->acceptance_code) & care & 0xFFFF0000UL) == 0U) ||
+               ((((bits >> 16) ^ filter->acceptance_code) & care & 0x0000FFFFUL) == 0U);
+    }
+    if (filter->single_filter)
+    {
+        bits = (message->identifier << 21) | ((uint32_t)message->rtr << 20) | ((uint32_t)data0 << 8) | data1;
+        return ((bits ^ filter->acceptance_code) & care) == 0U;
+    }
+    /* first filter: identifier, RTR and data byte 0, second: identifier, RTR */
+    bits = (message->identifier << 21) | ((uint32_t)message->rtr << 20) |
+           ((uint32_t)(data0 >> 4) << 16) | (data0 & 0x0FU);
+    if (((bits ^ filter->acceptance_code) & care & 0xFFFF000FUL) == 0U)
+    {
+        return true;
+    }
+    bits = (message->identifier << 5) | ((uint32_t)message->rtr << 4);
+    return ((bits ^ filter->acceptance_code) & care & 0x0000FFF0UL) == 0U;
+}
+
+static hostPort_t *hostPortOpen(bool controller, int controllerId, uint32_t rxQueueLen, uint32_t txQueueLen)
+{
+    hostPort_t *port;
+
+    for (port = &ports[0]; port < &ports[HOST_PORTS]; port++)
+    {
+        if (!port->used)
+        {
+            uint32_t generation = port->generation;
+
+            memset(port, 0, sizeof(*port));
+            port->generation = generation;
+            port->used = true;
+            port->controller = controller;
+            port->controllerId = controllerId;
+            port->state = controller ? TWAI_STATE_STOPPED : TWAI_STATE_RUNNING;
+            hostQueueInit(&port->txQueue, txQueueLen);
+            hostQueueInit(&port->rxQueue, rxQueueLen);
+            hostCondInit(&port->txCond);
+            hostCondInit(&port->rxCond);
+            hostCondInit(&port->alertCond);
+            return port;
+        }
+    }
+    return NULL;
+}
+
+static void hostPortClose(hostPort_t *port)
+{
+    free(port->txQueue.slot);
+    free(port->rxQueue.slot);
+    pthread_cond_destroy(&port->txCond);
+    pthread_cond_destroy(&port->rxCond);
+    pthread_cond_destroy(&port->alertCond);
+    port->used = false;
+    port->generation++;
+    pthread_cond_broadcast(&busCond);
+}
+
+/******************************************************************************/
+static void hostBusDeliver(const hostPort_t *sender, const hostFrame_t *frame)
+{
+    hostPort_t *port;
+
+    for (port = &ports[0]; port < &ports[HOST_PORTS]; port++)
+    {
+        if ((port == sender) || !hostPortOnBus(port) || !hostPortRateMatches(port))
+        {
+            continue;
+        }
+        if (port->controller && !hostFilterAccepts(&port->filter, &frame->message))
+        {
+            continue;
+        }
+        if (hostQueuePush(&port->rxQueue, frame))
+        {
+            hostAlert(port, TWAI_ALERT_RX_DATA);
+            pthread_cond_broadcast(&port->rxCond);
+        }
+        else
+        {
+            port->status.rx_missed_count++;
+            hostAlert(port, TWAI_ALERT_RX_QUEUE_FULL);
+        }
+        port->status.msgs_to_rx = port->rxQueue.count;
+    }
+}
+
+/* Port with the winning head frame. Frames of ports with wrong bit rate
+ * are dropped with bus error. */
+static hostPort_t *hostBusArbitrate(void)
+{
+    hostPort_t *winner = NULL;
+    hostPort_t *port;
+    uint32_t contenders = 0U;
+
+    for (port = &ports[0]; port < &ports[HOST_PORTS]; port++)
+    {
+        hostFrame_t frame;
+
+        if (!hostPortOnBus(port) || (port->txQueue.count == 0U))
+        {
+            continue;
+        }
+        if (!hostPortRateMatches(port))
+        {
+            (void)hostQueuePop(&port->txQueue, &frame);
+            port->status.msgs_to_tx = port->txQueue.count;
+            port->status.bus_error_count++;
+            port->status.tx_failed_count++;
+            hostAlert(port, TWAI_ALERT_BUS_ERROR | TWAI_ALERT_TX_FAILED);
+            pthread_cond_broadcast(&port->txCond);
+            continue;
+        }
+        contenders++;
+        if ((winner == NULL) || (hostFramePriority(&port->txQueue.slot[port->txQueue.head].message) <
+                                 hostFramePriority(&winner->txQueue.slot[winner->txQueue.head].message)))
+        {
+            winner = port;
+        }
+    }
+    if (contenders > 1U)
+    {
+        for (port = &ports[0]; port < &ports[HOST_PORTS]; port++)
+        {
+            if ((port != winner) && hostPortOnBus(port) && (port->txQueue.count != 0U))
+            {
+                port->status.arb_lost_count++;
+                hostAlert(port, TWAI_ALERT_ARB_LOST);
+            }
+        }
+    }
+    return winner;
+}
+
+/* Finish bus recovery of controllers. Returns time of next recovery end, or
+ * -1 if none is running. */
+static int64_t hostBusRecoveryProcess(void)
+{
+    int64_t now_us = esp_timer_get_time();
+    int64_t next_us = -1;
+    hostPort_t *port;
+
+    for (port = &ports[0]; port < &ports[HOST_PORTS]; port++)
+    {
+        if (!port->used || (port->state != TWAI_STATE_RECOVERING))
+        {
+            continue;
+        }
+        if (now_us >= port->recovered_us)
+        {
+            port->state = TWAI_STATE_STOPPED;
+            port->status.tx_error_counter = 0U;
+            port->status.rx_error_counter = 0U;
+            hostAlert(port, TWAI_ALERT_BUS_RECOVERED);
+        }
+        else if ((next_us < 0) || (port->recovered_us < next_us))
+        {
+            next_us = port->recovered_us;
+        }
+    }
+    return next_us;
+}
+
+static bool hostBusIdle(void)
+{
+    const hostPort_t *port;
+
+    if (busBusy)
+    {
+        return false;
+    }
+    for (port = &ports[0]; port < &ports[HOST_PORTS]; port++)
+    {
+        if (hostPortOnBus(port) && (port->txQueue.count != 0U))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+#if HOST_VCAN
+static void hostVcanWrite(const twai_message_t *message)
+{
+    struct can_frame cf;
+
+    memset(&cf, 0, sizeof(cf));
+    cf.can_id = message->identifier | (message->extd ? CAN_EFF_FLAG : 0U) | (message->rtr ? CAN_RTR_FLAG : 0U);
+    cf.can_dlc = (message->data_length_code > 8U) ? 8U : message->data_length_code;
+    memcpy(cf.data, message->data, cf.can_dlc);
+    if (write(vcanSocket, &cf, sizeof(cf)) != (ssize_t)sizeof(cf))
+    {
+        perror("vcan write");
+    }
+}
+
+/* Frames from other processes on the interface */
+static void *hostVcanRun(void *arg)
+{
+    struct can_frame cf;
+    hostFrame_t frame;
+
+    (void)arg;
+    while (read(vcanSocket, &cf, sizeof(cf)) == (ssize_t)sizeof(cf))
+    {
+        memset(&frame, 0, sizeof(frame));
+        frame.message.extd = (cf.can_id & CAN_EFF_FLAG) != 0U;
+        frame.message.rtr = (cf.can_id & CAN_RTR_FLAG) != 0U;
+        frame.message.identifier = cf.can_id & (frame.message.extd ? CAN_EFF_MASK : CAN_SFF_MASK);
+        frame.message.data_length_code = cf.can_dlc;
+        memcpy(frame.message.data, cf.data, 8);
+        hostKernelLock();
+        frame.time_us = esp_timer_get_time();
+        hostBusDeliver(NULL, &frame);
+        busFrames++;
+        hostKernelUnlock();
+    }
+    return NULL;
+}
+
+static void hostVcanOpen(void)
+{
+    const char *name = getenv("CO_HOST_VCAN_IF");
+    struct sockaddr_can addr;
+    struct ifreq ifr;
+    pthread_t thread;
+
+    if (name == NULL)
+    {
+        name = "vcan0";
+    }
+    vcanSocket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    if ((vcanSocket < 0) || (ioctl(vcanSocket, SIOCGIFINDEX, &ifr) < 0) ||
+        ((addr.can_ifindex = ifr.ifr_ifindex), bind(vcanSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0))
+    {
+        fprintf(stderr, "SocketCAN %s not available, bus is in-process only\n", name);
+        if (vcanSocket >= 0)
+        {
+            close(vcanSocket);
+        }
+        vcanSocket = -1;
+        return;
+    }
+    pthread_create(&thread, NULL, hostVcanRun, NULL);
+    pthread_detach(thread);
+}
+#endif /* HOST_VCAN */
+
+static void *hostBusRun(void *arg)
+{
+    struct timespec busFree = {0, 0};
+
+    (void)arg;
+    hostKernelLock();
+    while (true)
+    {
+        int64_t next_us = hostBusRecoveryProcess();
+        hostPort_t *winner = busHold ? NULL : hostBusArbitrate();
+        hostFrame_t frame;
+        uint32_t generation;
+
+        if (winner == NULL)
+        {
+            if (hostBusIdle())
+            {
+                pthread_cond_broadcast(&idleCond);
+            }
+            if (next_us >= 0)
+            {
+                struct timespec deadline;
+
+                hostDeadline(&deadline, 0);
+                deadline.tv_sec += (time_t)((next_us - esp_timer_get_time()) / 1000000);
+                deadline.tv_nsec += (long)(((next_us - esp_timer_get_time()) % 1000000) * 1000);
+                if (deadline.tv_nsec >= 1000000000L)
+                {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&busCond, hostKernelMutex(), &deadline);
+            }
+            else
+            {
+                pthread_cond_wait(&busCond, hostKernelMutex());
+            }
+            continue;
+        }
+
+        (void)hostQueuePop(&winner->txQueue, &frame);
+        generation = winner->generation;
+        if (busRealTime && (hostPortRate(winner) != 0U))
+        {
+            uint32_t bits = 47U + (frame.message.rtr ? 0U : 8U * ((frame.message.data_length_code > 8U) ? 8U : frame.message.data_length_code));
+            uint64_t duration_ns = (uint64_t)bits * 1000000U / hostPortRate(winner);
+            struct timespec now;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((now.tv_sec > busFree.tv_sec) || ((now.tv_sec == busFree.tv_sec) && (now.tv_nsec > busFree.tv_nsec)))
+            {
+                busFree = now;
+            }
+            busFree.tv_nsec += (long)duration_ns;
+            while (busFree.tv_nsec >= 1000000000L)
+            {
+                busFree.tv_sec++;
+                busFree.tv_nsec -= 1000000000L;
+            }
+            busBusy = true;
+            hostKernelUnlock();
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &busFree, NULL) != 0)
+            {
+            }
+            hostKernelLock();
+            busBusy = false;
+        }
+        if (winner->generation != generation)
+        {
+            /* controller uninstalled during the frame */
+            continue;
+        }
+        frame.time_us = esp_timer_get_time();
+        hostBusDeliver(winner, &frame);
+        busFrames++;
+        winner->status.msgs_to_tx = winner->txQueue.count;
+        hostAlert(winner, TWAI_ALERT_TX_SUCCESS | ((winner->txQueue.count == 0U) ? TWAI_ALERT_TX_IDLE : 0U));
+        pthread_cond_broadcast(&winner->txCond);
+#if HOST_VCAN
+        if (vcanSocket >= 0)
+        {
+            hostVcanWrite(&frame.message);
+        }
+#endif
+        if (busMonitor != NULL)
+        {
+            hostMonitor_t monitor = busMonitor;
+            void *monitorArg = busMonitorArg;
+
+            hostKernelUnlock();
+            monitor(monitorArg, winner, &frame.message, frame.time_us);
+            hostKernelLock();
+        }
+    }
+    return NULL;
+}
+
+static void hostBusStart(void)
+{
+    pthread_t thread;
+
+    hostCondInit(&busCond);
+    hostCondInit(&idleCond);
+#if HOST_VCAN
+    hostVcanOpen();
+#endif
+    if (pthread_create(&thread, NULL, hostBusRun, NULL) != 0)
+    {
+        abort();
+    }
+    pthread_setname_np(thread, "vbus");
+    pthread_detach(thread);
+}
+
+/******************************************************************************/
+void hostBusSetBitRate(uint32_t kbps)
+{
+    pthread_once(&busOnce, hostBusStart);
+    hostKernelLock();
+    busBitRate = kbps;
+    pthread_cond_broadcast(&busCond);
+    hostKernelUnlock();
+}
+
+void hostBusSetRealTime(bool realTime)
+{
+    hostKernelLock();
+    busRealTime = realTime;
+    hostKernelUnlock();
+}
+
+void hostBusHold(bool hold)
+{
+    pthread_once(&busOnce, hostBusStart);
+    hostKernelLock();
+    busHold = hold;
+    pthread_cond_broadcast(&busCond);
+    hostKernelUnlock();
+}
+
+void hostBusSetMonitor(hostMonitor_t monitor, void *arg)
+{
+    hostKernelLock();
+    busMonitor = monitor;
+    busMonitorArg = arg;
+    hostKernelUnlock();
+}
+
+uint64_t hostBusFrames(void)
+{
+    uint64_t frames;
+
+    hostKernelLock();
+    frames = busFrames;
+    hostKernelUnlock();
+    return frames;
+}
+
+bool hostBusWaitIdle(uint32_t timeout_ms)
+{
+    struct timespec deadline;
+    bool idle;
+
+    pthread_once(&busOnce, hostBusStart);
+    hostKernelLock();
+    hostDeadline(&deadline, pdMS_TO_TICKS(timeout_ms));
+    while (!(idle = hostBusIdle()))
+    {
+        if (pthread_cond_timedwait(&idleCond, hostKernelMutex(), &deadline) == ETIMEDOUT)
+        {
+            idle = hostBusIdle();
+            break;
+        }
+    }
+    hostKernelUnlock();
+    return idle;
+}
+
+hostPort_t *hostNodeOpen(uint32_t rxQueueLen, uint32_t txQueueLen)
+{
+    hostPort_t *node;
+
+    pthread_once(&busOnce, hostBusStart);
+    hostKernelLock();
+    node = hostPortOpen(false, -1, rxQueueLen, txQueueLen);
+    hostKernelUnlock();
+    return node;
+}
+
+void hostNodeClose(hostPort_t *node)
+{
+    hostKernelLock();
+    hostPortClose(node);
+    hostKernelUnlock();
+}
+
+static esp_err_t hostPortTransmit(hostPort_t *port, const twai_message_t *message, TickType_t ticks)
+{
+    struct timespec deadline;
+    const struct timespec *pDeadline = hostDeadline(&deadline, ticks);
+    hostFrame_t frame = {.message = *message, .time_us = 0};
+    esp_err_t ret = ESP_OK;
+
+    if ((message->data_length_code > TWAI_FRAME_MAX_DLC) && !message->dlc_non_comp)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    hostKernelLock();
+    while (ret == ESP_OK)
+    {
+        if (!hostPortOnBus(port))
+        {
+            ret = ESP_ERR_INVALID_STATE;
+        }
+        else if (hostQueuePush(&port->txQueue, &frame))
+        {
+            port->status.msgs_to_tx = port->txQueue.count;
+            pthread_cond_broadcast(&busCond);
+            break;
+        }
+        else if ((ticks == 0U) || (hostWait(&port->txCond, pDeadline) == ETIMEDOUT))
+        {
+            ret = ESP_ERR_TIMEOUT;
+        }
+    }
+    hostKernelUnlock();
+    return ret;
+}
+
+static esp_err_t hostPortReceive(hostPort_t *port, twai_message_t *message, int64_t *time_us, TickType_t ticks)
+{
+    struct timespec deadline;
+    const struct timespec *pDeadline = hostDeadline(&deadline, ticks);
+    hostFrame_t frame;
+
+    hostKernelLock();
+    while (!hostQueuePop(&port->rxQueue, &frame))
+    {
+        if ((ticks == 0U) || (hostWait(&port->rxCond, pDeadline) == ETIMEDOUT))
+        {
+            hostKernelUnlock();
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+    port->status.msgs_to_rx = port->rxQueue.count;
+    hostKernelUnlock();
+    *message = frame.message;
+    if (time_us != NULL)
+    {
+        *time_us = frame.time_us;
+    }
+    return ESP_OK;
+}
+
+esp_err_t hostNodeSend(hostPort_t *node, const twai_message_t *message, uint32_t timeout_ms)
+{
+    return hostPortTransmit(node, message, pdMS_TO_TICKS(timeout_ms));
+}
+
+esp_err_t hostNodeReceive(hostPort_t *node, twai_message_t *message, int64_t *time_us, uint32_t timeout_ms)
+{
+    return hostPortReceive(node, message, time_us, pdMS_TO_TICKS(timeout_ms));
+}
+
+hostPort_t *hostController(int controllerId)
+{
+    hostPort_t *port;
+    hostPort_t *found = NULL;
+
+    hostKernelLock();
+    for (port = &ports[0]; port < &ports[HOST_PORTS]; port++)
+    {
+        if (port->used && port->controller && (port->controllerId == controllerId))
+        {
+            found = port;
+        }
+    }
+    hostKernelUnlock();
+    return found;
+}
+
+uint32_t hostPortBitRate(const hostPort_t *port)
+{
+    return port->bitRate;
+}
+
+void hostPortFilter(const hostPort_t *port, twai_filter_config_t *filter)
+{
+    hostKernelLock();
+    *filter = port->filter;
+    hostKernelUnlock();
+}
+
+uint32_t hostInstallCount(void)
+{
+    uint32_t count;
+
+    hostKernelLock();
+    count = installCount;
+    hostKernelUnlock();
+    return count;
+}
+
+void hostPortBusOff(hostPort_t *port)
+{
+    hostFrame_t frame;
+    uint32_t alerts = TWAI_ALERT_BUS_OFF;
+
+    hostKernelLock();
+    if (port->state == TWAI_STATE_RUNNING)
+    {
+        if (port->status.tx_error_counter < 96U)
+        {
+            alerts |= TWAI_ALERT_ABOVE_ERR_WARN;
+        }
+        if (port->status.tx_error_counter < 128U)
+        {
+            alerts |= TWAI_ALERT_ERR_PASS;
+        }
+        while (hostQueuePop(&port->txQueue, &frame))
+        {
+            port->status.tx_failed_count++;
+        }
+        port->status.msgs_to_tx = 0U;
+        port->status.tx_error_counter = 128U;
+        port->state = TWAI_STATE_BUS_OFF;
+        hostAlert(port, alerts);
+        pthread_cond_broadcast(&port->txCond);
+    }
+    hostKernelUnlock();
+}
+
+void hostPortSetRecoveryTime(uint32_t time_us)
+{
+    hostKernelLock();
+    recoveryMin_us = time_us;
+    hostKernelUnlock();
+}
+
+void hostPortSetErrorCounters(hostPort_t *port, uint32_t txErrors, uint32_t rxErrors)
+{
+    uint32_t before, after;
+    uint32_t alerts = 0U;
+
+    hostKernelLock();
+    before = (port->status.tx_error_counter > port->status.rx_error_counter) ? port->status.tx_error_counter
+                                                                             : port->status.rx_error_counter;
+    after = (txErrors > rxErrors) ? txErrors : rxErrors;
+    if ((before < 96U) && (after >= 96U))
+    {
+        alerts |= TWAI_ALERT_ABOVE_ERR_WARN;
+    }
+    if ((before >= 96U) && (after < 96U))
+    {
+        alerts |= TWAI_ALERT_BELOW_ERR_WARN;
+    }
+    if ((before < 128U) && (after >= 128U))
+    {
+        alerts |= TWAI_ALERT_ERR_PASS;
+    }
+    if ((before >= 128U) && (after < 128U))
+    {
+        alerts |= TWAI_ALERT_ERR_ACTIVE;
+    }
+    port->status.tx_error_counter = txErrors;
+    port->status.rx_error_counter = rxErrors;
+    hostAlert(port, alerts);
+    hostKernelUnlock();
+}
+
+/******************************************************************************/
+esp_err_t twai_driver_install_v2(const twai_general_config_t *g_config,
+                                 const twai_timing_config_t *t_config,
+                                 const twai_filter_config_t *f_config,
+                                 twai_handle_t *ret_twai)
+{
+    hostPort_t *port;
+
+    if ((g_config == NULL) || (t_config == NULL) || (f_config == NULL) || (ret_twai == NULL) ||
+        (g_config->controller_id < 0) || (g_config->controller_id >= SOC_TWAI_CONTROLLER_NUM) ||
+        (t_config->quanta_resolution_hz == 0U))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_once(&busOnce, hostBusStart);
+    if (hostController(g_config->controller_id) != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    hostKernelLock();
+    /* one more frame waits in the controller */
+    port = hostPortOpen(true, g_config->controller_id, g_config->rx_queue_len, g_config->tx_queue_len + 1U);
+    if (port != NULL)
+    {
+        port->bitRate = t_config->quanta_resolution_hz / (1U + t_config->tseg_1 + t_config->tseg_2) / 1000U;
+        port->filter = *f_config;
+        port->alertsEnabled = g_config->alerts_enabled;
+        installCount++;
+    }
+    hostKernelUnlock();
+    *ret_twai = port;
+    return (port != NULL) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t twai_driver_uninstall_v2(twai_handle_t handle)
+{
+    esp_err_t ret = ESP_OK;
+
+    hostKernelLock();
+    if ((handle == NULL) || !handle->used)
+    {
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    else if ((handle->state != TWAI_STATE_STOPPED) && (handle->state != TWAI_STATE_BUS_OFF))
+    {
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    else
+    {
+        hostPortClose(handle);
+    }
+    hostKernelUnlock();
+    return ret;
+}
+
+esp_err_t twai_start_v2(twai_handle_t handle)
+{
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+
+    hostKernelLock();
+    if ((handle != NULL) && handle->used && (handle->state == TWAI_STATE_STOPPED))
+    {
+        /* TX and RX queues are reset */
+        handle->txQueue.count = 0U;
+        handle->rxQueue.count = 0U;
+        handle->status.msgs_to_tx = 0U;
+        handle->status.msgs_to_rx = 0U;
+        handle->state = TWAI_STATE_RUNNING;
+        pthread_cond_broadcast(&busCond);
+        ret = ESP_OK;
+    }
+    hostKernelUnlock();
+    return ret;
+}
+
+esp_err_t twai_stop_v2(twai_handle_t handle)
+{
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+
+    hostKernelLock();
+    if ((handle != NULL) && handle->used && (handle->state == TWAI_STATE_RUNNING))
+    {
+        handle->txQueue.count = 0U;
+        handle->status.msgs_to_tx = 0U;
+        handle->state = TWAI_STATE_STOPPED;
+        pthread_cond_broadcast(&handle->txCond);
+        ret = ESP_OK;
+    }
+    hostKernelUnlock();
+    return ret;
+}
+
+esp_err_t twai_transmit_v2(twai_handle_t handle, const twai_message_t *message, TickType_t ticks_to_wait)
+{
+    if ((handle == NULL) || (message == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return hostPortTransmit(handle, message, ticks_to_wait);
+}
+
+esp_err_t twai_receive_v2(twai_handle_t handle, twai_message_t *message, TickType_t ticks_to_wait)
+{
+    if ((handle == NULL) || (message == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return hostPortReceive(handle, message, NULL, ticks_to_wait);
+}
+
+esp_err_t twai_read_alerts_v2(twai_handle_t handle, uint32_t *alerts, TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    const struct timespec *pDeadline = hostDeadline(&deadline, ticks_to_wait);
+    esp_err_t ret = ESP_OK;
+
+    if ((handle == NULL) || (alerts == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    hostKernelLock();
+    while (handle->alertsPending == 0U)
+    {
+        if ((ticks_to_wait == 0U) || (hostWait(&handle->alertCond, pDeadline) == ETIMEDOUT))
+        {
+            ret = ESP_ERR_TIMEOUT;
+            break;
+        }
+    }
+    *alerts = handle->alertsPending;
+    handle->alertsPending = 0U;
+    hostKernelUnlock();
+    return ret;
+}
+
+esp_err_t twai_reconfigure_alerts_v2(twai_handle_t handle, uint32_t alerts_enabled, uint32_t *current_alerts)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    hostKernelLock();
+    handle->alertsEnabled = alerts_enabled;
+    if (current_alerts != NULL)
+    {
+        *current_alerts = handle->alertsPending;
+    }
+    handle->alertsPending = 0U;
+    hostKernelUnlock();
+    return ESP_OK;
+}
+
+esp_err_t twai_initiate_recovery_v2(twai_handle_t handle)
+{
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+
+    hostKernelLock();
+    if ((handle != NULL) && handle->used && (handle->state == TWAI_STATE_BUS_OFF))
+    {
+        /* 128 occurrences of 11 recessive bits */
+        uint32_t rate = hostPortRate(handle);
+        int64_t recovery_us = (rate != 0U) ? ((int64_t)128 * 11 * 1000 / rate) : 0;
+
+        if (recovery_us < recoveryMin_us)
+        {
+            recovery_us = recoveryMin_us;
+        }
+        handle->recovered_us = esp_timer_get_time() + recovery_us;
+        handle->state = TWAI_STATE_RECOVERING;
+        hostAlert(handle, TWAI_ALERT_RECOVERY_IN_PROGRESS);
+        pthread_cond_broadcast(&busCond);
+        ret = ESP_OK;
+    }
+    hostKernelUnlock();
+    return ret;
+}
+
+esp_err_t twai_get_status_info_v2(twai_handle_t handle, twai_status_info_t *status_info)
+{
+    if ((handle == NULL) || (status_info == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    hostKernelLock();
+    *status_info = handle->status;
+    status_info->state = handle->state;
+    hostKernelUnlock();
+    return ESP_OK;
+}
+
+esp_err_t twai_clear_transmit_queue_v2(twai_handle_t handle)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    hostKernelLock();
+    handle->txQueue.count = 0U;
+    handle->status.msgs_to_tx = 0U;
+    pthread_cond_broadcast(&handle->txCond);
+    hostKernelUnlock();
+    return ESP_OK;
+}
+
+esp_err_t twai_clear_receive_queue_v2(twai_handle_t handle)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    hostKernelLock();
+    handle->rxQueue.count = 0U;
+    handle->status.msgs_to_rx = 0U;
+    hostKernelUnlock();
+    return ESP_OK;
+}
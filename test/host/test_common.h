@@ -0,0 +1,72 @@
+/*
+ * Checks and helpers of host tests.
+ *
+ * @file        test_common.h
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+
+/* Stop the test with message, if cond is false */
+#define CHECK(cond)                                                               \
+    do                                                                            \
+    {                                                                             \
+        if (!(cond))                                                              \
+        {                                                                         \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                              \
+        }                                                                         \
+    } while (0)
+
+/* As CHECK, prints both values */
+#define CHECK_EQ(actual, expected)                                                  \
+    do                                                                              \
+    {                                                                               \
+        long long actual_ = (long long)(actual);                                    \
+        long long expected_ = (long long)(expected);                                \
+        if (actual_ != expected_)                                                   \
+        {                                                                           \
+            fprintf(stderr, "%s:%d: CHECK failed: %s == %s (%lld != %lld)\n",       \
+                    __FILE__, __LINE__, #actual, #expected, actual_, expected_);    \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+/* Poll cond every 100 us, returns its last value after timeout_ms */
+#define WAIT_FOR(cond, timeout_ms)                                           \
+    ({                                                                       \
+        int64_t end_us = hostTime_us() + (int64_t)(timeout_ms) * 1000;      \
+        bool done_;                                                          \
+        while (!(done_ = (cond)) && (hostTime_us() < end_us))                \
+        {                                                                    \
+            hostSleep_us(100);                                               \
+        }                                                                    \
+        done_;                                                               \
+    })
+
+#define TEST_PASS(name)                \
+    do                                 \
+    {                                  \
+        printf("%s: PASS\n", (name));  \
+        return 0;                      \
+    } while (0)
+
+#endif /* TEST_COMMON_H */
@@ -0,0 +1,152 @@
+/*
+ * Two CAN modules on separate controllers, one of them behind an application
+ * backend, exchange frames. Checks that the driver calls only the backend of
+ * its module, tasks run on the cores of CO_CANptrTWAI_t and frames pass
+ * unchanged between TX buffer and RX callback.
+ *
+ * @file        test_backend.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "301/CO_driver.h"
+#include "test_common.h"
+
+#define FRAMES 200U
+
+static CO_CANmodule_t CANmodule[2];
+static CO_CANrx_t rxArray[2][2];
+static CO_CANtx_t txArray[2][2];
+static uint32_t installs, transmits, receives;
+static uint32_t rxCount[2];
+static bool rxCorrupt;
+
+/* Backend of the application, counts calls and uses the TWAI controller */
+static esp_err_t countInstall(const twai_general_config_t *generalConfig,
+                              const twai_timing_config_t *timingConfig,
+                              const twai_filter_config_t *filterConfig,
+                              void **handle)
+{
+    __atomic_fetch_add(&installs, 1U, __ATOMIC_RELAXED);
+    return CO_CANbackendTWAI.install(generalConfig, timingConfig, filterConfig, handle);
+}
+
+static esp_err_t countTransmit(void *handle, const twai_message_t *message, TickType_t ticksToWait)
+{
+    __atomic_fetch_add(&transmits, 1U, __ATOMIC_RELAXED);
+    return CO_CANbackendTWAI.transmit(handle, message, ticksToWait);
+}
+
+static esp_err_t countReceive(void *handle, twai_message_t *message, TickType_t ticksToWait)
+{
+    esp_err_t ret = CO_CANbackendTWAI.receive(handle, message, ticksToWait);
+
+    if (ret == ESP_OK)
+    {
+        __atomic_fetch_add(&receives, 1U, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+
+static CO_CANbackend_t countBackend;
+
+static void rxCallback(void *object, void *message)
+{
+    uint32_t *count = (uint32_t *)object;
+    const uint8_t *data = CO_CANrxMsg_readData(message);
+    uint8_t i;
+
+    if (CO_CANrxMsg_readDLC(message) != 8U)
+    {
+        rxCorrupt = true;
+    }
+    for (i = 1U; i < 8U; i++)
+    {
+        rxCorrupt = rxCorrupt || (data[i] != (uint8_t)(data[0] + i));
+    }
+    __atomic_fetch_add(count, 1U, __ATOMIC_RELAXED);
+}
+
+static void sendFrames(CO_CANmodule_t *module, CO_CANtx_t *buffer, uint32_t count)
+{
+    uint32_t n;
+    uint8_t i;
+
+    for (n = 0U; n < count; n++)
+    {
+        for (i = 0U; i < 8U; i++)
+        {
+            buffer->data[i] = (uint8_t)(n + i);
+        }
+        while (CO_CANsend(module, buffer) != CO_ERROR_NO)
+        {
+            hostSleep_us(50);
+        }
+    }
+}
+
+int main(void)
+{
+    static const CO_CANptrTWAI_t CANptr[2] = {
+        {.backend = NULL, .controllerId = 0, .txGpio = 5, .rxGpio = 4, .rxTaskCore = 0, .txTaskCore = 0},
+        {.backend = &countBackend, .controllerId = 1, .txGpio = 6, .rxGpio = 7, .rxTaskCore = 1, .txTaskCore = tskNO_AFFINITY},
+    };
+    uint32_t i;
+
+    countBackend = CO_CANbackendTWAI;
+    countBackend.name = "count";
+    countBackend.install = countInstall;
+    countBackend.transmit = countTransmit;
+    countBackend.receive = countReceive;
+
+    for (i = 0U; i < 2U; i++)
+    {
+        CHECK_EQ(CO_CANmodule_init(&CANmodule[i], (void *)&CANptr[i], rxArray[i], 2, txArray[i], 2, 500), CO_ERROR_NO);
+        CHECK_EQ(CO_CANrxBufferInit(&CANmodule[i], 0, (i == 0U) ? 0x201 : 0x181, 0x7FF, false,
+                                    &rxCount[i], rxCallback), CO_ERROR_NO);
+        CHECK(CO_CANtxBufferInit(&CANmodule[i], 0, (i == 0U) ? 0x181 : 0x201, false, 8, false) != NULL);
+        CO_CANsetNormalMode(&CANmodule[i]);
+    }
+    CHECK(hostController(0) != NULL);
+    CHECK(hostController(1) != NULL);
+    CHECK_EQ(hostPortBitRate(hostController(1)), 500);
+    CHECK_EQ(installs, 1U);
+
+    /* Task affinity from CO_CANptrTWAI_t, alert task follows rx task */
+    CHECK_EQ(CANmodule[0].txTaskHandle->core, 0);
+    CHECK_EQ(CANmodule[1].rxTaskHandle->core, 1);
+    CHECK_EQ(CANmodule[1].txTaskHandle->core, tskNO_AFFINITY);
+#if CONFIG_CO_TWAI_ALERT_TASK
+    CHECK_EQ(CANmodule[1].alertTaskHandle->core, 1);
+#endif
+
+    /* TPDO of each module is RPDO of the other one, at bus speed */
+    hostBusSetRealTime(true);
+    sendFrames(&CANmodule[0], &txArray[0][0], FRAMES);
+    sendFrames(&CANmodule[1], &txArray[1][0], FRAMES);
+    CHECK(WAIT_FOR((rxCount[0] == FRAMES) && (rxCount[1] == FRAMES), 2000));
+    CHECK(!rxCorrupt);
+    CHECK_EQ(transmits, FRAMES);
+    CHECK_EQ(receives, FRAMES);
+
+    for (i = 0U; i < 2U; i++)
+    {
+        CO_CANmodule_disable(&CANmodule[i]);
+    }
+    CHECK(hostController(0) == NULL);
+    CHECK(hostController(1) == NULL);
+    TEST_PASS("test_backend");
+}
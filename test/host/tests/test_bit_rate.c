@@ -0,0 +1,91 @@
+/*
+ * Bit rate switch of LSS activate bit timing: transmission stops for the
+ * switch delay, the driver is reinstalled with the new timing, and frames sent
+ * meanwhile stay pending until transmission resumes after another delay.
+ *
+ * @file        test_bit_rate.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "301/CO_driver.h"
+#include "test_common.h"
+
+#define SWITCH_DELAY_MS 30
+/* Scheduling slack of the host */
+#define SLACK_MS 40
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[1];
+static CO_CANtx_t txArray[2];
+
+/* Main loop of the application */
+static bool process(void)
+{
+    CO_CANmodule_process(&CANmodule);
+    return false;
+}
+
+int main(void)
+{
+    hostPort_t *node = hostNodeOpen(8, 4);
+    twai_message_t msg;
+    uint32_t installs;
+    int64_t start_us, frame_us;
+
+    CHECK(node != NULL);
+    CHECK(CO_CANcheckBitRate(800));
+    CHECK(CO_CANcheckBitRate(1000));
+    CHECK(!CO_CANcheckBitRate(10));
+    CHECK(!CO_CANsetBitRate(&CANmodule, 250, SWITCH_DELAY_MS));
+
+    hostBusSetBitRate(1000);
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, 1, txArray, 2, 1000), CO_ERROR_NO);
+    CO_CANsetNormalMode(&CANmodule);
+    CHECK(CO_CANtxBufferInit(&CANmodule, 0, 0x581, false, 8, false) != NULL);
+    CHECK(CO_CANtxBufferInit(&CANmodule, 1, 0x181, false, 8, false) != NULL);
+    CHECK_EQ(CO_CANsend(&CANmodule, &txArray[0]), CO_ERROR_NO);
+    CHECK_EQ(hostNodeReceive(node, &msg, NULL, 1000), ESP_OK);
+    CHECK_EQ(hostPortBitRate(hostController(0)), 1000);
+
+    /* Switch, all nodes of the network change their bit rate */
+    installs = hostInstallCount();
+    CHECK(!CO_CANsetBitRate(&CANmodule, 10, SWITCH_DELAY_MS));
+    CHECK(CO_CANsetBitRate(&CANmodule, 250, SWITCH_DELAY_MS));
+    start_us = hostTime_us();
+    hostBusSetBitRate(250);
+    CHECK_EQ(CO_CANsend(&CANmodule, &txArray[0]), CO_ERROR_NO);
+    CHECK_EQ(CO_CANsend(&CANmodule, &txArray[1]), CO_ERROR_NO);
+
+    /* Nothing is sent until the switch is complete */
+    CHECK(!WAIT_FOR(process() || (hostNodeReceive(node, &msg, NULL, 0) == ESP_OK), SWITCH_DELAY_MS));
+    CHECK(WAIT_FOR(process() || (hostPortBitRate(hostController(0)) == 250), SLACK_MS));
+    CHECK_EQ(hostInstallCount(), installs + 1U);
+    CHECK(!WAIT_FOR(process() || (hostNodeReceive(node, &msg, NULL, 0) == ESP_OK),
+                    SWITCH_DELAY_MS - 5));
+    CHECK(WAIT_FOR(process() || (hostNodeReceive(node, &msg, &frame_us, 0) == ESP_OK), SLACK_MS));
+    CHECK(frame_us - start_us >= 2 * SWITCH_DELAY_MS * 1000);
+    CHECK(frame_us - start_us <= (2 * SWITCH_DELAY_MS + SLACK_MS) * 1000);
+
+    /* Pending frames go out at the new bit rate, lowest identifier first */
+    CHECK_EQ(msg.identifier, 0x181);
+    CHECK_EQ(hostNodeReceive(node, &msg, NULL, 100), ESP_OK);
+    CHECK_EQ(msg.identifier, 0x581);
+    CHECK_EQ(__atomic_load_n(&CANmodule.CANtxCount, __ATOMIC_RELAXED), 0U);
+
+    CO_CANmodule_disable(&CANmodule);
+    hostNodeClose(node);
+    TEST_PASS("test_bit_rate");
+}
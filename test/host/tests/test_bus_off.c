@@ -0,0 +1,117 @@
+/*
+ * Bus-off recovery waits the back-off time, doubles it for bus-off soon after
+ * recovery up to CONFIG_CO_BUS_OFF_BACKOFF_MAX_MS and restarts from
+ * CONFIG_CO_BUS_OFF_BACKOFF_MS after a quiet period. Built with CO_alertTask
+ * and with polling from CO_CANmodule_process().
+ *
+ * @file        test_bus_off.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "301/CO_driver.h"
+#include "test_common.h"
+
+/* Scheduling slack of the host on top of back-off and recovery time */
+#define SLACK_MS 40
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[1];
+static CO_CANtx_t txArray[1];
+
+/* Without CO_alertTask, the application calls CO_CANmodule_process() */
+static void process(void)
+{
+#if !CONFIG_CO_TWAI_ALERT_TASK
+    CO_CANmodule_process(&CANmodule);
+#endif
+}
+
+static bool busOffFlag(void)
+{
+    process();
+    return (CANmodule.CANerrorStatus & CO_CAN_ERRTX_BUS_OFF) != 0U;
+}
+
+static bool running(void)
+{
+    twai_status_info_t status;
+
+    process();
+    CHECK_EQ(twai_get_status_info_v2(hostController(0), &status), ESP_OK);
+    return (status.state == TWAI_STATE_RUNNING) && ((CANmodule.CANerrorStatus & CO_CAN_ERRTX_BUS_OFF) == 0U);
+}
+
+/* Bus-off, checks the controller runs again after back-off and recovery */
+static void busOff(uint32_t backoff_ms, uint32_t recovery_ms)
+{
+    int64_t start_us = hostTime_us();
+    int64_t time_us;
+
+    hostPortBusOff(hostController(0));
+    CHECK(WAIT_FOR(busOffFlag(), SLACK_MS));
+    CHECK(WAIT_FOR(running(), backoff_ms + recovery_ms + SLACK_MS));
+    time_us = hostTime_us() - start_us;
+    CHECK_EQ(CANmodule.busOffDelay_ms, backoff_ms);
+    if ((time_us < (int64_t)(backoff_ms + recovery_ms) * 1000) ||
+        (time_us > (int64_t)(backoff_ms + recovery_ms + SLACK_MS) * 1000))
+    {
+        fprintf(stderr, "back-off %lu ms, recovered after %lld us\n", (unsigned long)backoff_ms, (long long)time_us);
+        exit(1);
+    }
+}
+
+int main(void)
+{
+    hostPort_t *node = hostNodeOpen(8, 4);
+    twai_message_t msg;
+    CO_CANtx_t *buffer;
+
+    CHECK(node != NULL);
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, 1, txArray, 1, 1000), CO_ERROR_NO);
+    CO_CANsetNormalMode(&CANmodule);
+    buffer = CO_CANtxBufferInit(&CANmodule, 0, 0x701, false, 1, false);
+    CHECK(buffer != NULL);
+
+    /* First bus-off waits the initial back-off */
+    busOff(CONFIG_CO_BUS_OFF_BACKOFF_MS, 0);
+    CHECK_EQ(CO_CANsend(&CANmodule, buffer), CO_ERROR_NO);
+    CHECK_EQ(hostNodeReceive(node, &msg, NULL, 1000), ESP_OK);
+    CHECK_EQ(msg.identifier, 0x701);
+
+    /* Repeated bus-off doubles the back-off up to the maximum */
+    busOff(CONFIG_CO_BUS_OFF_BACKOFF_MS * 2, 0);
+    busOff(CONFIG_CO_BUS_OFF_BACKOFF_MS * 4, 0);
+    busOff(CONFIG_CO_BUS_OFF_BACKOFF_MAX_MS, 0);
+    busOff(CONFIG_CO_BUS_OFF_BACKOFF_MAX_MS, 0);
+
+    /* Quiet period longer than the maximum restarts with initial back-off */
+    CHECK(!WAIT_FOR(!running(), CONFIG_CO_BUS_OFF_BACKOFF_MAX_MS + 20));
+    busOff(CONFIG_CO_BUS_OFF_BACKOFF_MS, 0);
+
+    /* Controller is started only after the recovery sequence */
+    hostPortSetRecoveryTime(30000);
+    CHECK(!WAIT_FOR(!running(), CONFIG_CO_BUS_OFF_BACKOFF_MAX_MS + 20));
+    busOff(CONFIG_CO_BUS_OFF_BACKOFF_MS, 30);
+    hostPortSetRecoveryTime(0);
+
+    CHECK_EQ(CO_CANsend(&CANmodule, buffer), CO_ERROR_NO);
+    CHECK_EQ(hostNodeReceive(node, &msg, NULL, 1000), ESP_OK);
+    CHECK_EQ(msg.identifier, 0x701);
+
+    CO_CANmodule_disable(&CANmodule);
+    hostNodeClose(node);
+    TEST_PASS("test_bus_off");
+}
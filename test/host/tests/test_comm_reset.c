@@ -0,0 +1,112 @@
+/*
+ * Communication resets with a new node-ID, as after LSS configuration, with
+ * CONFIG_CO_TWAI_HW_FILTER. Each reset stops and resumes the driver tasks in
+ * CO_CANmodule_init() and stops them again right away for the reinstall with
+ * the new acceptance filter. Stops must neither hang nor wait for the receive
+ * timeout of the tasks. A buffer configured in normal mode, as an RPDO with
+ * COB-ID written by SDO, receives after the next CO_CANmodule_process().
+ *
+ * @file        test_comm_reset.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "301/CO_driver.h"
+#include "test_common.h"
+
+#define RESETS 200U
+/* Communication reset with two task stops, scheduling slack of the host */
+#define RESET_MAX_MS 30
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[5];
+static CO_CANtx_t txArray[1];
+static volatile uint32_t rxFrames;
+
+static void rxCallback(void *object, void *message)
+{
+    (void)object;
+    (void)message;
+    __atomic_fetch_add(&rxFrames, 1U, __ATOMIC_RELAXED);
+}
+
+/* CO_CANinit(), buffers of CO_CANopenInit() and CO_CANsetNormalMode() */
+static void commReset(uint8_t nodeId)
+{
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, 5, txArray, 1, 1000), CO_ERROR_NO);
+    CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 0, 0x000, 0x7FF, false, &CANmodule, rxCallback), CO_ERROR_NO);
+    CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 1, 0x080, 0x7FF, false, &CANmodule, rxCallback), CO_ERROR_NO);
+    CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 2, 0x200 + nodeId, 0x7FF, false, &CANmodule, rxCallback), CO_ERROR_NO);
+    CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 3, 0x600 + nodeId, 0x7FF, false, &CANmodule, rxCallback), CO_ERROR_NO);
+    CO_CANsetNormalMode(&CANmodule);
+}
+
+int main(void)
+{
+    hostPort_t *node = hostNodeOpen(8, 8);
+    uint32_t installs = hostInstallCount();
+    int64_t slowest_us = 0;
+    uint32_t n;
+
+    CHECK(node != NULL);
+    for (n = 0U; n < RESETS; n++)
+    {
+        uint8_t nodeId = (uint8_t)(1U + (n % 127U));
+        twai_message_t msg = {.identifier = 0x600U + nodeId, .data_length_code = 8};
+        uint32_t frames = rxFrames;
+        int64_t start_us = hostTime_us();
+        int64_t time_us;
+
+        commReset(nodeId);
+        time_us = hostTime_us() - start_us;
+        if (time_us > slowest_us)
+        {
+            slowest_us = time_us;
+        }
+
+        /* New node-ID passes the acceptance filter */
+        CHECK_EQ(hostNodeSend(node, &msg, 100), ESP_OK);
+        CHECK(WAIT_FOR(rxFrames == frames + 1U, 1000));
+    }
+    CHECK_EQ(hostInstallCount(), installs + RESETS);
+    if (slowest_us > RESET_MAX_MS * 1000)
+    {
+        fprintf(stderr, "communication reset took %lld us\n", (long long)slowest_us);
+        exit(1);
+    }
+
+    /* RPDO enabled in normal mode, identifier is rejected by installed filter */
+    {
+        twai_message_t msg = {.identifier = 0x3A5U, .data_length_code = 8};
+        uint32_t frames = rxFrames;
+
+        CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 4, 0x3A5, 0x7FF, false, &CANmodule, rxCallback), CO_ERROR_NO);
+        CHECK_EQ(hostNodeSend(node, &msg, 100), ESP_OK);
+        CHECK(!WAIT_FOR(rxFrames != frames, 50));
+        CO_CANmodule_process(&CANmodule);
+        CHECK_EQ(hostInstallCount(), installs + RESETS + 1U);
+        CHECK_EQ(hostNodeSend(node, &msg, 100), ESP_OK);
+        CHECK(WAIT_FOR(rxFrames == frames + 1U, 1000));
+
+        /* Buffer within the new filter needs no reinstall */
+        CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 4, 0x3A5, 0x7FF, false, &CANmodule, rxCallback), CO_ERROR_NO);
+        CO_CANmodule_process(&CANmodule);
+        CHECK_EQ(hostInstallCount(), installs + RESETS + 1U);
+    }
+
+    CO_CANmodule_disable(&CANmodule);
+    hostNodeClose(node);
+    TEST_PASS("test_comm_reset");
+}
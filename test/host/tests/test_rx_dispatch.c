@@ -0,0 +1,153 @@
+/*
+ * Received frames reach the same rxArray buffer as the linear search of
+ * CANopenNode finds, with and without CONFIG_CO_RX_DISPATCH_TABLE, for every
+ * 11-bit identifier, overlapping masks and reconfigured buffers.
+ *
+ * @file        test_rx_dispatch.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "301/CO_driver.h"
+#include "test_common.h"
+
+#define RX_SMALL 24U
+#define RX_LARGE 300U /* above CO_CAN_RX_DISPATCH_NONE, always linear */
+/* Frames sent before waiting for CO_rxTask, below TWAI rx_queue_len */
+#define CHUNK 4U
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[RX_LARGE];
+static CO_CANtx_t txArray[1];
+static int objects[RX_LARGE];
+static volatile int hits[0x800];     /* rxArray index + 1 of last callback */
+static volatile uint32_t callbacks;
+static hostPort_t *node;
+
+static void rxCallback(void *object, void *message)
+{
+    uint16_t ident = CO_CANrxMsg_readIdent(message);
+
+    hits[ident] = *(int *)object + 1;
+    __atomic_fetch_add(&callbacks, 1U, __ATOMIC_RELAXED);
+}
+
+static void rxInit(uint16_t index, uint16_t ident, uint16_t mask, bool_t rtr)
+{
+    CHECK_EQ(CO_CANrxBufferInit(&CANmodule, index, ident, mask, rtr, &objects[index], rxCallback), CO_ERROR_NO);
+}
+
+/* Linear search of CANopenNode over configured buffers, 0 if none matches */
+static int reference(uint16_t ident, uint16_t rxSize)
+{
+    uint16_t i;
+
+    for (i = 0U; i < rxSize; i++)
+    {
+        if ((rxArray[i].CANrx_callback != NULL) && (((ident ^ rxArray[i].ident) & rxArray[i].mask) == 0U))
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t rxFrames(void)
+{
+    CO_CANstats_t stats;
+
+    CO_CANmodule_getStats(&CANmodule, &stats, false);
+    return stats.rxFrames;
+}
+
+/* Send every identifier, compare receiving buffer with reference */
+static void checkAllIdents(uint16_t rxSize, const char *phase)
+{
+    uint32_t framesBefore = rxFrames();
+    uint32_t sent = 0U;
+    uint16_t ident;
+
+    for (ident = 0U; ident < 0x800U; ident++)
+    {
+        twai_message_t msg = {.identifier = ident, .data_length_code = 1, .data = {(uint8_t)ident}};
+
+        hits[ident] = 0;
+        CHECK_EQ(hostNodeSend(node, &msg, 1000), ESP_OK);
+        sent++;
+        if ((sent % CHUNK) == 0U)
+        {
+            CHECK(WAIT_FOR((rxFrames() - framesBefore) == sent, 2000));
+        }
+    }
+    CHECK(WAIT_FOR((rxFrames() - framesBefore) == sent, 2000));
+    for (ident = 0U; ident < 0x800U; ident++)
+    {
+        if (hits[ident] != reference(ident, rxSize))
+        {
+            fprintf(stderr, "%s: ident 0x%03x dispatched to %d, linear search finds %d\n",
+                    phase, ident, hits[ident] - 1, reference(ident, rxSize) - 1);
+            exit(1);
+        }
+    }
+}
+
+int main(void)
+{
+    uint16_t i;
+
+    for (i = 0U; i < RX_LARGE; i++)
+    {
+        objects[i] = i;
+    }
+    node = hostNodeOpen(16, 16);
+    CHECK(node != NULL);
+
+    /* CANopen slave with overlapping buffers */
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, RX_SMALL, txArray, 1, 1000), CO_ERROR_NO);
+    rxInit(0, 0x000, 0x7FF, false);  /* NMT */
+    rxInit(1, 0x080, 0x7FF, false);  /* SYNC */
+    rxInit(2, 0x080, 0x780, false);  /* EMCY consumer, SYNC is found first */
+    rxInit(3, 0x100, 0x7FF, false);  /* TIME */
+    rxInit(4, 0x205, 0x7FF, false);  /* RPDO */
+    rxInit(5, 0x305, 0x7FF, false);
+    rxInit(6, 0x405, 0x7FF, false);
+    rxInit(7, 0x505, 0x7FF, false);
+    rxInit(8, 0x605, 0x7FF, false);  /* SDO server */
+    rxInit(9, 0x700, 0x780, false);  /* all heartbeats */
+    rxInit(10, 0x705, 0x7FF, false); /* hidden by buffer 9 */
+    rxInit(11, 0x185, 0x7FF, true);  /* RTR never matches a received identifier */
+    rxInit(12, 0x7E5, 0x7FF, false); /* LSS */
+    CO_CANsetNormalMode(&CANmodule);
+    checkAllIdents(RX_SMALL, "initial");
+
+    /* Reconfigured buffers release their old identifiers */
+    rxInit(9, 0x701, 0x7FF, false);
+    rxInit(13, 0x000, 0x000, false); /* catch the rest */
+    rxInit(4, 0x7E4, 0x7FF, false);
+    checkAllIdents(RX_SMALL, "reconfigured");
+
+    /* Communication reset with rxArray above the dispatch table limit */
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, RX_LARGE, txArray, 1, 1000), CO_ERROR_NO);
+    rxInit(5, 0x123, 0x7FF, false);
+    rxInit(280, 0x123, 0x7FF, false);
+    rxInit(290, 0x400, 0x700, false);
+    CO_CANsetNormalMode(&CANmodule);
+    checkAllIdents(RX_LARGE, "large");
+
+    CO_CANmodule_disable(&CANmodule);
+    hostNodeClose(node);
+    TEST_PASS("test_rx_dispatch");
+}
@@ -0,0 +1,117 @@
+/*
+ * CO_CANmodule_getStats() with reset, called in a loop from another thread
+ * while CO_rxTask and CO_txTask count frames. Summed over all calls, no
+ * frame is lost or counted twice.
+ *
+ * @file        test_stats.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include "301/CO_driver.h"
+#include "test_common.h"
+
+#define RX_FRAMES 100000U
+#define TX_FRAMES 100000U
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[1];
+static CO_CANtx_t txArray[1];
+static uint32_t rxCallbacks;
+static volatile bool running = true;
+static uint64_t rxTotal, txTotal, resets;
+
+static void rxCallback(void *object, void *message)
+{
+    (void)object;
+    (void)message;
+    __atomic_fetch_add(&rxCallbacks, 1U, __ATOMIC_RELAXED);
+}
+
+/* Reads and resets statistics as fast as possible */
+static void *reader(void *arg)
+{
+    CO_CANstats_t stats;
+
+    (void)arg;
+    while (running)
+    {
+        CO_CANmodule_getStats(&CANmodule, &stats, true);
+        rxTotal += stats.rxFrames;
+        txTotal += stats.txFrames;
+        resets++;
+    }
+    CO_CANmodule_getStats(&CANmodule, &stats, true);
+    rxTotal += stats.rxFrames;
+    txTotal += stats.txFrames;
+    return NULL;
+}
+
+static void *sender(void *arg)
+{
+    uint32_t n;
+
+    (void)arg;
+    for (n = 0U; n < TX_FRAMES; n++)
+    {
+        while (CO_CANsend(&CANmodule, &txArray[0]) != CO_ERROR_NO)
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    hostPort_t *node = hostNodeOpen(1, 4);
+    twai_message_t msg = {.identifier = 0x201, .data_length_code = 8};
+    pthread_t readerThread, senderThread;
+    uint32_t n;
+
+    CHECK(node != NULL);
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, 1, txArray, 1, 1000), CO_ERROR_NO);
+    CHECK_EQ(CO_CANrxBufferInit(&CANmodule, 0, 0x201, 0x7FF, false, &CANmodule, rxCallback), CO_ERROR_NO);
+    CHECK(CO_CANtxBufferInit(&CANmodule, 0, 0x181, false, 8, false) != NULL);
+    CO_CANsetNormalMode(&CANmodule);
+
+    CHECK_EQ(pthread_create(&readerThread, NULL, reader, NULL), 0);
+    CHECK_EQ(pthread_create(&senderThread, NULL, sender, NULL), 0);
+    for (n = 0U; n < RX_FRAMES; n++)
+    {
+        CHECK_EQ(hostNodeSend(node, &msg, 100), ESP_OK);
+        /* don't overrun TWAI receive queue */
+        if ((n % 4U) == 3U)
+        {
+            CHECK(WAIT_FOR(__atomic_load_n(&rxCallbacks, __ATOMIC_RELAXED) == (n + 1U), 1000));
+        }
+    }
+    pthread_join(senderThread, NULL);
+    CHECK(WAIT_FOR(__atomic_load_n(&rxCallbacks, __ATOMIC_RELAXED) == RX_FRAMES, 1000));
+    CHECK(WAIT_FOR(!txArray[0].bufferFull, 1000));
+    CHECK(hostBusWaitIdle(1000));
+    running = false;
+    pthread_join(readerThread, NULL);
+
+    CHECK(resets > 1000U);
+    CHECK_EQ(rxTotal, RX_FRAMES);
+    CHECK_EQ(txTotal, TX_FRAMES);
+
+    CO_CANmodule_disable(&CANmodule);
+    hostNodeClose(node);
+    TEST_PASS("test_stats");
+}
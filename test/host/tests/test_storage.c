@@ -0,0 +1,146 @@
+/*
+ * CO_storageNVS on the simulated NVS flash: store command, auto storage of
+ * changed entries only, restore at init and after garbage collection of
+ * flash pages, restore defaults, LSS configuration and entry size checks.
+ *
+ * @file        test_storage.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "CO_storageNVS.h"
+#include "test_common.h"
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[1];
+static CO_CANtx_t txArray[1];
+static CO_storage_t storage;
+static uint8_t cmdData[16];
+static uint8_t autoData[100];
+static CO_storage_entry_t entries[] = {
+    {.addr = cmdData, .len = sizeof(cmdData), .subIndexOD = 2, .attr = CO_storage_cmd | CO_storage_restore},
+    {.addr = autoData, .len = sizeof(autoData), .subIndexOD = 3, .attr = CO_storage_auto | CO_storage_restore},
+};
+
+static CO_ReturnError_t storageInit(uint32_t *storageInitError)
+{
+    return CO_storageNVS_init(&storage, &CANmodule, NULL, NULL, entries, 2, storageInitError);
+}
+
+/* Bytes programmed since last call */
+static uint64_t programmed(void)
+{
+    hostFlashStats_t stats;
+
+    hostFlashStats(&stats, true);
+    return stats.bytesProgrammed;
+}
+
+int main(void)
+{
+    static uint8_t large[CONFIG_CO_STORAGE_BUFFER_SIZE + 1];
+    CO_storage_entry_t largeEntry = {.addr = large, .len = sizeof(large), .subIndexOD = 4, .attr = CO_storage_cmd};
+    uint32_t storageInitError = 0xFFFFFFFFU;
+    hostFlashStats_t stats;
+    uint8_t nodeId = 0;
+    uint16_t bitRate = 0;
+    uint32_t i;
+
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, 1, txArray, 1, 1000), CO_ERROR_NO);
+    hostFlashFormat(4);
+
+    /* Empty flash keeps defaults */
+    memset(cmdData, 0x11, sizeof(cmdData));
+    memset(autoData, 0x22, sizeof(autoData));
+    CHECK_EQ(storageInit(&storageInitError), CO_ERROR_NO);
+    CHECK_EQ(storageInitError, 0U);
+    CHECK_EQ(cmdData[0], 0x11);
+    CHECK(!CO_storageNVS_readLSS(&nodeId, &bitRate));
+
+    /* Store command writes once, unchanged data is not written */
+    cmdData[0] = 0x33;
+    (void)programmed();
+    CHECK_EQ(storage.store(&entries[0], &CANmodule), ODR_OK);
+    CHECK(programmed() >= sizeof(cmdData));
+    CHECK_EQ(storage.store(&entries[0], &CANmodule), ODR_OK);
+    CHECK_EQ(programmed(), 0U);
+
+    /* Auto storage writes only changed entries with CO_storage_auto */
+    cmdData[1] = 0x44;
+    CHECK_EQ(CO_storageNVS_autoProcess(&storage), 0U);
+    CHECK(programmed() >= sizeof(autoData));
+    CHECK_EQ(CO_storageNVS_autoProcess(&storage), 0U);
+    CHECK_EQ(programmed(), 0U);
+    autoData[99] = 0x55;
+    CHECK_EQ(CO_storageNVS_autoProcess(&storage), 0U);
+    CHECK(programmed() >= sizeof(autoData));
+
+    /* Stored data is restored after reset */
+    memset(cmdData, 0, sizeof(cmdData));
+    memset(autoData, 0, sizeof(autoData));
+    hostFlashReboot();
+    CHECK_EQ(storageInit(&storageInitError), CO_ERROR_NO);
+    CHECK_EQ(cmdData[0], 0x33);
+    CHECK_EQ(cmdData[1], 0x11);
+    CHECK_EQ(autoData[0], 0x22);
+    CHECK_EQ(autoData[99], 0x55);
+    CHECK(entries[0].stored && entries[1].stored);
+
+    /* Pages are erased and reused, data survives garbage collection */
+    for (i = 0U; i < 2000U; i++)
+    {
+        autoData[i % sizeof(autoData)] = (uint8_t)i;
+        CHECK_EQ(CO_storageNVS_autoProcess(&storage), 0U);
+    }
+    CHECK(CO_storageNVS_writeLSS(0x22, 250));
+    hostFlashStats(&stats, true);
+    CHECK(stats.erases > 10U);
+    memset(autoData, 0, sizeof(autoData));
+    hostFlashReboot();
+    CHECK_EQ(storageInit(&storageInitError), CO_ERROR_NO);
+    CHECK_EQ(autoData[1999U % sizeof(autoData)], (uint8_t)1999U);
+    CHECK_EQ(autoData[1998U % sizeof(autoData)], (uint8_t)1998U);
+    CHECK_EQ(cmdData[0], 0x33);
+    CHECK(CO_storageNVS_readLSS(&nodeId, &bitRate));
+    CHECK_EQ(nodeId, 0x22);
+    CHECK_EQ(bitRate, 250);
+
+    /* Restore defaults erases stored data, defaults are used after reset */
+    CHECK_EQ(storage.restore(&entries[0], &CANmodule), ODR_OK);
+    CHECK(!entries[0].stored);
+    memset(cmdData, 0x11, sizeof(cmdData));
+    hostFlashReboot();
+    CHECK_EQ(storageInit(&storageInitError), CO_ERROR_NO);
+    CHECK_EQ(cmdData[0], 0x11);
+    CHECK(!entries[0].stored);
+
+    /* Stored data of other length is not used */
+    entries[1].len = 50;
+    memset(autoData, 0x66, sizeof(autoData));
+    hostFlashReboot();
+    CHECK_EQ(storageInit(&storageInitError), CO_ERROR_DATA_CORRUPT);
+    CHECK_EQ(storageInitError, 1U << 3);
+    CHECK_EQ(autoData[0], 0x66);
+    entries[1].len = sizeof(autoData);
+
+    /* Entry must fit into the static buffer */
+    hostFlashReboot();
+    CHECK_EQ(CO_storageNVS_init(&storage, &CANmodule, NULL, NULL, &largeEntry, 1, &storageInitError),
+             CO_ERROR_ILLEGAL_ARGUMENT);
+
+    CO_CANmodule_disable(&CANmodule);
+    TEST_PASS("test_storage");
+}
@@ -0,0 +1,163 @@
+/*
+ * CO_traceDump() prints each complete record once, relative to the free
+ * running head, while writers on other threads continue. Overwritten and
+ * incomplete records are skipped and counted as lost.
+ *
+ * @file        test_trace.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "CO_trace.h"
+#include "test_common.h"
+
+#define WRITERS 4U
+#define WRITES 200000U
+#define SIZE CONFIG_CO_TRACE_BUFFER_SIZE
+
+/* Result of one or more dumps */
+typedef struct
+{
+    uint32_t records;
+    uint32_t lost;
+    uint32_t firstArg;
+    uint32_t lastArg;
+} dump_t;
+
+static uint32_t lastCounter[WRITERS];
+static bool seen[WRITERS];
+
+/* Dump into a temporary file and check every line: event is the writer,
+ * counters of a writer only increase, also across dumps */
+static void dump(dump_t *result)
+{
+    FILE *file = tmpfile();
+    char line[128];
+    int saved;
+
+    CHECK(file != NULL);
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    dup2(fileno(file), STDOUT_FILENO);
+    CO_traceDump();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    rewind(file);
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned long time_us, arg, lost;
+        unsigned event, core;
+
+        if (sscanf(line, "CO_TRACE,%lu,%u,%u,%lu", &time_us, &event, &core, &arg) == 4)
+        {
+            uint32_t writer = (uint32_t)arg >> 24;
+            uint32_t counter = (uint32_t)arg & 0xFFFFFFU;
+
+            CHECK_EQ(event, writer);
+            CHECK(writer < WRITERS);
+            CHECK(!seen[writer] || (counter > lastCounter[writer]));
+            seen[writer] = true;
+            lastCounter[writer] = counter;
+            if (result->records == 0U)
+            {
+                result->firstArg = (uint32_t)arg;
+            }
+            result->lastArg = (uint32_t)arg;
+            result->records++;
+        }
+        else if (sscanf(line, "CO_TRACE_LOST,%lu", &lost) == 1)
+        {
+            result->lost += (uint32_t)lost;
+        }
+        else
+        {
+            fprintf(stderr, "unexpected line: %s", line);
+            exit(1);
+        }
+    }
+    fclose(file);
+}
+
+static void *writer(void *arg)
+{
+    uint32_t id = (uint32_t)(uintptr_t)arg;
+    uint32_t n;
+
+    for (n = 0U; n < WRITES; n++)
+    {
+        CO_trace((CO_trace_event_t)id, (id << 24) | n);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t threads[WRITERS];
+    dump_t total = {0};
+    dump_t d;
+    uint32_t i;
+
+    /* Records since last dump, oldest first */
+    for (i = 0U; i < 10U; i++)
+    {
+        CO_trace((CO_trace_event_t)0, i);
+    }
+    memset(&d, 0, sizeof(d));
+    dump(&d);
+    CHECK_EQ(d.records, 10U);
+    CHECK_EQ(d.lost, 0U);
+    CHECK_EQ(d.firstArg, 0U);
+    CHECK_EQ(d.lastArg, 9U);
+    memset(&d, 0, sizeof(d));
+    dump(&d);
+    CHECK_EQ(d.records, 0U);
+
+    /* Buffer overrun keeps the newest records */
+    for (i = 10U; i < (10U + SIZE + 5U); i++)
+    {
+        CO_trace((CO_trace_event_t)0, i);
+    }
+    memset(&d, 0, sizeof(d));
+    dump(&d);
+    CHECK_EQ(d.records, SIZE);
+    CHECK_EQ(d.lost, 5U);
+    CHECK_EQ(d.firstArg, 15U);
+    CHECK_EQ(d.lastArg, 10U + SIZE + 4U);
+
+    /* Dumps while writers run, every record is printed once or lost */
+    memset(seen, 0, sizeof(seen));
+    for (i = 0U; i < WRITERS; i++)
+    {
+        CHECK_EQ(pthread_create(&threads[i], NULL, writer, (void *)(uintptr_t)i), 0);
+    }
+    for (i = 0U; i < 200U; i++)
+    {
+        dump(&total);
+    }
+    for (i = 0U; i < WRITERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    dump(&total);
+    CHECK_EQ(total.records + total.lost, WRITERS * WRITES);
+    CHECK(total.records > 0U);
+
+    TEST_PASS("test_trace");
+}
@@ -0,0 +1,172 @@
+/*
+ * TX buffers wait in the pending bitmap while the TWAI queue is full and go
+ * out lowest identifier first. Overflow, CO_CANclearPendingSyncPDOs() and the
+ * CANtxCount bookkeeping are checked on a held bus.
+ *
+ * @file        test_tx_pending.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "301/CO_driver.h"
+#include "test_common.h"
+
+/* TWAI transmit queue, one frame in the controller and one in CO_txTask */
+#define IN_FLIGHT (CONFIG_CO_TWAI_TX_QUEUE_LEN + 2U)
+#define TX_SIZE 24U
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[1];
+static CO_CANtx_t txArray[TX_SIZE];
+
+static uint16_t txCount(void)
+{
+    return __atomic_load_n(&CANmodule.CANtxCount, __ATOMIC_RELAXED);
+}
+
+static uint32_t twaiQueued(void)
+{
+    twai_status_info_t status;
+
+    CHECK_EQ(twai_get_status_info_v2(hostController(0), &status), ESP_OK);
+    return status.msgs_to_tx;
+}
+
+static bool buffersFree(void)
+{
+    uint16_t i;
+
+    for (i = 0U; i < TX_SIZE; i++)
+    {
+        if (txArray[i].bufferFull)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void)
+{
+    /* pending identifiers in scrambled order, sync TPDOs marked */
+    static const uint16_t idents[] = {0x385, 0x181, 0x705, 0x285, 0x182, 0x605, 0x080,
+                                      0x1A0, 0x480, 0x190, 0x581, 0x281, 0x100, 0x0FF};
+    static const bool_t sync[] = {false, true, false, false, true, false, false,
+                                  false, false, true, false, false, false, false};
+    const uint16_t nPending = sizeof(idents) / sizeof(idents[0]);
+    uint16_t expected[TX_SIZE];
+    uint16_t nExpected = 0U;
+    hostPort_t *node = hostNodeOpen(64, 4);
+    twai_message_t msg;
+    uint16_t i, j;
+
+    CHECK(node != NULL);
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, 1, txArray, TX_SIZE, 1000), CO_ERROR_NO);
+    CO_CANsetNormalMode(&CANmodule);
+    hostBusHold(true);
+
+    /* Occupy TWAI queue and CO_txTask with frames of low priority */
+    for (i = 0U; i < IN_FLIGHT; i++)
+    {
+        CO_CANtx_t *buffer = CO_CANtxBufferInit(&CANmodule, i, 0x7F0 + i, false, 1, false);
+
+        buffer->data[0] = (uint8_t)i;
+        CHECK_EQ(CO_CANsend(&CANmodule, buffer), CO_ERROR_NO);
+        expected[nExpected++] = 0x7F0 + i;
+    }
+    CHECK(WAIT_FOR((txCount() == 0U) && (twaiQueued() == IN_FLIGHT - 1U), 2000));
+
+    /* These stay pending */
+    for (i = 0U; i < nPending; i++)
+    {
+        CO_CANtx_t *buffer = CO_CANtxBufferInit(&CANmodule, IN_FLIGHT + i, idents[i], false, 1, sync[i]);
+
+        buffer->data[0] = (uint8_t)(IN_FLIGHT + i);
+        CHECK_EQ(CO_CANsend(&CANmodule, buffer), CO_ERROR_NO);
+    }
+    hostSleep_us(20000);
+    CHECK_EQ(txCount(), nPending);
+
+    /* Pending buffer is still full, new data goes with the same frame */
+    txArray[IN_FLIGHT].data[0] = 0xAA;
+    CHECK_EQ(CO_CANsend(&CANmodule, &txArray[IN_FLIGHT]), CO_ERROR_TX_OVERFLOW);
+    CHECK_EQ(txCount(), nPending);
+
+    /* Synchronous TPDOs are dropped */
+    CO_CANclearPendingSyncPDOs(&CANmodule);
+    CHECK((CANmodule.CANerrorStatus & CO_CAN_ERRTX_PDO_LATE) != 0U);
+    for (i = 0U; i < nPending; i++)
+    {
+        if (sync[i])
+        {
+            CHECK(!txArray[IN_FLIGHT + i].bufferFull);
+        }
+    }
+    CHECK_EQ(txCount(), nPending - 3U);
+
+    /* Remaining pending buffers go out sorted by identifier */
+    for (i = 0U; i < nPending; i++)
+    {
+        if (!sync[i])
+        {
+            for (j = nExpected; (j > IN_FLIGHT) && (expected[j - 1U] > idents[i]); j--)
+            {
+                expected[j] = expected[j - 1U];
+            }
+            expected[j] = idents[i];
+            nExpected++;
+        }
+    }
+
+    hostBusHold(false);
+    for (i = 0U; i < nExpected; i++)
+    {
+        CHECK_EQ(hostNodeReceive(node, &msg, NULL, 2000), ESP_OK);
+        if (msg.identifier != expected[i])
+        {
+            fprintf(stderr, "frame %d: ident 0x%03lx, expected 0x%03x\n", i, (unsigned long)msg.identifier, expected[i]);
+            exit(1);
+        }
+        if (msg.identifier == idents[0])
+        {
+            CHECK_EQ(msg.data[0], 0xAA);
+        }
+    }
+    CHECK_EQ(hostNodeReceive(node, &msg, NULL, 50), ESP_ERR_TIMEOUT);
+    CHECK(WAIT_FOR(buffersFree(), 1000));
+    CHECK_EQ(txCount(), 0U);
+    for (i = 0U; i < CO_CAN_TX_PENDING_WORDS; i++)
+    {
+        CHECK_EQ(CANmodule.txPending[i], 0U);
+    }
+
+    /* Communication reset drops pending buffers, count starts from zero */
+    hostBusHold(true);
+    for (i = 0U; i < TX_SIZE; i++)
+    {
+        CHECK_EQ(CO_CANsend(&CANmodule, &txArray[i]), CO_ERROR_NO);
+    }
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, 1, txArray, TX_SIZE, 1000), CO_ERROR_NO);
+    CO_CANsetNormalMode(&CANmodule);
+    CHECK_EQ(txCount(), 0U);
+    hostBusHold(false);
+    CHECK(hostBusWaitIdle(2000));
+    CHECK_EQ(txCount(), 0U);
+
+    CO_CANmodule_disable(&CANmodule);
+    hostNodeClose(node);
+    TEST_PASS("test_tx_pending");
+}
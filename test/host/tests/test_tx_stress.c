@@ -0,0 +1,131 @@
+/*
+ * Several threads call CO_CANsend() on their own TX buffers concurrently with
+ * CO_txTask, each buffer again as soon as it is free. Every accepted frame
+ * reaches the bus exactly once and the pending bookkeeping returns to zero.
+ *
+ * @file        test_tx_stress.c
+ * @author      Sicris Embay
+ * @copyright   2023 Sicris Embay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include "301/CO_driver.h"
+#include "test_common.h"
+
+#define PRODUCERS 4U
+#define BUFFERS_PER_PRODUCER 8U
+#define TX_SIZE (PRODUCERS * BUFFERS_PER_PRODUCER)
+#define ROUNDS 5000U
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[1];
+static CO_CANtx_t txArray[TX_SIZE];
+static uint32_t sent[TX_SIZE];
+static uint32_t received[TX_SIZE];
+
+static void *producer(void *arg)
+{
+    uint32_t first = (uint32_t)(uintptr_t)arg * BUFFERS_PER_PRODUCER;
+    uint32_t round, i;
+
+    for (round = 0U; round < ROUNDS; round++)
+    {
+        for (i = first; i < (first + BUFFERS_PER_PRODUCER); i++)
+        {
+            /* retry, while the buffer is still full from previous round */
+            while (CO_CANsend(&CANmodule, &txArray[i]) != CO_ERROR_NO)
+            {
+                sched_yield();
+            }
+            sent[i]++;
+        }
+    }
+    return NULL;
+}
+
+static bool drained(void)
+{
+    uint32_t i;
+
+    if (__atomic_load_n(&CANmodule.CANtxCount, __ATOMIC_RELAXED) != 0U)
+    {
+        return false;
+    }
+    for (i = 0U; i < TX_SIZE; i++)
+    {
+        if (txArray[i].bufferFull)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void)
+{
+    hostPort_t *node = hostNodeOpen(PRODUCERS * BUFFERS_PER_PRODUCER * ROUNDS, 4);
+    pthread_t threads[PRODUCERS];
+    uint32_t total = 0U;
+    twai_message_t msg;
+    uint32_t i;
+
+    CHECK(node != NULL);
+    CHECK_EQ(CO_CANmodule_init(&CANmodule, NULL, rxArray, 1, txArray, TX_SIZE, 1000), CO_ERROR_NO);
+    CO_CANsetNormalMode(&CANmodule);
+    for (i = 0U; i < TX_SIZE; i++)
+    {
+        /* identifiers interleave between producers */
+        CHECK(CO_CANtxBufferInit(&CANmodule, i, 0x180 + (i % PRODUCERS) * 0x10 + i / PRODUCERS, false, 1, false) != NULL);
+    }
+
+    for (i = 0U; i < PRODUCERS; i++)
+    {
+        CHECK_EQ(pthread_create(&threads[i], NULL, producer, (void *)(uintptr_t)i), 0);
+    }
+    for (i = 0U; i < PRODUCERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* No frame is left behind after the last CO_CANsend() */
+    CHECK(WAIT_FOR(drained(), 1000));
+    CHECK(hostBusWaitIdle(1000));
+    while (hostNodeReceive(node, &msg, NULL, 0) == ESP_OK)
+    {
+        for (i = 0U; i < TX_SIZE; i++)
+        {
+            if (txArray[i].ident == msg.identifier)
+            {
+                received[i]++;
+            }
+        }
+    }
+    for (i = 0U; i < TX_SIZE; i++)
+    {
+        if (received[i] != sent[i])
+        {
+            fprintf(stderr, "buffer %lu: %lu frames accepted, %lu on the bus\n",
+                    (unsigned long)i, (unsigned long)sent[i], (unsigned long)received[i]);
+            exit(1);
+        }
+        total += sent[i];
+    }
+    CHECK_EQ(total, TX_SIZE * ROUNDS);
+
+    CO_CANmodule_disable(&CANmodule);
+    hostNodeClose(node);
+    TEST_PASS("test_tx_stress");
+}
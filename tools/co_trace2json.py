@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Convert CO_traceDump() console output to Chrome trace JSON.
+
+Usage: co_trace2json.py monitor.log > trace.json
+
+Open the result in chrome://tracing or https://ui.perfetto.dev. Lines not
+starting with "CO_TRACE," are ignored, so a whole idf.py monitor log can be
+passed.
+"""
+
+import json
+import sys
+
+# (name, track, phase) indexed by CO_trace_event_t, see port/CO_trace.h
+EVENTS = [
+    ("CAN send", "CO_CANsend", "i"),
+    ("CAN send overflow", "CO_CANsend", "i"),
+    ("transmit", "CO_tx", "B"),
+    ("transmit", "CO_tx", "E"),
+    ("receive", "CO_rx", "B"),
+    ("receive", "CO_rx", "E"),
+    ("CO_process", "CO_main", "B"),
+    ("CO_process", "CO_main", "E"),
+    ("SYNC", "CO_timer", "B"),
+    ("SYNC", "CO_timer", "E"),
+    ("RPDO", "CO_timer", "B"),
+    ("RPDO", "CO_timer", "E"),
+    ("TPDO", "CO_timer", "B"),
+    ("TPDO", "CO_timer", "E"),
+    ("CO_CANmodule_process", "CO_main", "B"),
+    ("CO_CANmodule_process", "CO_main", "E"),
+]
+
+ARG_NAMES = {
+    0: "ident", 1: "ident", 2: "ident", 3: "err", 4: "ident", 5: "index",
+    7: "reset", 9: "syncWas", 15: "CANerrorStatus",
+}
+
+
+def convert(lines):
+    events = []
+    tracks = {}
+    offset = 0
+    previous = None
+
+    for line in lines:
+        start = line.find("CO_TRACE,")
+        if start < 0:
+            continue
+        try:
+            _, time_us, event, core, arg = line[start:].strip().split(",")[:5]
+            time_us, event, core, arg = int(time_us), int(event), int(core), int(arg)
+        except ValueError:
+            continue
+        if event >= len(EVENTS):
+            continue
+
+        # time_us is 32 bit and wraps after about 71 minutes
+        if previous is not None and time_us + offset < previous - (1 << 31):
+            offset += 1 << 32
+        previous = time_us + offset
+
+        name, track, phase = EVENTS[event]
+        if phase == "i":
+            track = "%s core%d" % (track, core)
+        tid = tracks.setdefault(track, len(tracks) + 1)
+        record = {"name": name, "ph": phase, "ts": previous, "pid": 1, "tid": tid}
+        if phase == "i":
+            record["s"] = "t"
+        if event in ARG_NAMES:
+            value = arg
+            if ARG_NAMES[event] in ("ident", "CANerrorStatus"):
+                value = "0x%X" % arg
+            record["args"] = {ARG_NAMES[event]: value}
+        events.append(record)
+
+    for track, tid in tracks.items():
+        events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": tid,
+                       "args": {"name": track}})
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], errors="replace") as f:
+            trace = convert(f)
+    else:
+        trace = convert(sys.stdin)
+    json.dump(trace, sys.stdout, indent=1)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()